@@ -13,57 +13,95 @@
 #include "eb_adc.h"
 #include "fx.h"
 #include "dsp_lib.h"
+#include "cpuload.h"
+#include "telring.h"
+#include "jobpool.h"
+#include "tempo.h"
+
+/* output samples per scope point */
+#define AUDIO_SCOPE_DEC (FRAMESZ/TELRING_SCOPE)
 
 static const char* TAG = "audio";
-int16_t audio_sl[4];
-uint64_t audio_load[3];
 int16_t audio_mute_state, audio_mute_cnt;
 int16_t *rxbuf = NULL;
-int16_t prc[2*FRAMESZ];
+int16_t prc[2*FRAMESZ] DSP_VEC;
 uint32_t frq[2] = { 0x02aaaaaa, 0}, phs[2] = { 0, 0};
 
+/* dry path delay to match pipelined effects */
+static int16_t audio_dry[2][2*FRAMESZ] DSP_VEC;
+static uint8_t audio_dry_idx;
+
+/* start of the last block, for the period */
+static uint32_t audio_last_cyc;
+
 /*
  * NOTE: ESP32 HW interleaves stereo R/L/R/L with R @ index 0
  * (opposite of most other systems)
  */
  
 /*
- * signal level calc
+ * signal level & clip calc
  */
-void IRAM_ATTR level_calc(int16_t sig, int16_t *level)
+void IRAM_ATTR level_calc(int16_t sig, telring_rec *rec, uint8_t chl)
 {
+	/* count full scale */
+	if((sig == INT16_MAX) || (sig == INT16_MIN))
+		rec->clip[chl]++;
+	
 	/* rectify */
-	sig = (sig < 0) ? -sig : sig;
+	sig = (sig < 0) ? (sig == INT16_MIN ? INT16_MAX : -sig) : sig;
 
-	/* peak hold - externally reset */
-	if(*level < sig)
-		*level = sig;
+	/* peak for this block */
+	if(rec->peak[chl] < sig)
+		rec->peak[chl] = sig;
 }
 
 /*
  * Audio processing callbacks
  */
-void audio_proc_cb(int16_t *dst, int16_t *src, uint32_t len)
+void IRAM_ATTR audio_proc_cb(int16_t *dst, int16_t *src, uint32_t len)
 {
 	uint8_t i;
 	int32_t wet, dry, mix;
+	int16_t *drysrc;
+	uint32_t cyc = esp_cpu_get_cycle_count();
+	telring_rec rec;
 	
-	/* update start time for load calcs */
-	audio_load[2] = audio_load[0];
-	audio_load[0] = esp_timer_get_time();
+	/* start of block for load calcs */
+	memset(&rec, 0, sizeof(telring_rec));
+	rec.period = cyc - audio_last_cyc;
+	audio_last_cyc = cyc;
 	
 	len >>= 2;	// len input is in bytes - we need stereo 16-bit samples
 	
+	/* results from background jobs land between blocks */
+	jobpool_complete();
+	
+	/* CVs for this block */
+	eb_adc_block();
+	
+	/* sync & tap tempo */
+	tempo_block();
+	
 	/* check input levels */
 	for(i=0;i<len;i++)
 	{
-		level_calc(src[2*i], &audio_sl[0]);
-		level_calc(src[2*i+1], &audio_sl[1]);
+		level_calc(src[2*i], &rec, 0);
+		level_calc(src[2*i+1], &rec, 1);
 	}
 	
 	/* process the selected algorithm */
 	fx_proc(prc, src, len);
 	
+	/* line dry up w/ the effect */
+	drysrc = src;
+	if(fx_get_latency())
+	{
+		memcpy(audio_dry[audio_dry_idx], src, 2*len*sizeof(int16_t));
+		audio_dry_idx ^= 1;
+		drysrc = audio_dry[audio_dry_idx];
+	}
+	
 	/* set W/D mix gain */	
 	wet = adc_val[0];
 	dry = 0xfff - wet;
@@ -72,10 +110,10 @@ void audio_proc_cb(int16_t *dst, int16_t *src, uint32_t len)
 	for(i=0;i<len;i++)
 	{
 		/* W/D with saturation */
-		mix = prc[2*i] * wet + src[2*i] * dry;
-		dst[2*i] = dsp_ssat16(mix>>12);
-		mix = prc[2*i+1] * wet + src[2*i+1] * dry;
-		dst[2*i+1] = dsp_ssat16(mix>>12);
+		mix = q12_mac(q12_mac(0, prc[2*i], wet), drysrc[2*i], dry);
+		dst[2*i] = q12_sat16(mix);
+		mix = q12_mac(q12_mac(0, prc[2*i+1], wet), drysrc[2*i+1], dry);
+		dst[2*i+1] = q12_sat16(mix);
 		
 		/* handle muting */
 		switch(audio_mute_state)
@@ -122,12 +160,18 @@ void audio_proc_cb(int16_t *dst, int16_t *src, uint32_t len)
 		}
 	
 		/* check output levels */
-		level_calc(dst[2*i], &audio_sl[2]);
-		level_calc(dst[2*i+1], &audio_sl[3]);
+		level_calc(dst[2*i], &rec, 2);
+		level_calc(dst[2*i+1], &rec, 3);
+		
+		/* scope */
+		if(!(i % AUDIO_SCOPE_DEC) && (i/AUDIO_SCOPE_DEC < TELRING_SCOPE))
+			rec.scope[i/AUDIO_SCOPE_DEC] = (dst[2*i] + dst[2*i+1]) >> 1;
 	}
 	
-	/* update end timer */
-	audio_load[1] = esp_timer_get_time();
+	/* end of block - publish for the UI */
+	rec.cyc = esp_cpu_get_cycle_count() - cyc;
+	cpuload_audio_add(rec.cyc);
+	telring_push(&rec);
 }
 
 /*
@@ -139,8 +183,7 @@ esp_err_t audio_init(void)
 	fx_init();
 	
 	/* init state */
-	audio_sl[0] = audio_sl[1] = audio_sl[2] = audio_sl[3] = 0;
-	audio_load[0] = audio_load[1] = audio_load[2] = 0;
+	audio_last_cyc = esp_cpu_get_cycle_count();
 	audio_mute_state = 2;	// start up  muted
 	audio_mute_cnt = 0;
 	memset(prc, 0, sizeof(int16_t)*FRAMESZ);
@@ -184,8 +227,5 @@ void audio_mute(uint8_t enable)
  */
 int16_t audio_get_level(uint8_t idx)
 {
-	idx &= 3;
-	int16_t result = audio_sl[idx];
-	audio_sl[idx] = 0;
-	return result;
+	return telring_take_peak(idx & 3);
 }
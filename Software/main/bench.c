@@ -0,0 +1,572 @@
+/*
+ * bench.c - on-target cycle counts for DSP kernels
+ * 10-18-26
+ *
+ * Enable with BENCHMARK in main.h - runs once at startup before audio
+ * starts and logs the best-case cycles over a number of passes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "esp_cpu.h"
+#include "fx.h"
+#include "sdkconfig.h"
+#include "dsp_fixed.h"
+#include "ifilter_mg4_v1.h"
+#include "fft.h"
+#include "fx_cdl.h"
+#include "fork.h"
+#include "jobpool.h"
+#include "esp_timer.h"
+#include "bench.h"
+
+#ifdef BENCHMARK
+
+#define BENCH_PASSES 64
+#define BENCH_DLY_SZ (1024*1024)
+
+/* PSRAM walked for the cache test - well over the data cache size */
+#define BENCH_PSRAM_SZ (256*1024)
+#define BENCH_PSRAM_STRIDE (4096+DSP_CACHE_ALIGN*8)
+
+/* random operand pairs for the fixed point check */
+#define BENCH_FIXED_VECS 200000
+
+static const char* TAG = "bench";
+
+static int16_t bench_src[2*FRAMESZ] DSP_VEC, bench_dst[2*FRAMESZ] DSP_VEC;
+
+/*
+ * fill source buffer with noise
+ */
+static void bench_fill(int16_t *buf, uint32_t len)
+{
+	uint32_t seed = 0x12345678;
+	
+	while(len--)
+	{
+		seed = seed * 1664525 + 1013904223;
+		*buf++ = seed >> 16;
+	}
+}
+
+/*
+ * plain C saturation, as dsp_fixed.h replaced it
+ */
+static int32_t bench_clamp(int32_t x, int bits)
+{
+	int32_t hi = (1<<bits)-1, lo = -(1<<bits);
+	
+	return x > hi ? hi : (x < lo ? lo : x);
+}
+
+/* count a mismatch, logging the first few */
+#define BENCH_FIXED_CHK(name, got, want) \
+	if((got) != (want) && (fails++ < 8)) \
+		ESP_LOGW(TAG, "fixed %s(%"PRId32", %"PRId32"): got %"PRId32" want %"PRId32, \
+			name, x, y, (int32_t)(got), (int32_t)(want));
+
+/*
+ * Fixed point helpers - the Xtensa asm in dsp_fixed.h against the plain C
+ * it stands for, over edge values & random operands. The host tests only
+ * ever build the portable versions, so this is the check on the asm.
+ */
+static void bench_fixed(void)
+{
+	static const int32_t edges[] =
+	{
+		0, 1, -1, 4095, 4096, -4096, 32767, -32768, 32766, -32767,
+		65535, -65536, 8388607, -8388608, 8388608, 0x3fffffff, -0x40000000,
+		0x7fffffff, (int32_t)0x80000000, 0x7ffffffe, (int32_t)0x80000001,
+	};
+	const uint32_t ne = sizeof(edges)/sizeof(edges[0]);
+	uint32_t seed = 0x12345678, i, fails = 0;
+	int32_t x, y, acc;
+	int16_t x16, y16;
+	
+	for(i=0;i<ne*ne+BENCH_FIXED_VECS;i++)
+	{
+		if(i < ne*ne)
+		{
+			x = edges[i/ne];
+			y = edges[i%ne];
+		}
+		else
+		{
+			seed = seed * 1664525 + 1013904223;
+			x = seed;
+			seed = seed * 1664525 + 1013904223;
+			y = seed;
+		}
+		x16 = x;
+		y16 = y;
+		acc = x>>2;
+		
+		BENCH_FIXED_CHK("dsp_ssat16", dsp_ssat16(x), bench_clamp(x, 15))
+		BENCH_FIXED_CHK("__SSAT7", __SSAT(x, 7), bench_clamp(x, 7))
+		BENCH_FIXED_CHK("__SSAT22", __SSAT(x, 22), bench_clamp(x, 22))
+		BENCH_FIXED_CHK("q15_mul", q15_mul(x16, y16), bench_clamp(((int32_t)x16 * y16)>>15, 15))
+		BENCH_FIXED_CHK("q15_mac", q15_mac(acc, x16, y16), acc + (int32_t)x16 * y16)
+		BENCH_FIXED_CHK("q31_mulh", q31_mulh(x, y), ((int64_t)x * y)>>32)
+		BENCH_FIXED_CHK("q31_mul", q31_mul(x, y), ((int64_t)x * y)>>31)
+		BENCH_FIXED_CHK("s823_mul", s823_mul(x, y), ((int64_t)x * y)>>23)
+	}
+	
+	if(fails)
+		ESP_LOGE(TAG, "fixed: asm vs C %"PRIu32" mismatches", fails);
+	else
+		ESP_LOGI(TAG, "fixed: asm vs C match over %"PRIu32" operand pairs", i);
+}
+
+/*
+ * Ladder filter - per-sample mono calls vs stereo block
+ */
+static void bench_mg4(void)
+{
+	ifmg4_state fs[2];
+	ifmg4_stereo_state fsb;
+	uint32_t i, j, t, mono, block, mod;
+	int16_t fcm[FRAMESZ];
+	uint8_t mode;
+	
+	init_ifilter_mg4_lut();
+	for(mode=0;mode<4;mode++)
+	{
+		/* 1 is bypass - nothing to measure */
+		if(mode == 1)
+			continue;
+		
+		init_ifilter_mg4(&fs[0]);
+		init_ifilter_mg4(&fs[1]);
+		init_ifilter_mg4_block(&fsb);
+		mono = block = UINT32_MAX;
+		
+		for(i=0;i<BENCH_PASSES;i++)
+		{
+			/* previous per-sample path */
+			t = esp_cpu_get_cycle_count();
+			set_ifilter_mg4(&fs[0], 8192, 16384, mode);
+			dupe_ifilter_mg4(&fs[0], &fs[1]);
+			for(j=0;j<FRAMESZ;j++)
+			{
+				bench_dst[2*j] = ifilter_mg4(&fs[0], bench_src[2*j]);
+				bench_dst[2*j+1] = ifilter_mg4(&fs[1], bench_src[2*j+1]);
+			}
+			t = esp_cpu_get_cycle_count() - t;
+			mono = t < mono ? t : mono;
+			
+			/* stereo block */
+			t = esp_cpu_get_cycle_count();
+			set_ifilter_mg4_block(&fsb, 8192, 16384, mode);
+			ifilter_mg4_block(&fsb, bench_dst, bench_src, FRAMESZ);
+			t = esp_cpu_get_cycle_count() - t;
+			block = t < block ? t : block;
+		}
+		
+		/* stereo block w/ per-frame cutoff ramp */
+		mod = UINT32_MAX;
+		for(j=0;j<FRAMESZ;j++)
+			fcm[j] = 4096 + 64*j;
+		for(i=0;i<BENCH_PASSES;i++)
+		{
+			t = esp_cpu_get_cycle_count();
+			ifilter_mg4_block_mod(&fsb, bench_dst, bench_src, fcm, FRAMESZ);
+			t = esp_cpu_get_cycle_count() - t;
+			mod = t < mod ? t : mod;
+		}
+		
+		/* per sample to a tenth of a cycle */
+		mono = 10*mono/(2*FRAMESZ);
+		block = 10*block/(2*FRAMESZ);
+		mod = 10*mod/(2*FRAMESZ);
+		ESP_LOGI(TAG, "mg4 mode %d: before %"PRIu32".%"PRIu32" cyc/smpl, after %"PRIu32".%"PRIu32" cyc/smpl, %"PRIu32"%%",
+			mode, mono/10, mono%10, block/10, block%10, 100*block/mono);
+		ESP_LOGI(TAG, "mg4 mode %d: modulated %"PRIu32".%"PRIu32" cyc/smpl", mode, mod/10, mod%10);
+	}
+}
+
+/*
+ * Clean delay - per-sample PSRAM access vs. SRAM staged bursts at short
+ * and long range, w/ the delay kept moving so the taps are crossfading
+ */
+static void bench_cdl(void)
+{
+	const char *rng_names[] = {"short", "long"};
+	uint32_t *mem, i, t, cyc[2];
+	uint8_t rng, staged, cfg = fx_cd_staged;
+	void *blk;
+	
+	mem = heap_caps_malloc(FX_MAX_MEM, MALLOC_CAP_INTERNAL);
+	fx_ext_sz = BENCH_DLY_SZ;
+	fx_ext_buffer = heap_caps_malloc(fx_ext_sz, MALLOC_CAP_SPIRAM);
+	if(!mem || !fx_ext_buffer)
+	{
+		ESP_LOGW(TAG, "cdl: no memory");
+		goto done;
+	}
+	
+	/* ADC isn't running yet so params can be forced */
+	adc_param[2] = 2048;
+	for(rng=0;rng<2;rng++)
+	{
+		adc_param[3] = rng ? 0xfff : 0;
+		for(staged=0;staged<2;staged++)
+		{
+			fx_cd_staged = staged;
+			blk = fx_cdr_struct.init(mem);
+			cyc[staged] = 0;
+			for(i=0;i<4*BENCH_PASSES;i++)
+			{
+				adc_param[1] = (i & 1) ? 1000 : 1100;
+				t = esp_cpu_get_cycle_count();
+				fx_cdr_struct.proc(blk, bench_dst, bench_src, FRAMESZ);
+				t = esp_cpu_get_cycle_count() - t;
+				cyc[staged] += t;
+			}
+			cyc[staged] /= 4*BENCH_PASSES;
+		}
+		
+		ESP_LOGI(TAG, "cdl %s: per-sample %"PRIu32" cyc/smpl, staged %"PRIu32" cyc/smpl, %"PRIu32"%%",
+			rng_names[rng], cyc[0]/(2*FRAMESZ), cyc[1]/(2*FRAMESZ), 100*cyc[1]/cyc[0]);
+	}
+	
+	/* compressed storage at long range, staged */
+	fx_cd_staged = 1;
+	blk = fx_ldr_struct.init(mem);
+	cyc[0] = 0;
+	for(i=0;i<4*BENCH_PASSES;i++)
+	{
+		adc_param[1] = (i & 1) ? 1000 : 1100;
+		t = esp_cpu_get_cycle_count();
+		fx_ldr_struct.proc(blk, bench_dst, bench_src, FRAMESZ);
+		t = esp_cpu_get_cycle_count() - t;
+		cyc[0] += t;
+	}
+	cyc[0] /= 4*BENCH_PASSES;
+	ESP_LOGI(TAG, "cdl long 8-bit: %"PRIu32" cyc/smpl", cyc[0]/(2*FRAMESZ));
+	fx_cd_staged = cfg;
+	
+done:
+	free(mem);
+	free(fx_ext_buffer);
+	fx_ext_buffer = NULL;
+	fx_ext_sz = 0;
+}
+
+/*
+ * Alignment - block copies in SRAM from a vector aligned source vs. one
+ * a halfword off, and PSRAM block reads that start on a cache line vs.
+ * half a line in, w/ a stride that misses the cache every time
+ */
+static void bench_align(void)
+{
+	uint8_t *sram, *psram;
+	uint32_t i, t, ofs, sz, pos, cyc[2];
+	uint8_t mis;
+	
+	sz = 2*FRAMESZ*sizeof(int16_t);
+	sram = heap_caps_aligned_alloc(DSP_CACHE_ALIGN, sz + DSP_CACHE_ALIGN, MALLOC_CAP_INTERNAL);
+	psram = heap_caps_aligned_alloc(DSP_CACHE_ALIGN, BENCH_PSRAM_SZ + DSP_CACHE_ALIGN, MALLOC_CAP_SPIRAM);
+	if(!sram || !psram)
+	{
+		ESP_LOGW(TAG, "align: no memory");
+		goto done;
+	}
+	memset(sram, 0, sz + DSP_CACHE_ALIGN);
+	memset(psram, 0, BENCH_PSRAM_SZ + DSP_CACHE_ALIGN);
+	
+	/* SRAM - does memcpy care when src & dst alignment disagree */
+	for(mis=0;mis<2;mis++)
+	{
+		ofs = mis ? sizeof(int16_t) : 0;
+		cyc[mis] = UINT32_MAX;
+		for(i=0;i<BENCH_PASSES;i++)
+		{
+			t = esp_cpu_get_cycle_count();
+			memcpy(bench_dst, sram + ofs, sz);
+			t = esp_cpu_get_cycle_count() - t;
+			cyc[mis] = t < cyc[mis] ? t : cyc[mis];
+		}
+	}
+	ESP_LOGI(TAG, "align sram copy: aligned %"PRIu32" cyc/blk, +2 bytes %"PRIu32" cyc/blk, %"PRIu32"%%",
+		cyc[0], cyc[1], 100*cyc[1]/cyc[0]);
+	
+	/* PSRAM - average since every block is a cold miss */
+	for(mis=0;mis<2;mis++)
+	{
+		ofs = mis ? DSP_CACHE_ALIGN/2 : 0;
+		cyc[mis] = 0;
+		pos = 0;
+		for(i=0;i<4*BENCH_PASSES;i++)
+		{
+			t = esp_cpu_get_cycle_count();
+			memcpy(bench_dst, psram + pos + ofs, sz);
+			t = esp_cpu_get_cycle_count() - t;
+			cyc[mis] += t;
+			pos = (pos + BENCH_PSRAM_STRIDE) % (BENCH_PSRAM_SZ - sz);
+			pos &= ~(DSP_CACHE_ALIGN-1);
+		}
+		cyc[mis] /= 4*BENCH_PASSES;
+	}
+	ESP_LOGI(TAG, "align psram read: line aligned %"PRIu32" cyc/blk, straddling %"PRIu32" cyc/blk, %"PRIu32"%%",
+		cyc[0], cyc[1], 100*cyc[1]/cyc[0]);
+	
+done:
+	free(sram);
+	free(psram);
+}
+
+/*
+ * Fork-join - two independent ladder filters in sequence on one core vs.
+ * one on each, plus the round trip for an empty job. Runs as a task on
+ * core 1 so the worker has core 0 to itself.
+ */
+static ifmg4_stereo_state bench_fs[2];
+static int16_t bench_dst2[2*FRAMESZ] DSP_VEC;
+static TaskHandle_t bench_caller;
+
+static void IRAM_ATTR bench_fork_flt(void *arg)
+{
+	ifilter_mg4_block(&bench_fs[1], bench_dst2, bench_src, FRAMESZ);
+}
+
+static void bench_fork_task(void *pvParameter)
+{
+	uint32_t i, t, seq, par, ping, ping_max;
+	
+	init_ifilter_mg4_lut();
+	for(i=0;i<2;i++)
+	{
+		init_ifilter_mg4_block(&bench_fs[i]);
+		set_ifilter_mg4_block(&bench_fs[i], 4096 + 8192*i, 16384, MG4_LP);
+	}
+	seq = par = ping = UINT32_MAX;
+	ping_max = 0;
+	
+	for(i=0;i<BENCH_PASSES;i++)
+	{
+		/* both on this core */
+		t = esp_cpu_get_cycle_count();
+		ifilter_mg4_block(&bench_fs[0], bench_dst, bench_src, FRAMESZ);
+		bench_fork_flt(NULL);
+		t = esp_cpu_get_cycle_count() - t;
+		seq = t < seq ? t : seq;
+		
+		/* one on each */
+		t = esp_cpu_get_cycle_count();
+		fork_run(bench_fork_flt, NULL);
+		ifilter_mg4_block(&bench_fs[0], bench_dst, bench_src, FRAMESZ);
+		fork_join();
+		t = esp_cpu_get_cycle_count() - t;
+		par = t < par ? t : par;
+		
+		/* handoff alone */
+		t = fork_ping();
+		ping = t < ping ? t : ping;
+		ping_max = t > ping_max ? t : ping_max;
+		
+		vTaskDelay(1);
+	}
+	
+	ESP_LOGI(TAG, "fork dual mg4: sequential %"PRIu32" cyc/blk, forked %"PRIu32" cyc/blk, %"PRIu32"%%",
+		seq, par, 100*par/seq);
+	ESP_LOGI(TAG, "fork wake round trip: min %"PRIu32" cyc, max %"PRIu32" cyc", ping, ping_max);
+	fork_log();
+	
+	xTaskNotifyGive(bench_caller);
+	vTaskDelete(NULL);
+}
+
+static void bench_fork(void)
+{
+	if(fork_init() != ESP_OK)
+		return;
+	
+	bench_caller = xTaskGetCurrentTaskHandle();
+	if(xTaskCreatePinnedToCore(bench_fork_task, "bench_fork", 4096, NULL, 5, NULL, 1) != pdPASS)
+	{
+		ESP_LOGW(TAG, "fork: no task");
+		return;
+	}
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+
+/*
+ * one size of one transform, best of several passes
+ */
+static uint32_t bench_fft_run(int16_t *buf, uint32_t n, uint8_t real, int8_t *exp)
+{
+	uint32_t i, t, best = UINT32_MAX;
+	
+	for(i=0;i<BENCH_PASSES/8;i++)
+	{
+		bench_fill(buf, real ? n : 2*n);
+		t = esp_cpu_get_cycle_count();
+		if(real)
+			fft_real(buf, n, exp);
+		else
+			fft_cplx(buf, n, 0, exp);
+		t = esp_cpu_get_cycle_count() - t;
+		best = t < best ? t : best;
+	}
+	return best;
+}
+
+/*
+ * FFT - complex & real at each size, w/ cost as % of one audio block. With
+ * the PIE stages built in, the C stages are timed too & the two outputs
+ * compared - they should differ by no more than a few LSBs.
+ */
+static void bench_fft(void)
+{
+	int16_t *buf;
+	uint32_t n, cplx, real, blk_cyc;
+	int8_t exp;
+#ifdef CONFIG_S3GTA_FFT_PIE
+	int16_t *ref;
+	uint32_t i, diff;
+	int8_t ref_exp;
+	
+	ref = heap_caps_aligned_alloc(DSP_VEC_ALIGN, 2*FFT_MAX_N*sizeof(int16_t), MALLOC_CAP_INTERNAL);
+#endif
+	
+	/* PIE loads need 16 byte alignment */
+	buf = heap_caps_aligned_alloc(DSP_VEC_ALIGN, 2*FFT_MAX_N*sizeof(int16_t), MALLOC_CAP_INTERNAL);
+#ifdef CONFIG_S3GTA_FFT_PIE
+	if(!buf || !ref)
+#else
+	if(!buf)
+#endif
+	{
+		ESP_LOGW(TAG, "fft: no memory");
+		goto done;
+	}
+	fft_init();
+	blk_cyc = (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000000 / SAMPLE_RATE) * FRAMESZ;
+	
+	for(n=FFT_MIN_N;n<=FFT_MAX_N;n<<=1)
+	{
+#ifdef CONFIG_S3GTA_FFT_PIE
+		/* C stages first, keeping the complex output */
+		fft_pie = 0;
+		cplx = bench_fft_run(ref, n, 0, &ref_exp);
+		real = bench_fft_run(buf, n, 1, &exp);
+		fft_pie = 1;
+		ESP_LOGI(TAG, "fft %4"PRIu32" C:   cplx %7"PRIu32" cyc %3"PRIu32"%% blk, real %7"PRIu32" cyc %3"PRIu32"%% blk",
+			n, cplx, 100*cplx/blk_cyc, real, 100*real/blk_cyc);
+		
+		cplx = bench_fft_run(buf, n, 0, &exp);
+		real = bench_fft_run(buf, n, 1, &exp);
+		ESP_LOGI(TAG, "fft %4"PRIu32" PIE: cplx %7"PRIu32" cyc %3"PRIu32"%% blk, real %7"PRIu32" cyc %3"PRIu32"%% blk",
+			n, cplx, 100*cplx/blk_cyc, real, 100*real/blk_cyc);
+		
+		/* same input to both - compare the complex outputs */
+		bench_fill(buf, 2*n);
+		fft_cplx(buf, n, 0, &exp);
+		if(exp != ref_exp)
+			ESP_LOGW(TAG, "fft %4"PRIu32": PIE exp %d, C exp %d", n, exp, ref_exp);
+		else
+		{
+			for(i=diff=0;i<2*n;i++)
+				diff = abs(buf[i]-ref[i]) > diff ? abs(buf[i]-ref[i]) : diff;
+			ESP_LOGI(TAG, "fft %4"PRIu32": PIE vs C max diff %"PRIu32" LSB", n, diff);
+		}
+#else
+		cplx = bench_fft_run(buf, n, 0, &exp);
+		real = bench_fft_run(buf, n, 1, &exp);
+		ESP_LOGI(TAG, "fft %4"PRIu32": cplx %7"PRIu32" cyc %3"PRIu32"%% blk, real %7"PRIu32" cyc %3"PRIu32"%% blk",
+			n, cplx, 100*cplx/blk_cyc, real, 100*real/blk_cyc);
+#endif
+	}
+	
+done:
+	free(buf);
+#ifdef CONFIG_S3GTA_FFT_PIE
+	free(ref);
+#endif
+}
+
+/*
+ * Job pool - a 4k real FFT offloaded to core 0 while this task stands in
+ * for the audio core, delivering completions once per block period
+ */
+#define BENCH_JOB_N 4096
+static int16_t *bench_job_buf;
+static volatile uint8_t bench_job_done;
+
+static void bench_job_run(void *arg)
+{
+	int8_t exp;
+	
+	fft_real(bench_job_buf, BENCH_JOB_N, &exp);
+}
+
+static void IRAM_ATTR bench_job_fin(void *arg)
+{
+	bench_job_done = 1;
+}
+
+static void bench_jobs(void)
+{
+	uint32_t i, t, sub_max, cmp_max, blks, blks_max;
+	int64_t blk_us, next;
+	
+	bench_job_buf = heap_caps_malloc(BENCH_JOB_N*sizeof(int16_t), MALLOC_CAP_INTERNAL);
+	if(!bench_job_buf || (jobpool_init() != ESP_OK))
+	{
+		ESP_LOGW(TAG, "jobs: not available");
+		free(bench_job_buf);
+		return;
+	}
+	blk_us = 1000000LL * FRAMESZ / SAMPLE_RATE;
+	sub_max = cmp_max = blks_max = 0;
+	
+	for(i=0;i<BENCH_PASSES/8;i++)
+	{
+		bench_fill(bench_job_buf, BENCH_JOB_N);
+		bench_job_done = 0;
+		t = esp_cpu_get_cycle_count();
+		jobpool_submit(JOB_PRIO_LOW, bench_job_run, bench_job_fin, NULL);
+		t = esp_cpu_get_cycle_count() - t;
+		sub_max = t > sub_max ? t : sub_max;
+		
+		/* block boundaries until it comes back */
+		next = esp_timer_get_time();
+		for(blks=0;!bench_job_done;blks++)
+		{
+			next += blk_us;
+			while(esp_timer_get_time() < next);
+			t = esp_cpu_get_cycle_count();
+			jobpool_complete();
+			t = esp_cpu_get_cycle_count() - t;
+			cmp_max = t > cmp_max ? t : cmp_max;
+		}
+		blks_max = blks > blks_max ? blks : blks_max;
+	}
+	
+	ESP_LOGI(TAG, "jobs fft %d: submit %"PRIu32" cyc, complete %"PRIu32" cyc, done in %"PRIu32" blocks",
+		BENCH_JOB_N, sub_max, cmp_max, blks_max);
+	jobpool_log();
+	free(bench_job_buf);
+}
+
+/*
+ * run all benchmarks
+ */
+void bench_run(void)
+{
+	ESP_LOGI(TAG, "Running benchmarks, %d passes, %d frames/block", BENCH_PASSES, FRAMESZ);
+	bench_fill(bench_src, 2*FRAMESZ);
+	bench_fixed();
+	bench_mg4();
+	bench_cdl();
+	bench_align();
+	bench_fork();
+	bench_fft();
+	bench_jobs();
+	ESP_LOGI(TAG, "Benchmarks done");
+}
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ * bench.h - on-target cycle counts for DSP kernels
+ * 10-18-26
+ */
+
+#ifndef __bench__
+#define __bench__
+
+void bench_run(void);
+
+#endif
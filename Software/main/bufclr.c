@@ -0,0 +1,188 @@
+/*
+ * bufclr.c - background clearing of PSRAM buffers via GDMA
+ * 10-18-26
+ *
+ * Effects that need a clean delay line ask for it here when they init and
+ * get back a ticket. A task on core 0 zeroes the region by async memcpy
+ * from a small block of zeroed SRAM, one chunk at a time, and the effect
+ * polls the ticket once per audio block until it's done.
+ */
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_async_memcpy.h"
+#include "esp_cache.h"
+#include "esp_heap_caps.h"
+#include "bufclr.h"
+#include "place.h"
+#include "memplan.h"
+
+/* DMA transfers in flight */
+#define BUFCLR_BACKLOG 4
+
+static const char *TAG = "bufclr";
+
+typedef struct
+{
+	uint8_t *addr;
+	size_t sz;
+	uint32_t id;
+} bufclr_req;
+
+static QueueHandle_t bufclr_q;
+static SemaphoreHandle_t bufclr_slots;
+static async_memcpy_handle_t bufclr_mcp;
+static uint8_t *bufclr_zero;
+
+/* last ticket issued & last ticket completed */
+static uint32_t bufclr_id;
+static volatile uint32_t bufclr_cmpl;
+
+/*
+ * DMA transfer done - free up a slot
+ */
+static bool IRAM_ATTR bufclr_cb(async_memcpy_handle_t mcp, async_memcpy_event_t *event, void *args)
+{
+	BaseType_t hpw = pdFALSE;
+	
+	xSemaphoreGiveFromISR(bufclr_slots, &hpw);
+	return hpw == pdTRUE;
+}
+
+/*
+ * work through clear requests
+ */
+static void bufclr_task(void *pvParameter)
+{
+	bufclr_req req;
+	esp_err_t ret;
+	size_t ofs, n;
+	uint8_t i;
+	int64_t t;
+	
+	while(1)
+	{
+		xQueueReceive(bufclr_q, &req, portMAX_DELAY);
+		t = esp_timer_get_time();
+		
+		/* push out & drop anything cached so stale lines can't land later */
+		ret = esp_cache_msync(req.addr, req.sz, ESP_CACHE_MSYNC_FLAG_DIR_C2M | ESP_CACHE_MSYNC_FLAG_INVALIDATE);
+		if(ret != ESP_OK)
+		{
+			/* DMA would race the cache - do it all by hand */
+			ESP_LOGW(TAG, "Error syncing cache: %d - clearing by hand", ret);
+			memset(req.addr, 0, req.sz);
+			ofs = req.sz;
+		}
+		else
+			ofs = 0;
+		
+		/* queue up chunks as slots free up */
+		for(;ofs<req.sz;ofs+=n)
+		{
+			n = req.sz - ofs;
+			n = n > BUFCLR_CHUNK ? BUFCLR_CHUNK : n;
+			xSemaphoreTake(bufclr_slots, portMAX_DELAY);
+			if(esp_async_memcpy(bufclr_mcp, req.addr+ofs, bufclr_zero, n, bufclr_cb, NULL) != ESP_OK)
+			{
+				/* DMA refused - do it by hand */
+				memset(req.addr+ofs, 0, n);
+				xSemaphoreGive(bufclr_slots);
+			}
+		}
+		
+		/* wait for the tail to land */
+		for(i=0;i<BUFCLR_BACKLOG;i++)
+			xSemaphoreTake(bufclr_slots, portMAX_DELAY);
+		for(i=0;i<BUFCLR_BACKLOG;i++)
+			xSemaphoreGive(bufclr_slots);
+		
+		bufclr_cmpl = req.id;
+		ESP_LOGI(TAG, "cleared %d bytes in %lld us", req.sz, esp_timer_get_time() - t);
+	}
+}
+
+/*
+ * start up DMA and the clearing task
+ */
+esp_err_t bufclr_init(void)
+{
+	async_memcpy_config_t cfg = ASYNC_MEMCPY_DEFAULT_CONFIG();
+	esp_err_t ret;
+	
+	/* zero source block */
+	bufclr_zero = memplan_get(MP_BUFCLR_ZERO, NULL);
+	if(!bufclr_zero)
+	{
+		ESP_LOGW(TAG, "Failed getting zero block");
+		return ESP_ERR_NO_MEM;
+	}
+	
+	/* GDMA memcpy w/ PSRAM destination */
+	cfg.backlog = BUFCLR_BACKLOG;
+	cfg.sram_trans_align = 4;
+	cfg.psram_trans_align = BUFCLR_ALIGN;
+	ret = esp_async_memcpy_install(&cfg, &bufclr_mcp);
+	if(ret != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Error installing async memcpy: %d", ret);
+		goto fail;
+	}
+	
+	bufclr_slots = xSemaphoreCreateCounting(BUFCLR_BACKLOG, BUFCLR_BACKLOG);
+	bufclr_q = xQueueCreate(4, sizeof(bufclr_req));
+	if(!bufclr_slots || !bufclr_q)
+	{
+		ret = ESP_ERR_NO_MEM;
+		goto fail;
+	}
+	
+	/* clear in background on the UI core */
+	if(place_task_create(PL_BUFCLR, bufclr_task, NULL, NULL) != pdPASS)
+	{
+		ret = ESP_FAIL;
+		goto fail;
+	}
+	
+	ESP_LOGI(TAG, "Buffer clear service running");
+	return ESP_OK;
+	
+fail:
+	ESP_LOGW(TAG, "Buffer clear service unavailable - clearing in foreground");
+	bufclr_q = NULL;
+	return ret;
+}
+
+/*
+ * request a region be cleared, returning a ticket for bufclr_done(). Call
+ * from task context. Falls back to memset if the service isn't running.
+ */
+uint32_t bufclr_request(void *addr, size_t sz)
+{
+	bufclr_req req;
+	
+	req.addr = addr;
+	req.sz = sz;
+	req.id = ++bufclr_id;
+	
+	if(bufclr_q)
+		xQueueSend(bufclr_q, &req, portMAX_DELAY);
+	else
+	{
+		memset(addr, 0, sz);
+		bufclr_cmpl = req.id;
+	}
+	
+	return req.id;
+}
+
+/*
+ * check if a clear request is finished - safe from the audio ISR
+ */
+uint8_t IRAM_ATTR bufclr_done(uint32_t id)
+{
+	return (int32_t)(bufclr_cmpl - id) >= 0;
+}
@@ -0,0 +1,22 @@
+/*
+ * bufclr.h - background clearing of PSRAM buffers via GDMA
+ * 10-18-26
+ */
+
+#ifndef __bufclr__
+#define __bufclr__
+
+#include "main.h"
+#include "dsp_align.h"
+
+/* alignment needed for DMA into PSRAM */
+#define BUFCLR_ALIGN DSP_DMA_ALIGN
+
+/* bytes per DMA transfer - fits in one descriptor */
+#define BUFCLR_CHUNK (63*BUFCLR_ALIGN)
+
+esp_err_t bufclr_init(void);
+uint32_t bufclr_request(void *addr, size_t sz);
+uint8_t bufclr_done(uint32_t id);
+
+#endif
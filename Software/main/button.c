@@ -10,11 +10,19 @@
 #include "esp_timer.h"
 #include "debounce.h"
 #include "button.h"
+#include "tempo.h"
 
 #define BUTTON_PIN 0
 
+/* scan period & debounce length, ms */
+#define BUTTON_DEBOUNCE 15
+
+/* hold this long to clear the tempo, ms */
+#define BUTTON_HOLD_CLEAR 2000
+
 debounce_state btn_dbs;
 uint8_t btn_fe, btn_re;
+static uint16_t btn_hold;
 
 /*
  * button scanning callback
@@ -24,6 +32,15 @@ void button_timer_callback(void *arg)
 	debounce(&btn_dbs, (!gpio_get_level(BUTTON_PIN)));
 	btn_fe |= btn_dbs.fe;
 	btn_re |= btn_dbs.re;
+	
+	/* it's the tap tempo button - the press started a debounce ago */
+	if(btn_dbs.re)
+		tempo_tap(esp_timer_get_time() - BUTTON_DEBOUNCE*1000);
+	
+	/* long press clears it */
+	btn_hold = btn_dbs.state ? btn_hold+1 : 0;
+	if(btn_hold == BUTTON_HOLD_CLEAR)
+		tempo_clear();
 }
 
 /*
@@ -36,7 +53,7 @@ esp_err_t button_init(void)
 	gpio_set_pull_mode(BUTTON_PIN, GPIO_PULLUP_ONLY);
 	
 	/* init debounce */
-	init_debounce(&btn_dbs, 15);
+	init_debounce(&btn_dbs, BUTTON_DEBOUNCE);
 	btn_fe = 0;
 	btn_re = 0;
 	
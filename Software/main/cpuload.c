@@ -0,0 +1,217 @@
+/*
+ * cpuload.c - per-core CPU load from idle time
+ * 10-18-26
+ *
+ * Idle time on each core is the run time FreeRTOS gives that core's idle
+ * task, so the idle loop still waits for interrupts as usual. Busy is
+ * whatever isn't idle, which covers everything on the core - timer & SPI
+ * ISRs, LCD busy-waits and the tick - not just the audio callback.
+ *
+ * FreeRTOS charges ISR time to the task it interrupted, so an ISR that
+ * lands in the idle task would read as idle. The audio, ADC DMA & sync
+ * jack ISRs note when they do that and their cycles are moved back to
+ * busy. The rest - timer, SPI, the tick, and the driver code around the
+ * ADC & GPIO callbacks - aren't timed, so what they take out of idle is
+ * still missed. The load page says so.
+ *
+ * The breakdown comes from the same run time stats for tasks, and the
+ * timed ISRs' own cycle counts. "other" (busy less timed ISRs & tasks) is
+ * a floor on the rest of the ISR load.
+ */
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "cpuload.h"
+
+static const char *TAG = "cpuload";
+
+volatile uint32_t cpuload_audio_cyc[2];
+volatile uint32_t cpuload_audio_idle_cyc[2];
+TaskHandle_t cpuload_idle_hdl[2];
+volatile uint32_t cpuload_isr_cyc[2];
+volatile uint32_t cpuload_isr_idle_cyc[2];
+
+/* state at the start of the window */
+static int64_t cpuload_time;
+static uint32_t cpuload_audio_prev[2], cpuload_audio_idle_prev[2];
+static uint32_t cpuload_isr_prev[2], cpuload_isr_idle_prev[2];
+
+/* idle task run time over the window, us */
+static uint32_t cpuload_idle_us[2];
+
+static cpuload_info cpuload;
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static TaskStatus_t cpuload_snap[CPULOAD_MAX_TASKS];
+static TaskHandle_t cpuload_hdl[CPULOAD_MAX_TASKS];
+static configRUN_TIME_COUNTER_TYPE cpuload_run[CPULOAD_MAX_TASKS];
+static uint8_t cpuload_num_hdl;
+#endif
+
+/*
+ * find the idle tasks
+ */
+esp_err_t cpuload_init(void)
+{
+	uint8_t i;
+	
+#ifndef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	ESP_LOGW(TAG, "CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS not set - no load figures");
+	return ESP_ERR_NOT_SUPPORTED;
+#endif
+	
+	for(i=0;i<2;i++)
+		cpuload_idle_hdl[i] = xTaskGetIdleTaskHandleForCore(i);
+	
+	cpuload_time = esp_timer_get_time();
+	ESP_LOGI(TAG, "Measuring idle time from run time stats");
+	return ESP_OK;
+}
+
+/*
+ * ratio in 0.1%
+ */
+static uint16_t cpuload_permil(uint64_t part, uint64_t whole)
+{
+	part = whole ? 1000*part/whole : 0;
+	return part > 1000 ? 1000 : part;
+}
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+/*
+ * run time of each task over the window, busiest first
+ */
+static void cpuload_tasks(uint32_t window_us)
+{
+	configRUN_TIME_COUNTER_TYPE run;
+	UBaseType_t n, i;
+	cpuload_task *t, tmp;
+	uint8_t j;
+	
+	n = uxTaskGetSystemState(cpuload_snap, CPULOAD_MAX_TASKS, NULL);
+	cpuload.num_tasks = 0;
+	cpuload_idle_us[0] = cpuload_idle_us[1] = 0;
+	for(i=0;i<n;i++)
+	{
+		/* run time since last look - new tasks start from zero */
+		run = cpuload_snap[i].ulRunTimeCounter;
+		for(j=0;j<cpuload_num_hdl;j++)
+			if(cpuload_hdl[j] == cpuload_snap[i].xHandle)
+				break;
+		if(j < cpuload_num_hdl)
+			run -= cpuload_run[j];
+		
+		/* idle tasks are what's left over */
+		for(j=0;j<2;j++)
+			if(cpuload_snap[i].xHandle == cpuload_idle_hdl[j])
+				cpuload_idle_us[j] = run;
+		if((cpuload_snap[i].xHandle == cpuload_idle_hdl[0]) ||
+			(cpuload_snap[i].xHandle == cpuload_idle_hdl[1]))
+			continue;
+		
+		t = &cpuload.tasks[cpuload.num_tasks++];
+		strncpy(t->name, cpuload_snap[i].pcTaskName, configMAX_TASK_NAME_LEN-1);
+		t->name[configMAX_TASK_NAME_LEN-1] = 0;
+		t->core = xTaskGetCoreID(cpuload_snap[i].xHandle);
+		t->load = cpuload_permil(run, window_us);
+		
+		/* insertion sort */
+		for(j=cpuload.num_tasks-1;j && (t[-1].load < t->load);j--,t--)
+		{
+			tmp = t[-1];
+			t[-1] = *t;
+			*t = tmp;
+		}
+	}
+	
+	/* save counters for next time */
+	for(i=0;i<n;i++)
+	{
+		cpuload_hdl[i] = cpuload_snap[i].xHandle;
+		cpuload_run[i] = cpuload_snap[i].ulRunTimeCounter;
+	}
+	cpuload_num_hdl = n;
+}
+#endif
+
+/*
+ * close out the window since the last call & start a new one - from the UI
+ * at a steady rate. The ISR cycle totals are 32-bit, so a window has to be
+ * shorter than they take to wrap - about 17 sec at 240MHz.
+ */
+void cpuload_update(void)
+{
+	int64_t now = esp_timer_get_time();
+	uint32_t window_us = now - cpuload_time;
+	uint64_t window = (uint64_t)window_us * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+	uint32_t audio, audio_idle, other, other_idle, tasks;
+	uint64_t idle, isr;
+	uint8_t i, j;
+	
+	if(!window_us)
+		return;
+	cpuload_time = now;
+	
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+	cpuload_tasks(window_us);
+#else
+	return;
+#endif
+	
+	for(i=0;i<2;i++)
+	{
+		audio = cpuload_audio_cyc[i];
+		audio_idle = cpuload_audio_idle_cyc[i];
+		other = __atomic_load_n(&cpuload_isr_cyc[i], __ATOMIC_RELAXED);
+		other_idle = __atomic_load_n(&cpuload_isr_idle_cyc[i], __ATOMIC_RELAXED);
+		
+		/* idle task time less the timed ISR time charged to it */
+		idle = (uint64_t)cpuload_idle_us[i] * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ;
+		isr = (uint64_t)(audio_idle - cpuload_audio_idle_prev[i]) +
+			(other_idle - cpuload_isr_idle_prev[i]);
+		idle = idle > isr ? idle - isr : 0;
+		
+		cpuload.load[i] = 1000 - cpuload_permil(idle, window);
+		cpuload.audio[i] = cpuload_permil(audio - cpuload_audio_prev[i], window);
+		cpuload.isr[i] = cpuload_permil(other - cpuload_isr_prev[i], window);
+		cpuload_audio_prev[i] = audio;
+		cpuload_audio_idle_prev[i] = audio_idle;
+		cpuload_isr_prev[i] = other;
+		cpuload_isr_idle_prev[i] = other_idle;
+		
+		/* whatever the timed ISRs & pinned tasks don't account for */
+		tasks = cpuload.audio[i] + cpuload.isr[i];
+		for(j=0;j<cpuload.num_tasks;j++)
+			if(cpuload.tasks[j].core == i)
+				tasks += cpuload.tasks[j].load;
+		cpuload.other[i] = cpuload.load[i] > tasks ? cpuload.load[i] - tasks : 0;
+		
+		cpuload.hist[i][cpuload.hist_idx] = cpuload.load[i] / 10;
+	}
+	cpuload.hist_idx = (cpuload.hist_idx + 1) % CPULOAD_HIST;
+}
+
+/*
+ * get latest results
+ */
+const cpuload_info *cpuload_get(void)
+{
+	return &cpuload;
+}
+
+/*
+ * dump latest results to the console
+ */
+void cpuload_log(void)
+{
+	uint8_t i;
+	
+	for(i=0;i<2;i++)
+		ESP_LOGI(TAG, "core %d: %d.%d%% busy, audio isr %d.%d%%, adc & sync isr %d.%d%%, other %d.%d%%", i,
+			cpuload.load[i]/10, cpuload.load[i]%10, cpuload.audio[i]/10, cpuload.audio[i]%10,
+			cpuload.isr[i]/10, cpuload.isr[i]%10, cpuload.other[i]/10, cpuload.other[i]%10);
+	for(i=0;i<cpuload.num_tasks;i++)
+		ESP_LOGI(TAG, "  %-16s core %s %d.%d%%", cpuload.tasks[i].name,
+			cpuload.tasks[i].core == 0 ? "0" : (cpuload.tasks[i].core == 1 ? "1" : "any"),
+			cpuload.tasks[i].load/10, cpuload.tasks[i].load%10);
+}
@@ -0,0 +1,83 @@
+/*
+ * cpuload.h - per-core CPU load from idle time
+ * 10-18-26
+ */
+
+#ifndef __cpuload__
+#define __cpuload__
+
+#include "main.h"
+#include "esp_cpu.h"
+
+/* history for the graph, one sample per update */
+#define CPULOAD_HIST 100
+
+/* tasks tracked for the breakdown */
+#define CPULOAD_MAX_TASKS 24
+
+/*
+ * one task's share of its core
+ */
+typedef struct
+{
+	char name[configMAX_TASK_NAME_LEN];
+	BaseType_t core;		/* or tskNO_AFFINITY */
+	uint16_t load;			/* 0.1% of a core */
+} cpuload_task;
+
+/*
+ * latest window & history
+ */
+typedef struct
+{
+	uint16_t load[2];		/* busy, 0.1% */
+	uint16_t audio[2];		/* audio ISR, 0.1% */
+	uint16_t isr[2];		/* ADC DMA & sync jack ISRs, 0.1% */
+	uint16_t other[2];		/* busy but not in the breakdown, 0.1% */
+	uint8_t num_tasks;
+	cpuload_task tasks[CPULOAD_MAX_TASKS];	/* busiest first, idle left out */
+	uint8_t hist[2][CPULOAD_HIST];			/* busy %, oldest at hist_idx */
+	uint8_t hist_idx;
+} cpuload_info;
+
+/* audio ISR cycles per core, & the part of it that interrupted idle */
+extern volatile uint32_t cpuload_audio_cyc[2];
+extern volatile uint32_t cpuload_audio_idle_cyc[2];
+extern TaskHandle_t cpuload_idle_hdl[2];
+
+/* the same for the ADC DMA & sync jack ISRs */
+extern volatile uint32_t cpuload_isr_cyc[2];
+extern volatile uint32_t cpuload_isr_idle_cyc[2];
+
+/*
+ * charge audio ISR cycles to the running core - FreeRTOS counts them as
+ * run time of whatever task was interrupted
+ */
+static inline __attribute__((always_inline)) void cpuload_audio_add(uint32_t cyc)
+{
+	uint8_t core = esp_cpu_get_core_id();
+	
+	cpuload_audio_cyc[core] += cyc;
+	if(xTaskGetCurrentTaskHandle() == cpuload_idle_hdl[core])
+		cpuload_audio_idle_cyc[core] += cyc;
+}
+
+/*
+ * charge cycles of the ADC DMA or sync jack ISR to the running core. They
+ * share the totals & can preempt each other, so add atomically.
+ */
+static inline __attribute__((always_inline)) void cpuload_isr_add(uint32_t cyc)
+{
+	uint8_t core = esp_cpu_get_core_id();
+	
+	__atomic_fetch_add(&cpuload_isr_cyc[core], cyc, __ATOMIC_RELAXED);
+	if(xTaskGetCurrentTaskHandle() == cpuload_idle_hdl[core])
+		__atomic_fetch_add(&cpuload_isr_idle_cyc[core], cyc, __ATOMIC_RELAXED);
+}
+
+esp_err_t cpuload_init(void);
+void cpuload_update(void);
+const cpuload_info *cpuload_get(void);
+void cpuload_log(void);
+
+#endif
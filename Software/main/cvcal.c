@@ -0,0 +1,263 @@
+/*
+ * cvcal.c - CV calibration to volts
+ * 10-18-26
+ *
+ * The S3 ADC isn't linear and the back-board offset pots shift every CV,
+ * so raw codes are only good for knobs. Calibration captures the code for
+ * each channel at a set of known reference voltages (from the "CV Cal"
+ * menu page) and keeps the points in NVS. At boot, or after a new
+ * calibration, they're expanded to a lookup table per channel covering
+ * every code, so converting a reading is one interpolated lookup. Until a
+ * channel is calibrated it uses a nominal straight line.
+ *
+ * The tables are double buffered - the UI builds the idle one and swaps it
+ * in so the audio core never reads a half-built table.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "cvcal.h"
+#include "nvs.h"
+#include "fx.h"
+
+static const char *TAG = "cvcal";
+
+/* uncalibrated full scale */
+#define CVCAL_NOM_FS_MV 5000
+
+/* least codes between adjacent references for a usable calibration */
+#define CVCAL_MIN_STEP 20
+
+/* change these to match the references on hand, in mV */
+static const int16_t cvcal_refs[CVCAL_REFS] =
+{
+	0, 1000, 2000, 3000, 4000, 5000,
+};
+
+/* what's kept in NVS for each channel */
+typedef struct
+{
+	uint8_t version;
+	uint8_t num;
+	int16_t ref_mv[CVCAL_REFS];
+	int16_t raw[CVCAL_REFS];
+} cvcal_pts;
+#define CVCAL_VERSION 1
+
+static int16_t cvcal_lut[ADC_NUMVALS][2][CVCAL_LUT_LEN];
+static uint8_t cvcal_cur[ADC_NUMVALS];
+static uint8_t cvcal_ok[ADC_NUMVALS];
+static int16_t cvcal_pend[ADC_NUMVALS][CVCAL_REFS];
+
+/* opened once so saves don't allocate */
+static nvs_handle_t cvcal_nvs;
+static uint8_t cvcal_nvs_ok;
+
+/*
+ * expand calibration points to a lookup table - straight lines between
+ * points & the end segments carried on past them
+ */
+static void cvcal_build(int16_t *lut, const int16_t *ref, const int16_t *raw, uint8_t num)
+{
+	int32_t x, mv, dir;
+	uint16_t i;
+	uint8_t k;
+	
+	dir = raw[1] > raw[0] ? 1 : -1;
+	for(i=0;i<CVCAL_LUT_LEN;i++)
+	{
+		x = i<<CVCAL_LUT_SHIFT;
+		
+		/* segment - codes may fall as voltage rises */
+		k = 0;
+		while((k < num-2) && ((x - raw[k+1])*dir >= 0))
+			k++;
+		
+		mv = ref[k] + ((x - raw[k]) * (ref[k+1] - ref[k])) / (raw[k+1] - raw[k]);
+		lut[i] = mv > INT16_MAX ? INT16_MAX : (mv < INT16_MIN ? INT16_MIN : mv);
+	}
+}
+
+/*
+ * make a table the idle one & swap it in
+ */
+static void cvcal_install(uint8_t chl, const int16_t *ref, const int16_t *raw, uint8_t num)
+{
+	uint8_t next = cvcal_cur[chl] ^ 1;
+	
+	cvcal_build(cvcal_lut[chl][next], ref, raw, num);
+	__atomic_store_n(&cvcal_cur[chl], next, __ATOMIC_RELEASE);
+}
+
+/*
+ * nominal line for an uncalibrated channel
+ */
+static void cvcal_nominal(uint8_t chl)
+{
+	static const int16_t ref[2] = {0, CVCAL_NOM_FS_MV};
+	static const int16_t raw[2] = {0, 4095};
+	
+	cvcal_install(chl, ref, raw, 2);
+	cvcal_ok[chl] = 0;
+}
+
+/*
+ * points have to move the same way & far enough at every step
+ */
+static uint8_t cvcal_valid(const int16_t *raw, uint8_t num)
+{
+	int16_t dir = raw[1] > raw[0] ? 1 : -1;
+	uint8_t k;
+	
+	for(k=0;k<num-1;k++)
+		if((raw[k+1] - raw[k])*dir < CVCAL_MIN_STEP)
+			return 0;
+	return 1;
+}
+
+/*
+ * load stored calibrations & build the tables - after NVS flash init
+ */
+esp_err_t cvcal_init(void)
+{
+	cvcal_pts pts;
+	size_t sz;
+	char key[8];
+	uint8_t i;
+	esp_err_t err;
+	
+	for(i=0;i<ADC_NUMVALS;i++)
+		cvcal_nominal(i);
+	
+	err = nvs_open("cvcal", NVS_READWRITE, &cvcal_nvs);
+	if(err != ESP_OK)
+	{
+		ESP_LOGW(TAG, "Error (%s) opening NVS - CVs uncalibrated", esp_err_to_name(err));
+		return err;
+	}
+	cvcal_nvs_ok = 1;
+	
+	for(i=0;i<ADC_NUMVALS;i++)
+	{
+		sprintf(key, "cv%d", i);
+		sz = sizeof(cvcal_pts);
+		err = nvs_get_blob(cvcal_nvs, key, &pts, &sz);
+		if(err == ESP_ERR_NVS_NOT_FOUND)
+			continue;
+		if((err != ESP_OK) || (sz != sizeof(cvcal_pts)) || (pts.version != CVCAL_VERSION) ||
+			(pts.num < 2) || (pts.num > CVCAL_REFS) || !cvcal_valid(pts.raw, pts.num))
+		{
+			ESP_LOGW(TAG, "CV %d: bad calibration in NVS, ignored", i);
+			continue;
+		}
+		
+		cvcal_install(i, pts.ref_mv, pts.raw, pts.num);
+		cvcal_ok[i] = 1;
+		ESP_LOGI(TAG, "CV %d: calibrated, %d points", i, pts.num);
+	}
+	
+	return ESP_OK;
+}
+
+/*
+ * reference voltage for a calibration step
+ */
+int16_t cvcal_ref_mv(uint8_t step)
+{
+	return step < CVCAL_REFS ? cvcal_refs[step] : 0;
+}
+
+/*
+ * note the code read w/ a reference applied
+ */
+void cvcal_capture(uint8_t chl, uint8_t step, int16_t raw)
+{
+	if((chl < ADC_NUMVALS) && (step < CVCAL_REFS))
+		cvcal_pend[chl][step] = raw;
+}
+
+/*
+ * all references captured - check, use & save them
+ */
+esp_err_t cvcal_commit(uint8_t chl)
+{
+	cvcal_pts pts;
+	char key[8];
+	esp_err_t err;
+	
+	if(chl >= ADC_NUMVALS)
+		return ESP_ERR_INVALID_ARG;
+	
+	if(!cvcal_valid(cvcal_pend[chl], CVCAL_REFS))
+	{
+		ESP_LOGW(TAG, "CV %d: readings don't track the references, not used", chl);
+		return ESP_ERR_INVALID_STATE;
+	}
+	
+	memset(&pts, 0, sizeof(cvcal_pts));
+	pts.version = CVCAL_VERSION;
+	pts.num = CVCAL_REFS;
+	memcpy(pts.ref_mv, cvcal_refs, sizeof(pts.ref_mv));
+	memcpy(pts.raw, cvcal_pend[chl], sizeof(pts.raw));
+	cvcal_install(chl, pts.ref_mv, pts.raw, pts.num);
+	cvcal_ok[chl] = 1;
+	
+	if(!cvcal_nvs_ok)
+		return ESP_ERR_INVALID_STATE;
+	sprintf(key, "cv%d", chl);
+	fx_flash_begin();
+	err = nvs_set_blob(cvcal_nvs, key, &pts, sizeof(cvcal_pts));
+	if(err == ESP_OK)
+		err = nvs_commit(cvcal_nvs);
+	fx_flash_end();
+	ESP_LOGI(TAG, "CV %d: calibrated, save %s", chl, esp_err_to_name(err));
+	
+	return err;
+}
+
+/*
+ * forget a channel's calibration
+ */
+esp_err_t cvcal_clear(uint8_t chl)
+{
+	char key[8];
+	esp_err_t err;
+	
+	if(chl >= ADC_NUMVALS)
+		return ESP_ERR_INVALID_ARG;
+	
+	cvcal_nominal(chl);
+	if(!cvcal_nvs_ok)
+		return ESP_ERR_INVALID_STATE;
+	sprintf(key, "cv%d", chl);
+	fx_flash_begin();
+	err = nvs_erase_key(cvcal_nvs, key);
+	if(err == ESP_OK)
+		err = nvs_commit(cvcal_nvs);
+	fx_flash_end();
+	
+	return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+}
+
+/*
+ * whether a channel has a stored calibration
+ */
+uint8_t cvcal_is_cal(uint8_t chl)
+{
+	return chl < ADC_NUMVALS ? cvcal_ok[chl] : 0;
+}
+
+/*
+ * 12-bit code to mV - cheap enough for every sample
+ */
+int16_t IRAM_ATTR cvcal_mv(uint8_t chl, int16_t raw)
+{
+	const int16_t *t = cvcal_lut[chl][__atomic_load_n(&cvcal_cur[chl], __ATOMIC_ACQUIRE)];
+	int32_t frac;
+	
+	raw = raw < 0 ? 0 : (raw > 4095 ? 4095 : raw);
+	t += raw>>CVCAL_LUT_SHIFT;
+	frac = raw & ((1<<CVCAL_LUT_SHIFT)-1);
+	
+	return t[0] + (((t[1] - t[0]) * frac)>>CVCAL_LUT_SHIFT);
+}
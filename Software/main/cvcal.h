@@ -0,0 +1,27 @@
+/*
+ * cvcal.h - CV calibration to volts
+ * 10-18-26
+ */
+
+#ifndef __cvcal__
+#define __cvcal__
+
+#include "main.h"
+#include "eb_adc.h"
+
+/* reference voltages applied during calibration */
+#define CVCAL_REFS 6
+
+/* lookup table - one entry every 128 codes, plus the end */
+#define CVCAL_LUT_SHIFT 7
+#define CVCAL_LUT_LEN ((4096>>CVCAL_LUT_SHIFT)+1)
+
+esp_err_t cvcal_init(void);
+int16_t cvcal_ref_mv(uint8_t step);
+void cvcal_capture(uint8_t chl, uint8_t step, int16_t raw);
+esp_err_t cvcal_commit(uint8_t chl);
+esp_err_t cvcal_clear(uint8_t chl);
+uint8_t cvcal_is_cal(uint8_t chl);
+int16_t cvcal_mv(uint8_t chl, int16_t raw);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ * cvcond.c - per-channel CV conditioning
+ * 10-18-26
+ *
+ * Each block eb_adc_block() hands over one averaged reading per channel
+ * and gets back the value effects see in adc_val[] & adc_param[]. On the
+ * way it goes through a median for spikes, a moving average, a slew limit,
+ * a deadband and quantisation, each set per channel and each costing the
+ * same whatever it's set to. The deadband & steps are what keep a noisy
+ * CV from nudging an effect into recomputing every block.
+ *
+ * Effects set what they need from their init and everything goes back to
+ * the defaults on the next effect change. Settings are picked up at the
+ * start of the next block, behind a sequence count so the audio core
+ * never takes half of one.
+ *
+ * The CV streams in cvmod.c take the raw samples and don't go through
+ * here.
+ */
+
+#include <string.h>
+#include "cvcond.h"
+
+/* what each channel gets w/o asking - about as smooth as the old IIR */
+static const cvcond_cfg cvcond_dflt =
+{
+	3,		/* median */
+	4,		/* avg */
+	0,		/* slew */
+	0,		/* deadband */
+	0,		/* steps */
+};
+
+typedef struct
+{
+	cvcond_cfg cfg;
+	cvcond_cfg pend;			/* next settings */
+	uint32_t seq;				/* odd while pend is being written */
+	uint32_t seen;				/* seq of the settings in use */
+	uint8_t primed;				/* histories hold real readings */
+	int16_t med[CVCOND_MED_MAX];
+	uint8_t med_idx;
+	int16_t avg[CVCOND_AVG_MAX];
+	uint8_t avg_idx;
+	int32_t avg_sum;
+	int16_t slew;				/* slew limiter output */
+	int16_t held;				/* deadband output */
+} cvcond_chl;
+
+static cvcond_chl cvcond_state[ADC_NUMVALS];
+
+/*
+ * keep settings in range
+ */
+static void cvcond_clamp(cvcond_cfg *cfg)
+{
+	cfg->median = cfg->median >= 5 ? 5 : (cfg->median >= 3 ? 3 : 1);
+	cfg->avg = cfg->avg > CVCOND_AVG_MAX ? CVCOND_AVG_MAX : (cfg->avg < 1 ? 1 : cfg->avg);
+	cfg->steps = cfg->steps == 1 ? 0 : cfg->steps;
+}
+
+/*
+ * start every channel on the defaults
+ */
+void cvcond_init(void)
+{
+	uint8_t i;
+	
+	memset(cvcond_state, 0, sizeof(cvcond_state));
+	for(i=0;i<ADC_NUMVALS;i++)
+		cvcond_state[i].cfg = cvcond_state[i].pend = cvcond_dflt;
+}
+
+/*
+ * all channels back to the defaults - before the next effect's init
+ */
+void cvcond_reset(void)
+{
+	uint8_t i;
+	
+	for(i=0;i<ADC_NUMVALS;i++)
+		cvcond_set(i, &cvcond_dflt);
+}
+
+/*
+ * new settings for a channel, used from the next block - one task at a
+ * time
+ */
+esp_err_t cvcond_set(uint8_t chl, const cvcond_cfg *cfg)
+{
+	cvcond_chl *c;
+	
+	if((chl >= ADC_NUMVALS) || !cfg)
+		return ESP_ERR_INVALID_ARG;
+	c = &cvcond_state[chl];
+	
+	__atomic_add_fetch(&c->seq, 1, __ATOMIC_ACQ_REL);
+	c->pend = *cfg;
+	cvcond_clamp(&c->pend);
+	__atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+	
+	return ESP_OK;
+}
+
+/*
+ * latest settings asked for on a channel, whether or not the audio core
+ * has picked them up yet - from the task that sets them
+ */
+const cvcond_cfg *cvcond_get(uint8_t chl)
+{
+	return chl < ADC_NUMVALS ? &cvcond_state[chl].pend : NULL;
+}
+
+/*
+ * fill the histories so a new setting starts from where the CV is
+ */
+static void IRAM_ATTR cvcond_prime(cvcond_chl *c, int16_t in)
+{
+	uint8_t i;
+	
+	for(i=0;i<CVCOND_MED_MAX;i++)
+		c->med[i] = in;
+	for(i=0;i<CVCOND_AVG_MAX;i++)
+		c->avg[i] = in;
+	c->avg_sum = in * c->cfg.avg;
+	c->slew = in;
+	c->held = in;
+	c->primed = 1;
+}
+
+/*
+ * median of the last n readings - sorting 5 is cheap enough to always do
+ */
+static inline __attribute__((always_inline)) int16_t cvcond_median(cvcond_chl *c, int16_t in)
+{
+	int16_t s[CVCOND_MED_MAX], t;
+	uint8_t i, j, n = c->cfg.median;
+	
+	c->med[c->med_idx] = in;
+	c->med_idx = c->med_idx == CVCOND_MED_MAX-1 ? 0 : c->med_idx+1;
+	if(n == 1)
+		return in;
+	
+	/* newest n */
+	j = c->med_idx;
+	for(i=0;i<n;i++)
+	{
+		j = j ? j-1 : CVCOND_MED_MAX-1;
+		s[i] = c->med[j];
+	}
+	for(i=1;i<n;i++)
+	{
+		t = s[i];
+		for(j=i;j && (s[j-1] > t);j--)
+			s[j] = s[j-1];
+		s[j] = t;
+	}
+	
+	return s[n>>1];
+}
+
+/*
+ * condition one channel's reading for this block - from eb_adc_block()
+ */
+int16_t IRAM_ATTR cvcond_proc(uint8_t chl, int16_t in)
+{
+	cvcond_chl *c = &cvcond_state[chl];
+	cvcond_cfg cfg;
+	uint32_t seq;
+	int32_t x, d;
+	
+	/* pick up new settings - if they're mid-write, next block */
+	seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+	if((seq != c->seen) && !(seq & 1))
+	{
+		cfg = c->pend;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq)
+		{
+			c->cfg = cfg;
+			c->seen = seq;
+			c->primed = 0;
+		}
+	}
+	if(!c->primed)
+		cvcond_prime(c, in);
+	
+	/* spikes */
+	x = cvcond_median(c, in);
+	
+	/* moving average over the newest avg blocks */
+	c->avg_sum += x - c->avg[(c->avg_idx + CVCOND_AVG_MAX - c->cfg.avg) & (CVCOND_AVG_MAX-1)];
+	c->avg[c->avg_idx] = x;
+	c->avg_idx = (c->avg_idx + 1) & (CVCOND_AVG_MAX-1);
+	x = c->avg_sum / c->cfg.avg;
+	
+	/* slew limit */
+	if(c->cfg.slew)
+	{
+		d = x - c->slew;
+		d = d > c->cfg.slew ? c->cfg.slew : (d < -c->cfg.slew ? -c->cfg.slew : d);
+		x = c->slew + d;
+	}
+	c->slew = x;
+	
+	/* deadband - ends of travel always get through */
+	d = x - c->held;
+	d = d < 0 ? -d : d;
+	if((d > c->cfg.deadband) || (x == 0) || (x == 4095))
+		c->held = x;
+	x = c->held;
+	
+	/* quantise to the nearest level */
+	if(c->cfg.steps)
+		x = cvcond_level(x, c->cfg.steps) * 4095 / (c->cfg.steps - 1);
+	
+	return x;
+}
+
+/*
+ * which of steps levels a value is nearest
+ */
+uint16_t IRAM_ATTR cvcond_level(int16_t val, uint16_t steps)
+{
+	if(steps < 2)
+		return 0;
+	return ((int32_t)val * (steps - 1) + 2047) / 4095;
+}
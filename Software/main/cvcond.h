@@ -0,0 +1,35 @@
+/*
+ * cvcond.h - per-channel CV conditioning
+ * 10-18-26
+ */
+
+#ifndef __cvcond__
+#define __cvcond__
+
+#include "main.h"
+#include "eb_adc.h"
+
+/* longest histories */
+#define CVCOND_AVG_MAX 8
+#define CVCOND_MED_MAX 5
+
+/*
+ * conditioning for one channel - stages run in this order
+ */
+typedef struct
+{
+	uint8_t median;		/* median of 1, 3 or 5 blocks to drop spikes */
+	uint8_t avg;		/* blocks in the moving average, 1 to 8 */
+	uint16_t slew;		/* most change per block in codes, 0 for none */
+	uint16_t deadband;	/* least change that gets through, 0 for none */
+	uint16_t steps;		/* quantise to this many levels, 0 for none */
+} cvcond_cfg;
+
+void cvcond_init(void);
+void cvcond_reset(void);
+esp_err_t cvcond_set(uint8_t chl, const cvcond_cfg *cfg);
+const cvcond_cfg *cvcond_get(uint8_t chl);
+int16_t cvcond_proc(uint8_t chl, int16_t in);
+uint16_t cvcond_level(int16_t val, uint16_t steps);
+
+#endif
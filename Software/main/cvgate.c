@@ -0,0 +1,223 @@
+/*
+ * cvgate.c - gate & trigger events from the CV inputs
+ * 10-18-26
+ *
+ * Any CV can be made a gate or trigger input. Its raw samples are run
+ * through a Schmitt trigger in mV, so thresholds follow the calibration,
+ * at the full 12kHz per channel rate. eb_adc_block() scans every DMA frame
+ * that landed since the last block, w/ the age of each sample worked out
+ * from when its frame landed, so no edge is missed when the ADC & audio
+ * clocks slip. Each edge is put on the audio sample clock and held until
+ * it's exactly CVGATE_LATENCY samples old, then delivered at that offset
+ * in the block. The audio callback hands them to the running effect's
+ * event function before its proc runs.
+ *
+ * The input set in menuconfig is set up at boot & cvgate_set() changes it
+ * from any task. Settings are picked up behind a sequence count as in
+ * cvcond.c.
+ */
+
+#include <string.h>
+#include "sdkconfig.h"
+#include "cvgate.h"
+#include "cvcal.h"
+#include "fx.h"
+
+static const char *TAG = "cvgate";
+
+typedef struct
+{
+	uint8_t mode;
+	int16_t on;			/* mV */
+	int16_t off;
+} cvgate_cfg;
+
+typedef struct
+{
+	cvgate_cfg cfg;
+	cvgate_cfg pend;
+	uint32_t seq;		/* odd while pend is being written */
+	uint32_t seen;
+	uint8_t state;
+} cvgate_chl;
+
+static cvgate_chl cvgate_state[ADC_NUMVALS];
+static cvgate_event cvgate_pend[CVGATE_PEND];
+static uint8_t cvgate_num_pend;
+static cvgate_event cvgate_ev[CVGATE_MAX_EV];
+static uint8_t cvgate_num_ev;
+static uint32_t cvgate_smp;		/* audio sample clock at this block */
+static uint32_t cvgate_lost;	/* edges w/ no room or too late */
+
+/*
+ * set up the input from menuconfig
+ */
+void cvgate_init(void)
+{
+	memset(cvgate_state, 0, sizeof(cvgate_state));
+	cvgate_num_pend = 0;
+	cvgate_num_ev = 0;
+	cvgate_smp = -FRAMESZ;
+	
+#if CONFIG_S3GTA_GATE_CV
+#ifdef CONFIG_S3GTA_GATE_TRIG
+	cvgate_set(CONFIG_S3GTA_GATE_CV-1, CVGATE_TRIG, CVGATE_ON_MV, CVGATE_OFF_MV);
+#else
+	cvgate_set(CONFIG_S3GTA_GATE_CV-1, CVGATE_GATE, CVGATE_ON_MV, CVGATE_OFF_MV);
+#endif
+#endif
+}
+
+/*
+ * make a channel a gate or trigger input, or a plain CV again
+ */
+esp_err_t cvgate_set(uint8_t chl, uint8_t mode, int16_t on_mv, int16_t off_mv)
+{
+	cvgate_chl *c;
+	
+	if((chl >= ADC_NUMVALS) || (mode > CVGATE_TRIG) || (off_mv >= on_mv))
+		return ESP_ERR_INVALID_ARG;
+	c = &cvgate_state[chl];
+	
+	__atomic_add_fetch(&c->seq, 1, __ATOMIC_ACQ_REL);
+	c->pend.mode = mode;
+	c->pend.on = on_mv;
+	c->pend.off = off_mv;
+	__atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+	
+	ESP_LOGI(TAG, "CV%d: %s, on %d mV off %d mV", chl+1,
+		mode == CVGATE_GATE ? "gate" : (mode == CVGATE_TRIG ? "trigger" : "off"),
+		on_mv, off_mv);
+	return ESP_OK;
+}
+
+/*
+ * new block - before any frames are scanned
+ */
+void IRAM_ATTR cvgate_begin(void)
+{
+	cvgate_smp += FRAMESZ;
+}
+
+/*
+ * look for edges in one channel's raw samples from one frame, oldest
+ * first, each w/ how many samples before this block it was taken - from
+ * eb_adc_block()
+ */
+void IRAM_ATTR cvgate_scan(uint8_t chl, const int16_t *raw, const uint16_t *age, uint8_t n)
+{
+	cvgate_chl *c = &cvgate_state[chl];
+	cvgate_event *ev;
+	cvgate_cfg cfg;
+	uint32_t seq;
+	int16_t mv;
+	uint8_t k, edge;
+	
+	/* pick up new settings */
+	seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+	if((seq != c->seen) && !(seq & 1))
+	{
+		cfg = c->pend;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq)
+		{
+			c->cfg = cfg;
+			c->seen = seq;
+		}
+	}
+	if(c->cfg.mode == CVGATE_OFF)
+		return;
+	
+	for(k=0;k<n;k++)
+	{
+		/* Schmitt trigger */
+		mv = cvcal_mv(chl, raw[k]);
+		if(!c->state && (mv >= c->cfg.on))
+			edge = CVGATE_RISE;
+		else if(c->state && (mv <= c->cfg.off))
+			edge = CVGATE_FALL;
+		else
+			continue;
+		c->state = edge;
+		
+		/* triggers only fire on the way up */
+		if((c->cfg.mode == CVGATE_TRIG) && (edge == CVGATE_FALL))
+			continue;
+		if(cvgate_num_pend >= CVGATE_PEND)
+		{
+			cvgate_lost++;
+			continue;
+		}
+		
+		ev = &cvgate_pend[cvgate_num_pend++];
+		ev->chl = chl;
+		ev->mode = c->cfg.mode;
+		ev->edge = edge;
+		ev->time = cvgate_smp - age[k];
+	}
+}
+
+/*
+ * after the frames are scanned - pick out the edges due in this block, in
+ * the order they happened
+ */
+void IRAM_ATTR cvgate_end(void)
+{
+	cvgate_event ev;
+	int32_t due;
+	uint8_t i, j, keep = 0;
+	
+	cvgate_num_ev = 0;
+	for(i=0;i<cvgate_num_pend;i++)
+	{
+		ev = cvgate_pend[i];
+		due = (int32_t)(ev.time + CVGATE_LATENCY - cvgate_smp);
+		
+		/* next block or later */
+		if(due >= FRAMESZ)
+		{
+			cvgate_pend[keep++] = ev;
+			continue;
+		}
+		
+		/* frame held up for more than a block - it's stale */
+		if((due < -FRAMESZ) || (cvgate_num_ev >= CVGATE_MAX_EV))
+		{
+			cvgate_lost++;
+			continue;
+		}
+		
+		/* a little late goes at the start of the block */
+		ev.offset = due < 0 ? 0 : due;
+		for(j=cvgate_num_ev;j && (cvgate_ev[j-1].offset > ev.offset);j--)
+			cvgate_ev[j] = cvgate_ev[j-1];
+		cvgate_ev[j] = ev;
+		cvgate_num_ev++;
+	}
+	cvgate_num_pend = keep;
+}
+
+/*
+ * this block's events - from the audio callback
+ */
+const cvgate_event * IRAM_ATTR cvgate_events(uint8_t *n)
+{
+	*n = cvgate_num_ev;
+	return cvgate_ev;
+}
+
+/*
+ * edges dropped so far
+ */
+uint32_t cvgate_get_lost(void)
+{
+	return cvgate_lost;
+}
+
+/*
+ * current level of a gate input
+ */
+uint8_t IRAM_ATTR cvgate_get(uint8_t chl)
+{
+	return chl < ADC_NUMVALS ? cvgate_state[chl].state : 0;
+}
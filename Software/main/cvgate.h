@@ -0,0 +1,60 @@
+/*
+ * cvgate.h - gate & trigger events from the CV inputs
+ * 10-18-26
+ */
+
+#ifndef __cvgate__
+#define __cvgate__
+
+#include "main.h"
+#include "eb_adc.h"
+
+/* most events in one block, all channels */
+#define CVGATE_MAX_EV 8
+
+/* edges waiting to be delivered, all channels */
+#define CVGATE_PEND 16
+
+/* samples from an edge to its delivery - the oldest sample of a frame
+ * that lands just after a block starts is this old at the next block */
+#define CVGATE_LATENCY (2*FRAMESZ)
+
+/* default Schmitt thresholds, mV */
+#define CVGATE_ON_MV 2500
+#define CVGATE_OFF_MV 1000
+
+enum cvgate_modes
+{
+	CVGATE_OFF,
+	CVGATE_GATE,		/* rising & falling edges */
+	CVGATE_TRIG,		/* rising edges only */
+};
+
+enum cvgate_edges
+{
+	CVGATE_FALL,
+	CVGATE_RISE,
+};
+
+/*
+ * one edge, on the audio sample clock
+ */
+typedef struct
+{
+	uint8_t chl;
+	uint8_t mode;
+	uint8_t edge;
+	uint16_t offset;	/* sample in the block it's delivered with */
+	uint32_t time;		/* sample it happened at, since audio started */
+} cvgate_event;
+
+void cvgate_init(void);
+esp_err_t cvgate_set(uint8_t chl, uint8_t mode, int16_t on_mv, int16_t off_mv);
+void cvgate_begin(void);
+void cvgate_scan(uint8_t chl, const int16_t *raw, const uint16_t *age, uint8_t n);
+void cvgate_end(void);
+const cvgate_event *cvgate_events(uint8_t *n);
+uint8_t cvgate_get(uint8_t chl);
+uint32_t cvgate_get_lost(void);
+
+#endif
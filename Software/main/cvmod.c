@@ -0,0 +1,166 @@
+/*
+ * cvmod.c - audio-rate CV streams for effects
+ * 10-18-26
+ *
+ * The ADC delivers each CV at 12kHz in frames of one audio block. Effects
+ * that want a CV as a modulation input rather than a control call
+ * cvmod_request() from their init with the bandwidth they need, and each
+ * block eb_adc_block() passes the raw samples for that channel through a
+ * one-pole smoother at that bandwidth and cvmod_push() interpolates them
+ * up to one value per audio sample. The proc reads the block back with
+ * cvmod_get() - 12-bit, same scale as adc_param[], one frame late.
+ *
+ * Requests are dropped each time the effect changes, so channels nobody
+ * asked for cost nothing.
+ *
+ * Streams come from the raw ADC samples, so they skip the conditioning
+ * chain & calibration that adc_param[] goes through. When a block is flat
+ * the effects go back to adc_param[] for it. Flat is judged on its own
+ * heavily smoothed copy of the input rather than the stream, so ADC noise
+ * doesn't count as movement at wide stream bandwidths.
+ */
+
+#include "cvmod.h"
+#include "dsp_align.h"
+
+static const char *TAG = "cvmod";
+
+/* 2*pi in Q14 */
+#define CVMOD_2PI_Q14 102944
+
+/* flat detector smoother, Hz & Q14 coef, same approximation as requests */
+#define CVMOD_DET_BW 100
+#define CVMOD_DET_W ((CVMOD_DET_BW * CVMOD_2PI_Q14) / CVMOD_RATE)
+#define CVMOD_DET_COEF ((CVMOD_DET_W<<14) / ((1<<14) + CVMOD_DET_W))
+
+typedef struct
+{
+	uint8_t active;
+	int16_t coef;			/* smoother, Q14 */
+	int32_t state;			/* smoother, 12.4 */
+	int16_t last;			/* final output of the previous block */
+	int32_t det;			/* flat detector, 12.4 */
+	uint8_t flat;
+} cvmod_chl;
+
+static cvmod_chl cvmod_state[ADC_NUMVALS];
+static DSP_VEC int16_t cvmod_buf[ADC_NUMVALS][FRAMESZ];
+
+/*
+ * drop all requests - before the next effect's init
+ */
+void cvmod_reset(void)
+{
+	uint8_t i;
+	
+	for(i=0;i<ADC_NUMVALS;i++)
+		__atomic_store_n(&cvmod_state[i].active, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * ask for a CV stream w/ bandwidth in Hz, or CVMOD_BW_FULL - from an
+ * effect's init. Integer only since it runs on the audio core.
+ */
+esp_err_t cvmod_request(uint8_t chl, uint16_t bw)
+{
+	cvmod_chl *c;
+	int32_t w;
+	uint16_t i;
+	
+	if(chl >= ADC_NUMVALS)
+		return ESP_ERR_INVALID_ARG;
+	c = &cvmod_state[chl];
+	
+	/* 1-exp(-w) ~= w/(1+w) - close below a few hundred Hz, never > 1 */
+	if(bw == CVMOD_BW_FULL || bw >= CVMOD_RATE/2)
+		c->coef = 1<<14;
+	else
+	{
+		w = ((int32_t)bw * CVMOD_2PI_Q14) / CVMOD_RATE;
+		c->coef = (w<<14) / ((1<<14) + w);
+	}
+	
+	/* start from the current reading so nothing jumps */
+	c->last = adc_avg[chl];
+	c->state = c->last<<4;
+	c->det = c->state;
+	c->flat = 1;
+	for(i=0;i<FRAMESZ;i++)
+		cvmod_buf[chl][i] = c->last;
+	__atomic_store_n(&c->active, 1, __ATOMIC_RELEASE);
+	
+	ESP_LOGI(TAG, "CV %d at %d Hz", chl, bw);
+	return ESP_OK;
+}
+
+/*
+ * smooth & interpolate one channel's raw samples for this block - from
+ * eb_adc_block(). n is 0 when the ADC had no new frame, which holds the
+ * last value.
+ */
+void IRAM_ATTR cvmod_push(uint8_t chl, const int16_t *raw, uint8_t n)
+{
+	cvmod_chl *c = &cvmod_state[chl];
+	int16_t *dst = cvmod_buf[chl];
+	int16_t z[CVMOD_MAX_IN+1], min, max;
+	uint32_t step, pos;
+	uint16_t i, idx;
+	
+	if(!__atomic_load_n(&c->active, __ATOMIC_ACQUIRE))
+		return;
+	
+	n = n > CVMOD_MAX_IN ? CVMOD_MAX_IN : n;
+	if(!n)
+	{
+		if(!c->flat)
+		{
+			for(i=0;i<FRAMESZ;i++)
+				dst[i] = c->last;
+			c->flat = 1;
+		}
+		return;
+	}
+	
+	/* smooth at the input rate, w/ the last output in front. The
+	 * detector's range over the block decides if it's flat. */
+	z[0] = c->last;
+	min = max = c->det>>4;
+	for(i=0;i<n;i++)
+	{
+		c->state += (((raw[i]<<4) - c->state) * c->coef)>>14;
+		z[i+1] = c->state>>4;
+		c->det += (((raw[i]<<4) - c->det) * CVMOD_DET_COEF)>>14;
+		min = (c->det>>4) < min ? (c->det>>4) : min;
+		max = (c->det>>4) > max ? (c->det>>4) : max;
+	}
+	
+	/* linear interpolation up to the audio rate, 16.16 position in z[] */
+	step = ((uint32_t)n<<16)/FRAMESZ;
+	pos = 0;
+	for(i=0;i<FRAMESZ;i++)
+	{
+		pos += step;
+		idx = pos>>16;
+		if(idx >= n)
+			dst[i] = z[n];
+		else
+			dst[i] = z[idx] + (((z[idx+1] - z[idx]) * (int32_t)(pos & 0xffff))>>16);
+	}
+	c->last = z[n];
+	c->flat = (max - min) < CVMOD_FLAT;
+}
+
+/*
+ * this block's stream for a channel - NULL if it wasn't requested. flat
+ * is set if the CV hasn't moved beyond its noise this block, and the
+ * caller should use adc_param[] instead.
+ */
+const int16_t * IRAM_ATTR cvmod_get(uint8_t chl, uint8_t *flat)
+{
+	if(chl >= ADC_NUMVALS || !__atomic_load_n(&cvmod_state[chl].active, __ATOMIC_ACQUIRE))
+		return NULL;
+	
+	if(flat)
+		*flat = cvmod_state[chl].flat;
+	return cvmod_buf[chl];
+}
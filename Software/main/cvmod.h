@@ -0,0 +1,33 @@
+/*
+ * cvmod.h - audio-rate CV streams for effects
+ * 10-18-26
+ */
+
+#ifndef __cvmod__
+#define __cvmod__
+
+#include "main.h"
+#include "fx.h"
+
+/* CV input rate - each channel's share of the continuous ADC */
+#define CVMOD_RATE 12000
+
+/* most raw samples per channel in one block */
+#define CVMOD_MAX_IN (CVMOD_RATE*FRAMESZ/SAMPLE_RATE)
+
+/* bandwidth request for no smoothing beyond the interpolation */
+#define CVMOD_BW_FULL 0
+
+/* a block where the flat detector moves less than this is treated as a
+ * constant. The detector is smoothed to 100Hz, which cuts white ADC noise
+ * to about a sixth of what's in the 6kHz input band. 2 LSB hasn't been
+ * checked against measured noise - raise it if the streams chatter w/
+ * nothing patched. */
+#define CVMOD_FLAT 2
+
+void cvmod_reset(void);
+esp_err_t cvmod_request(uint8_t chl, uint16_t bw);
+void cvmod_push(uint8_t chl, const int16_t *raw, uint8_t n);
+const int16_t *cvmod_get(uint8_t chl, uint8_t *flat);
+
+#endif
@@ -0,0 +1,17 @@
+/*
+ * dlycodec.h - block-scaled 8-bit storage codec for long delay lines
+ * 10-18-26
+ */
+
+#ifndef __dlycodec__
+#define __dlycodec__
+
+#include <stdint.h>
+
+#define DLYC_FRAMES 32						/* stereo frames per codec block */
+#define DLYC_BYTES (2+2*DLYC_FRAMES)		/* bytes per codec block */
+
+void dlyc_encode(uint8_t *dst, const int16_t *src);
+void dlyc_decode(int16_t *dst, const uint8_t *src);
+
+#endif
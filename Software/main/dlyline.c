@@ -0,0 +1,152 @@
+/*
+ * dlyline.c - tiered stereo delay line, recent history in SRAM
+ * 10-18-26
+ *
+ * The newest near_len frames live in a ring in internal SRAM, and every
+ * frame is also copied out to the PSRAM history a block at a time as each
+ * DLYL_SPILL frame block completes. Reads up to near_len frames back come
+ * from SRAM and anything older comes from PSRAM, so short modulated taps
+ * run at SRAM speed while long taps still get the full PSRAM length.
+ *
+ * The PSRAM tier can optionally use the 8-bit block-scaled codec for ~1.9x
+ * the length. Recent history is always kept at full resolution.
+ */
+
+#include <string.h>
+#include "dlyline.h"
+
+/* spills encode whole codec blocks */
+_Static_assert(DLYL_SPILL % DLYC_FRAMES == 0, "DLYL_SPILL must be a multiple of DLYC_FRAMES");
+
+/* raw spills land on whole cache lines when the far tier is line aligned */
+_Static_assert((2*DLYL_SPILL*sizeof(int16_t)) % DSP_CACHE_ALIGN == 0, "DLYL_SPILL must fill whole cache lines");
+
+/*
+ * set up a delay line. near_len must be a power of 2 of at least
+ * 2*DLYL_SPILL frames and far should start on a cache line. The far tier
+ * isn't cleared here.
+ */
+void dlyline_init(dlyline *dl, int16_t *near, uint32_t near_len, void *far,
+	size_t far_sz, uint8_t codec)
+{
+	dl->near = near;
+	dl->near_len = near_len;
+	dl->nptr = 0;
+	memset(near, 0, 2*near_len*sizeof(int16_t));
+	
+	/* whole spill blocks of history */
+	dl->far = far;
+	dl->codec = codec;
+	if(codec)
+		dl->far_len = (far_sz / DLYC_BYTES) * DLYC_FRAMES;
+	else
+		dl->far_len = far_sz / (2*sizeof(int16_t));
+	dl->far_len -= dl->far_len % DLYL_SPILL;
+	dl->wptr = 0;
+	
+	/* far slots of the block being filled still hold the oldest frames */
+	dl->max = dl->far_len - DLYL_SPILL;
+}
+
+/*
+ * copy the last completed block out to PSRAM
+ */
+void IRAM_ATTR dlyline_spill(dlyline *dl)
+{
+	int16_t *src;
+	uint32_t fptr, i;
+	uint8_t *cb;
+	
+	src = &dl->near[2*((dl->nptr - DLYL_SPILL) & (dl->near_len-1))];
+	fptr = dl->wptr ? dl->wptr - DLYL_SPILL : dl->far_len - DLYL_SPILL;
+	
+	if(dl->codec)
+	{
+		cb = (uint8_t *)dl->far + DLYC_BYTES*(fptr / DLYC_FRAMES);
+		for(i=0;i<DLYL_SPILL;i+=DLYC_FRAMES)
+		{
+			dlyc_encode(cb, &src[2*i]);
+			cb += DLYC_BYTES;
+		}
+	}
+	else
+		memcpy(&((int16_t *)dl->far)[2*fptr], src, 2*DLYL_SPILL*sizeof(int16_t));
+}
+
+/*
+ * get a span of sz frames starting off frames back, oldest first. Needs
+ * off >= sz and sz <= DLYL_SPILL. Returns a pointer straight into the
+ * near ring when the span doesn't wrap, otherwise fills dst (which must
+ * hold DLYL_RD_FRAMES frames) and returns where the span starts in it.
+ */
+int16_t * IRAM_ATTR dlyline_read(dlyline *dl, int16_t *dst, uint32_t off, uint16_t sz)
+{
+	int32_t rptr;
+	uint32_t n, b, nblk, ofs;
+	uint8_t *cb;
+	int16_t *blkdst;
+	
+	/* recent history */
+	if(off <= dl->near_len)
+	{
+		rptr = (dl->nptr - off) & (dl->near_len-1);
+		n = dl->near_len - rptr;
+		if(n >= sz)
+			return &dl->near[2*rptr];
+		memcpy(dst, &dl->near[2*rptr], 2*n*sizeof(int16_t));
+		memcpy(&dst[2*n], dl->near, 2*(sz-n)*sizeof(int16_t));
+		return dst;
+	}
+	
+	/* older history - start of span */
+	rptr = dl->wptr - off;
+	rptr = rptr < 0 ? dl->far_len + rptr : rptr;
+	
+	if(dl->codec)
+	{
+		/* decode all codec blocks the span touches */
+		cb = (uint8_t *)dl->far;
+		nblk = dl->far_len / DLYC_FRAMES;
+		b = rptr / DLYC_FRAMES;
+		ofs = rptr % DLYC_FRAMES;
+		n = (ofs + sz + DLYC_FRAMES - 1) / DLYC_FRAMES;
+		for(blkdst=dst;n--;blkdst+=2*DLYC_FRAMES)
+		{
+			dlyc_decode(blkdst, &cb[DLYC_BYTES*b]);
+			b = b+1 == nblk ? 0 : b+1;
+		}
+		return &dst[2*ofs];
+	}
+	
+	/* split at buffer wrap */
+	n = dl->far_len - rptr;
+	n = n > sz ? sz : n;
+	memcpy(dst, &((int16_t *)dl->far)[2*rptr], 2*n*sizeof(int16_t));
+	if(n < sz)
+		memcpy(&dst[2*n], dl->far, 2*(sz-n)*sizeof(int16_t));
+	return dst;
+}
+
+/*
+ * append sz frames
+ */
+void IRAM_ATTR dlyline_write(dlyline *dl, const int16_t *src, uint16_t sz)
+{
+	uint32_t n;
+	
+	while(sz)
+	{
+		/* up to the end of the block being filled - never wraps the ring */
+		n = DLYL_SPILL - (dl->nptr & (DLYL_SPILL-1));
+		n = n > sz ? sz : n;
+		memcpy(&dl->near[2*dl->nptr], src, 2*n*sizeof(int16_t));
+		src += 2*n;
+		sz -= n;
+		dl->nptr = (dl->nptr + n) & (dl->near_len-1);
+		dl->wptr += n;
+		dl->wptr = dl->wptr >= dl->far_len ? dl->wptr - dl->far_len : dl->wptr;
+		
+		if(!(dl->nptr & (DLYL_SPILL-1)))
+			dlyline_spill(dl);
+	}
+}
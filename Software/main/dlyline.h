@@ -0,0 +1,74 @@
+/*
+ * dlyline.h - tiered stereo delay line, recent history in SRAM
+ * 10-18-26
+ */
+
+#ifndef __dlyline__
+#define __dlyline__
+
+#include "fx.h"
+#include "dlycodec.h"
+
+/* frames per bulk spill to PSRAM & longest span read */
+#define DLYL_SPILL FRAMESZ
+
+/* scratch frames needed by dlyline_read() */
+#define DLYL_RD_FRAMES (DLYL_SPILL+DLYC_FRAMES)
+
+typedef struct
+{
+	int16_t *near;			/* SRAM ring of newest frames */
+	uint32_t near_len;		/* frames, power of 2 */
+	uint32_t nptr;			/* near write index */
+	void *far;				/* PSRAM history */
+	uint32_t far_len;		/* frames */
+	uint32_t wptr;			/* far write index, incl. frames not spilled yet */
+	uint32_t max;			/* longest usable offset */
+	uint8_t codec;			/* far tier is 8-bit compressed */
+} dlyline;
+
+void dlyline_init(dlyline *dl, int16_t *near, uint32_t near_len, void *far,
+	size_t far_sz, uint8_t codec);
+void dlyline_spill(dlyline *dl);
+int16_t * dlyline_read(dlyline *dl, int16_t *dst, uint32_t off, uint16_t sz);
+void dlyline_write(dlyline *dl, const int16_t *src, uint16_t sz);
+
+/*
+ * one sample from the frame written off frames ago (1 = newest)
+ */
+static inline __attribute__((always_inline)) int16_t dlyline_tap(dlyline *dl, uint32_t off, uint8_t chl)
+{
+	int32_t rptr;
+	uint8_t *cb;
+	
+	/* recent history */
+	if(off <= dl->near_len)
+		return dl->near[2*((dl->nptr - off) & (dl->near_len-1)) + chl];
+	
+	/* older history */
+	rptr = dl->wptr - off;
+	rptr = rptr < 0 ? dl->far_len + rptr : rptr;
+	if(dl->codec)
+	{
+		cb = (uint8_t *)dl->far + DLYC_BYTES*(rptr / DLYC_FRAMES);
+		return (int8_t)cb[2 + 2*(rptr % DLYC_FRAMES) + chl] << cb[chl];
+	}
+	return ((int16_t *)dl->far)[2*rptr + chl];
+}
+
+/*
+ * append one frame
+ */
+static inline __attribute__((always_inline)) void dlyline_put(dlyline *dl, const int16_t *frm)
+{
+	dl->near[2*dl->nptr] = frm[0];
+	dl->near[2*dl->nptr+1] = frm[1];
+	dl->nptr = (dl->nptr + 1) & (dl->near_len-1);
+	dl->wptr = dl->wptr + 1 == dl->far_len ? 0 : dl->wptr + 1;
+	
+	/* bulk copy out each completed block */
+	if(!(dl->nptr & (DLYL_SPILL-1)))
+		dlyline_spill(dl);
+}
+
+#endif
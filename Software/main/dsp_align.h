@@ -0,0 +1,43 @@
+/*
+ * dsp_align.h - alignment for audio buffers & state
+ * 10-18-26
+ *
+ * PIE vector loads & stores (EE.VLD/EE.VST.128) drop the low address bits,
+ * so anything they may touch has to start on 16 bytes, and GDMA to PSRAM
+ * wants 64 bytes - those two are for correctness. A PSRAM block that
+ * doesn't start on a cache line spans one more line than it needs, but
+ * what lining them up saves hasn't been measured. The bench's align
+ * figures are where to check before counting on it.
+ */
+
+#ifndef __dsp_align__
+#define __dsp_align__
+
+#include <stdint.h>
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+/* PIE 128-bit vectors */
+#define DSP_VEC_ALIGN 16
+
+/* data cache line in front of PSRAM */
+#ifdef CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE
+#define DSP_CACHE_ALIGN CONFIG_ESP32S3_DATA_CACHE_LINE_SIZE
+#else
+#define DSP_CACHE_ALIGN 32
+#endif
+
+/* GDMA w/ PSRAM on either end */
+#define DSP_DMA_ALIGN 64
+
+/* placement attributes */
+#define DSP_ALIGNED(n) __attribute__((aligned(n)))
+#define DSP_VEC DSP_ALIGNED(DSP_VEC_ALIGN)
+#define DSP_CACHED DSP_ALIGNED(DSP_CACHE_ALIGN)
+
+/* round up sizes & check addresses */
+#define DSP_ALIGN_UP(x, n) (((x) + (n) - 1) & ~((n) - 1))
+#define DSP_IS_ALIGNED(p, n) ((((uintptr_t)(p)) & ((n) - 1)) == 0)
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * dsp_fixed.h - fixed-point arithmetic primitives for ESP32S3 Audio
+ * 10-18-26
+ *
+ * Typed Q15, Q31, S8.23 and 12-bit control gain operations. On Xtensa
+ * these map directly onto MUL16S / MULL / MULSH / CLAMPS so the generated
+ * code doesn't depend on what the compiler makes of 64-bit intermediates.
+ * The 64-bit product is narrowed w/ SLLI / EXTUI / OR rather than SSAI+SRC
+ * so SAR, which gcc can't be told about, is left alone. Elsewhere the
+ * portable C versions are used and give bit-identical results - the
+ * BENCHMARK build checks the two against each other on the target.
+ */
+
+#ifndef __dsp_fixed__
+#define __dsp_fixed__
+
+#include <stdint.h>
+
+typedef int16_t q15_t;		/* S0.15 */
+typedef int32_t q31_t;		/* S0.31 */
+typedef int32_t s823_t;		/* S8.23 */
+
+#define Q15_ONE  (32767)
+#define Q31_ONE  (0x7fffffff)
+#define S823_ONE (8388608)
+
+/*
+ * signed saturation to 16-bit
+ */
+static inline __attribute__((always_inline)) int16_t dsp_ssat16(int32_t in)
+{
+#ifdef __XTENSA__
+	int32_t out;
+	asm("clamps %0, %1, 15" : "=a" (out) : "a" (in));
+	return out;
+#else
+	in = in > 32767 ? 32767 : in;
+	in = in < -32768 ? -32768 : in;
+	return in;
+#endif
+}
+
+/**
+  \brief   Signed Saturate
+  \details Saturates a signed value.
+  \param [in]  ARG1  Value to be saturated
+  \param [in]  ARG2  Bit position to saturate to (7..22)
+  \return             Saturated value
+ */
+#ifdef __XTENSA__
+#define __SSAT(ARG1,ARG2) \
+__extension__ \
+({                          \
+  int32_t __RES, __ARG1 = (ARG1); \
+  asm("clamps %0, %1, %2" : "=a" (__RES) :  "a" (__ARG1), "I" (ARG2) ); \
+  __RES; \
+ })
+#else
+#define __SSAT(ARG1,ARG2) \
+__extension__ \
+({                          \
+  int32_t __ARG1 = (ARG1); \
+  __ARG1 > ((1<<(ARG2))-1) ? ((1<<(ARG2))-1) : \
+  (__ARG1 < -(1<<(ARG2)) ? -(1<<(ARG2)) : __ARG1); \
+ })
+#endif
+
+/*
+ * arithmetic right shift with round-to-nearest
+ */
+static inline __attribute__((always_inline)) int32_t dsp_rshift_rnd(int32_t x, const int sh)
+{
+	return (x + (1<<(sh-1))) >> sh;
+}
+
+/*
+ * Q15 x Q15 -> Q15, truncated. -1 * -1 saturates to +1.
+ */
+static inline __attribute__((always_inline)) q15_t q15_mul(q15_t x, q15_t y)
+{
+#ifdef __XTENSA__
+	int32_t out;
+	asm("mul16s %0, %1, %2\n\t"
+		"srai %0, %0, 15\n\t"
+		"clamps %0, %0, 15"
+		: "=&a" (out) : "a" (x), "a" (y));
+	return out;
+#else
+	return dsp_ssat16(((int32_t)x * (int32_t)y) >> 15);
+#endif
+}
+
+/*
+ * Q15 x Q15 accumulated into a Q30 sum. The MAC16 accumulator isn't used
+ * since its state can't be kept live across C statements.
+ */
+static inline __attribute__((always_inline)) int32_t q15_mac(int32_t acc, q15_t x, q15_t y)
+{
+#ifdef __XTENSA__
+	int32_t p;
+	asm("mul16s %0, %1, %2" : "=a" (p) : "a" (x), "a" (y));
+	return acc + p;
+#else
+	return acc + (int32_t)x * (int32_t)y;
+#endif
+}
+
+/*
+ * Q31 x Q31 -> high word of the 64-bit product (Q30)
+ */
+static inline __attribute__((always_inline)) int32_t q31_mulh(q31_t x, q31_t y)
+{
+#ifdef __XTENSA__
+	int32_t out;
+	asm("mulsh %0, %1, %2" : "=a" (out) : "a" (x), "a" (y));
+	return out;
+#else
+	return ((int64_t)x * (int64_t)y) >> 32;
+#endif
+}
+
+/*
+ * Q31 x Q31 -> Q31, truncated
+ */
+static inline __attribute__((always_inline)) q31_t q31_mul(q31_t x, q31_t y)
+{
+#ifdef __XTENSA__
+	int32_t hi, lo;
+	asm("mull %1, %2, %3\n\t"
+		"mulsh %0, %2, %3\n\t"
+		"slli %0, %0, 1\n\t"
+		"extui %1, %1, 31, 1\n\t"
+		"or %0, %0, %1"
+		: "=&a" (hi), "=&a" (lo) : "a" (x), "a" (y));
+	return hi;
+#else
+	return ((int64_t)x * (int64_t)y) >> 31;
+#endif
+}
+
+/*
+ * Q31 multiply-accumulate into a 64-bit Q62 sum
+ */
+static inline __attribute__((always_inline)) int64_t q31_mac(int64_t acc, q31_t x, q31_t y)
+{
+	return acc + (int64_t)x * (int64_t)y;
+}
+
+/*
+ * 12-bit control gains (ADC scale, 4096 = unity): multiply-accumulate
+ * into a Q12 sum, then narrow back to 16 bits with saturation
+ */
+static inline __attribute__((always_inline)) int32_t q12_mac(int32_t acc, int16_t x, int16_t g)
+{
+	return q15_mac(acc, x, g);
+}
+
+static inline __attribute__((always_inline)) int16_t q12_sat16(int32_t acc)
+{
+	return dsp_ssat16(acc >> 12);
+}
+
+/*
+ * S8.23 x S8.23 -> S8.23, truncated
+ */
+static inline __attribute__((always_inline)) s823_t s823_mul(s823_t x, s823_t y)
+{
+#ifdef __XTENSA__
+	int32_t hi, lo;
+	asm("mull %1, %2, %3\n\t"
+		"mulsh %0, %2, %3\n\t"
+		"slli %0, %0, 9\n\t"
+		"extui %1, %1, 23, 9\n\t"
+		"or %0, %0, %1"
+		: "=&a" (hi), "=&a" (lo) : "a" (x), "a" (y));
+	return hi;
+#else
+	return ((int64_t)x * (int64_t)y) >> 23;
+#endif
+}
+
+/*
+ * S8.23 x S8.23 -> S8.23 with round-to-nearest
+ */
+static inline __attribute__((always_inline)) s823_t s823_mul_rnd(s823_t x, s823_t y)
+{
+	return ((int64_t)x * (int64_t)y + (1<<22)) >> 23;
+}
+
+#endif
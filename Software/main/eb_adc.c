@@ -5,26 +5,58 @@
  
 #include <stdio.h>
 #include "main.h"
-//#include "driver/adc.h"
-#include "esp_adc/adc_oneshot.h"
-#include "driver/gpio.h"
+#include "esp_adc/adc_continuous.h"
 #include "esp_timer.h"
-#include "hal/i2s_hal.h"
-#include "hal/i2s_types.h"
-#include <soc/sens_reg.h>
-#include <soc/sens_struct.h>
-#include <soc/spi_reg.h>
-#include <soc/spi_struct.h>
+#include "fx.h"
 #include "eb_adc.h"
+#include "cvmod.h"
+#include "cvcal.h"
+#include "cvcond.h"
+#include "cvgate.h"
+#include "cpuload.h"
 
 static const char* TAG = "eb_adc";
-static uint8_t adc_idx, adc_hyst_state, adc_param_idx;
-//static int16_t adc_hyst_val;
-int32_t adc_iir[ADC_NUMVALS];
 volatile int16_t adc_val[ADC_NUMVALS], adc_param[ADC_NUMPARAMS];
+volatile int16_t adc_mv[ADC_NUMVALS];
+volatile int16_t adc_avg[ADC_NUMVALS];
 
-#define GET_UNIT(x)			((x>>3) & 0x1)
-#define TIMES				8
+/*
+ * Continuous conversions - all four channels round robin at ADC_RATE total,
+ * DMA'd in frames of one audio block's worth. The DMA ISR just queues each
+ * frame w/ the time it landed & the audio callback decimates the newest at
+ * the start of each block, so CVs are sampled in step w/ the audio w/ no
+ * CPU polling. Every queued frame is scanned for gate edges.
+ */
+#define ADC_RATE			48000
+#define ADC_FRAME_CONV		(ADC_RATE*FRAMESZ/SAMPLE_RATE)
+#define ADC_FRAME_BYTES		(ADC_FRAME_CONV*SOC_ADC_DIGI_RESULT_BYTES)
+#define ADC_POOL_BYTES		(2*ADC_FRAME_BYTES)
+#define ADC_CHL_NONE		0xff
+
+/* frames in flight to the audio callback - a power of 2, fewer than the
+ * driver's DMA buffers so none is rewritten while it's queued */
+#define ADC_QLEN			4
+
+/* oldest a frame can be & still fit its samples' ages in 16 bits */
+#define ADC_AGE_MAX			(UINT16_MAX-ADC_FRAME_CONV)
+
+static adc_continuous_handle_t adc_hdl;
+/* the driver cycles DMA through several frames, so each one stays put for
+ * a few blocks after it lands */
+typedef struct
+{
+	struct
+	{
+		uint8_t *frm;
+		int64_t t;			/* landed, us */
+	} f[ADC_QLEN];
+	uint32_t head;
+	uint32_t tail;
+} adc_queue;
+
+static adc_queue adc_q;
+static int16_t adc_raw[ADC_NUMVALS][CVMOD_MAX_IN];	/* per channel for CV streams */
+static uint16_t adc_age[ADC_NUMVALS][CVMOD_MAX_IN];	/* & samples before the block */
 
 /*
  * channel mapping:
@@ -41,159 +73,179 @@ const uint8_t adc_chls[ADC_NUMVALS] =
 	ADC_CHANNEL_5,	
 };
 
+/* ADC1 channel back to value index */
+const uint8_t adc_chl_idx[SOC_ADC_MAX_CHANNEL_NUM] =
+{
+	ADC_CHL_NONE, ADC_CHL_NONE, ADC_CHL_NONE, ADC_CHL_NONE,
+	2, 3, 1, 0,
+	ADC_CHL_NONE, ADC_CHL_NONE,
+};
+
 /*
- * low-level: set channel, wait for ready & start conversion
- * cuts time from 45us to 15us
+ * DMA frame done - from the ADC ISR on the core that started it
  */
-void IRAM_ATTR my_adc1_get_raw_begin(uint8_t chl)
+static bool IRAM_ATTR adc_conv_done(adc_continuous_handle_t handle,
+	const adc_continuous_evt_data_t *edata, void *user_data)
 {
-	SENS.sar_meas1_ctrl2.sar1_en_pad = (1 << chl);
-	/* note that this reg is undocumented! */
-	while (HAL_FORCE_READ_U32_REG_FIELD(SENS.sar_slave_addr1, meas_status) != 0) {}
-	SENS.sar_meas1_ctrl2.meas1_start_sar = 0;
-	SENS.sar_meas1_ctrl2.meas1_start_sar = 1;
+	uint32_t cyc = esp_cpu_get_cycle_count();
+	uint32_t head = adc_q.head;
+	
+	/* full - audio isn't running, drop it */
+	if((edata->size == ADC_FRAME_BYTES) &&
+		(head - __atomic_load_n(&adc_q.tail, __ATOMIC_ACQUIRE) < ADC_QLEN))
+	{
+		adc_q.f[head & (ADC_QLEN-1)].frm = edata->conv_frame_buffer;
+		adc_q.f[head & (ADC_QLEN-1)].t = esp_timer_get_time();
+		__atomic_store_n(&adc_q.head, head+1, __ATOMIC_RELEASE);
+	}
+	
+	cpuload_isr_add(esp_cpu_get_cycle_count() - cyc);
+	return false;
 }
 
 /*
- * low-level: wait for eoc & fetch result
+ * driver's copy pool is never read so it's always full - nothing to do
  */
-int16_t IRAM_ATTR my_adc1_get_raw_end(void)
+static bool IRAM_ATTR adc_pool_ovf(adc_continuous_handle_t handle,
+	const adc_continuous_evt_data_t *edata, void *user_data)
 {
-    while (SENS.sar_meas1_ctrl2.meas1_done_sar == 0);
-    return 4095-HAL_FORCE_READ_U32_REG_FIELD(SENS.sar_meas1_ctrl2, meas1_data_sar);
+	return false;
 }
 
 /*
- * IIR filter for 12-bit ADC values 
+ * split a frame by channel - sums for decimation, raw samples for CV
+ * streams & gates, each w/ its age at the block start from when the frame
+ * landed. Conversion i of the frame was ADC_FRAME_CONV-1-i before that.
  */
-#define IIR_COEF 4
-inline int16_t adc_IIR_filter(int32_t *filt_state, int16_t in)
+static void IRAM_ATTR eb_adc_unpack(const uint8_t *frm, uint32_t age,
+	uint32_t *sum, uint32_t *cnt)
 {
-	*filt_state += ((in<<IIR_COEF) - *filt_state )>>IIR_COEF;
-	return *filt_state >> (IIR_COEF);
+	const adc_digi_output_data_t *d = (const adc_digi_output_data_t *)frm;
+	uint8_t idx;
+	uint16_t i;
+	
+	for(idx=0;idx<ADC_NUMVALS;idx++)
+		sum[idx] = cnt[idx] = 0;
+	
+	/* boxcar over the block */
+	for(i=0;i<ADC_FRAME_CONV;i++)
+	{
+		if(d[i].type2.unit != ADC_UNIT_1 || d[i].type2.channel >= SOC_ADC_MAX_CHANNEL_NUM)
+			continue;
+		idx = adc_chl_idx[d[i].type2.channel];
+		if(idx == ADC_CHL_NONE)
+			continue;
+		if(cnt[idx] < CVMOD_MAX_IN)
+		{
+			adc_raw[idx][cnt[idx]] = 4095-d[i].type2.data;
+			adc_age[idx][cnt[idx]] = age +
+				((ADC_FRAME_CONV-1-i) * SAMPLE_RATE) / ADC_RATE;
+		}
+		sum[idx] += d[i].type2.data;
+		cnt[idx]++;
+	}
 }
 
 /*
- * ADC timer callback
+ * decimate the newest frame to one value per channel - from the audio
+ * callback at the start of a block. The ADC & I2S clocks aren't locked, so
+ * now & then no frame lands in a block & the CVs hold, or two land in one. Every frame
+ * that landed goes to the gate detectors, and the newest one's raw samples
+ * also go on to any CV streams effects have asked for.
  */
-void IRAM_ATTR adc_timer_callback(void *arg)
+void IRAM_ATTR eb_adc_block(void)
 {
-	/* set ISR active flag */
-	//gpio_set_level(DIAG_1, 1);
+	uint32_t sum[ADC_NUMVALS], cnt[ADC_NUMVALS] = {0};
+	uint32_t tail = adc_q.tail, age, n;
+	int64_t now = esp_timer_get_time();
+	uint8_t idx, fresh = 0;
 	
-	/* don't wait for conversion - get previous result */
-	adc_val[adc_idx] = adc_IIR_filter(&adc_iir[adc_idx], my_adc1_get_raw_end());
-
-#if 0
-	/* handle hysteresis */
-	if(adc_idx<(ADC_NUMVALS-1))
+	/* every frame since the last block, oldest first */
+	cvgate_begin();
+	while(tail != __atomic_load_n(&adc_q.head, __ATOMIC_ACQUIRE))
 	{
-		/* update parameter */
-		switch(adc_hyst_state)
+		age = ((now - adc_q.f[tail & (ADC_QLEN-1)].t) * SAMPLE_RATE) / 1000000;
+		age = age > ADC_AGE_MAX ? ADC_AGE_MAX : age;
+		eb_adc_unpack(adc_q.f[tail & (ADC_QLEN-1)].frm, age, sum, cnt);
+		for(idx=0;idx<ADC_NUMVALS;idx++)
 		{
-			case 0:	/* reset */
-				adc_hyst_val = adc_val[1];
-				adc_hyst_state = 1;
-				break;
-			
-			case 1: /* locked & waiting for unlock */
-				if(abs(adc_val[1]-adc_hyst_val) > 200)
-					adc_hyst_state = 2;
-				break;
-			
-			case 2:	/* tracking */
-				adc_param[adc_param_idx] = adc_val[1];
-				break;
+			n = cnt[idx] < CVMOD_MAX_IN ? cnt[idx] : CVMOD_MAX_IN;
+			cvgate_scan(idx, adc_raw[idx], adc_age[idx], n);
 		}
+		__atomic_store_n(&adc_q.tail, ++tail, __ATOMIC_RELEASE);
+		fresh = 1;
 	}
-#else
-	/* just pass thru to params */
-	adc_param[adc_idx] = adc_val[adc_idx];
-#endif
-
-	/* advance channel */
-	adc_idx = (adc_idx + 1)%ADC_NUMVALS;
+	cvgate_end();
 	
-	/* start next conversion */
-	my_adc1_get_raw_begin(adc_chls[adc_idx]);
+	/* nothing new - streams hold */
+	if(!fresh)
+	{
+		for(idx=0;idx<ADC_NUMVALS;idx++)
+			cvmod_push(idx, NULL, 0);
+		return;
+	}
 	
-	/* clear ISR active flag */
-	//gpio_set_level(DIAG_1, 0);
+	for(idx=0;idx<ADC_NUMVALS;idx++)
+	{
+		cvmod_push(idx, adc_raw[idx], cnt[idx] < CVMOD_MAX_IN ? cnt[idx] : CVMOD_MAX_IN);
+		if(!cnt[idx])
+			continue;
+		
+		/* calibration sees the plain average */
+		adc_avg[idx] = 4095-(sum[idx]/cnt[idx]);
+		adc_mv[idx] = cvcal_mv(idx, adc_avg[idx]);
+		
+		/* conditioned for use as controls */
+		adc_val[idx] = cvcond_proc(idx, adc_avg[idx]);
+		adc_param[idx] = adc_val[idx];
+	}
 }
 
 esp_err_t eb_adc_init(void)
 {
+	adc_digi_pattern_config_t pattern[ADC_NUMVALS];
 	uint8_t i;
-	esp_timer_handle_t timer_handle;
 	
 	/* setup state */
-	adc_idx = 0;
-	adc_hyst_state = 0;
-	adc_param_idx = 0;
+	cvcond_init();
+	cvgate_init();
 	
-	/* single conversions w/ timer */
-#if 0
-	/* OLD API is deprecated */
-    ESP_LOGI(TAG, "PIO mode w/ deprecated driver");
-	adc1_config_width(ADC_WIDTH_BIT_12);
-	adc1_config_channel_atten(CV0, ADC_ATTEN_DB_6);
-	adc1_config_channel_atten(CV1, ADC_ATTEN_DB_6);
-	adc1_get_raw(CV0);
-#else
-	/* New one-shot API */
-    ESP_LOGI(TAG, "PIO mode w/ new one-shot driver");
-	/* init ADC1 */
-	adc_oneshot_unit_handle_t adc1_handle;
-	adc_oneshot_unit_init_cfg_t init_config1 = {
-		.unit_id = ADC_UNIT_1,
-		.ulp_mode = ADC_ULP_MODE_DISABLE,
+	/* continuous conversions w/ DMA */
+    ESP_LOGI(TAG, "DMA mode w/ continuous driver, %d Hz per channel", ADC_RATE/ADC_NUMVALS);
+	adc_continuous_handle_cfg_t hdl_config = {
+		.max_store_buf_size = ADC_POOL_BYTES,
+		.conv_frame_size = ADC_FRAME_BYTES,
 	};
-	ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config1, &adc1_handle));
+	ESP_ERROR_CHECK(adc_continuous_new_handle(&hdl_config, &adc_hdl));
 	
 	/* set up channels: GPIO 5-8 are ADC1 chls 4-7 */
-	adc_oneshot_chan_cfg_t config = {
-		.bitwidth = SOC_ADC_RTC_MAX_BITWIDTH,	// defaults to 12 bit on S3
-		.atten = ADC_ATTEN_DB_6,
-	};
 	for(i=0;i<ADC_NUMVALS;i++)
-		ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, adc_chls[i], &config));
-
-	/* read a channel to start ADC */
-	int dummy;
-	ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, adc_chls[0], &dummy));
-#endif
+	{
+		pattern[i].atten = ADC_ATTEN_DB_6;
+		pattern[i].channel = adc_chls[i];
+		pattern[i].unit = ADC_UNIT_1;
+		pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;	// 12 bit on S3
+	}
+	adc_continuous_config_t dig_cfg = {
+		.pattern_num = ADC_NUMVALS,
+		.adc_pattern = pattern,
+		.sample_freq_hz = ADC_RATE,
+		.conv_mode = ADC_CONV_SINGLE_UNIT_1,
+		.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+	};
+	ESP_ERROR_CHECK(adc_continuous_config(adc_hdl, &dig_cfg));
 	
-	/* Timer for controlling ADC sampling intervals */
-	esp_timer_create_args_t timer_args = {
-		.callback = adc_timer_callback,
-		.arg = NULL,
-		.name = "adc_timer",
-		.skip_unhandled_events = true
+	/* track frames as they land */
+	adc_continuous_evt_cbs_t cbs = {
+		.on_conv_done = adc_conv_done,
+		.on_pool_ovf = adc_pool_ovf,
 	};
-	esp_timer_create(&timer_args, &timer_handle);
-	esp_timer_start_periodic(timer_handle, 1000);
+	ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc_hdl, &cbs, NULL));
+	ESP_ERROR_CHECK(adc_continuous_start(adc_hdl));
 	
 	return ESP_OK;
 }
 
-/*
- * set adc[1] parameter destination
- */
-void eb_adc_setactparam(uint8_t idx)
-{
-	if(idx>=ADC_NUMPARAMS)
-		return;
-	
-	if(idx != adc_param_idx)
-	{
-		/* this has to be atomic */
-		taskDISABLE_INTERRUPTS();
-		adc_param_idx = idx;
-		adc_hyst_state = 0;
-		taskENABLE_INTERRUPTS();
-	}
-}
-
 /*
  * set adc[1] parameter value
  */
@@ -204,11 +256,3 @@ void eb_adc_setparamval(uint8_t idx, int16_t val)
 	
 	adc_param[idx] = val;
 }
-
-/*
- * force adc[1] active parameter hysteresis to track live value
- */
-void eb_adc_forceactparam(void)
-{
-	adc_hyst_state = 2;
-}
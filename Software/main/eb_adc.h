@@ -10,10 +10,11 @@
 #define ADC_NUMPARAMS 4
 
 extern volatile int16_t adc_val[ADC_NUMVALS], adc_param[ADC_NUMPARAMS];
+extern volatile int16_t adc_mv[ADC_NUMVALS];	/* calibrated, see cvcal.h */
+extern volatile int16_t adc_avg[ADC_NUMVALS];	/* before conditioning */
 
 esp_err_t eb_adc_init(void);
-void eb_adc_setactparam(uint8_t idx);
+void eb_adc_block(void);
 void eb_adc_setparamval(uint8_t idx, int16_t val);
-void eb_adc_forceactparam(void);
 
 #endif
@@ -12,7 +12,11 @@
 #include "driver/i2s_std.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "sdkconfig.h"
 #include "eb_i2s.h"
+#include "dsp_align.h"
 
 /* Hardware I/O defines */
 #define I2S_STD_MCLK_IO1        GPIO_NUM_15      // I2S master clock io number
@@ -24,6 +28,9 @@
 #define GPIO_TX_DIAG_PIN        GPIO_NUM_36      // Realtime Diag pin for TX
 #define GPIO_RX_DIAG_PIN        GPIO_NUM_37      // Realtime Diag pin for RX
 
+/* TX callback more than 1.5 DMA buffers late counts as an xrun */
+#define I2S_LATE_CYC            (3*64*(CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ*1000000/48000)/2)
+
 /* tag for logging */
 static const char* TAG = "eb_i2s";
 
@@ -35,16 +42,21 @@ static i2s_chan_handle_t	rx_chan;        // I2S rx channel handler
  * Asynchronous callbacks
  */
 int rx_cnt = 0, tx_cnt = 0;
-int16_t *tx_buffer, *rx_buffer, temp_buf[128];
+int16_t *tx_buffer, *rx_buffer;
+int16_t temp_buf[128] DSP_VEC;
 uint32_t tx_sz, rx_sz;
 uint32_t cp0_regs[18];
 void (*audio_cb)(int16_t *dst, int16_t *src, uint32_t len);
 
+/* xrun detection */
+static uint32_t tx_last_cyc, tx_last_rx;
+static volatile uint32_t xrun_cnt = 0;
+
 /*
  * RX IRQ callback - this is where all the work is done
  * handling data generation in RX IRQ has ~3ms latency
  */
-bool i2s_async_rx_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+bool IRAM_ATTR i2s_async_rx_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
 {
 	/* raise RT diag */
 	gpio_set_level(GPIO_RX_DIAG_PIN, 1);
@@ -76,11 +88,18 @@ bool i2s_async_rx_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *us
  * TX IRQ callback - unused for now
  * handling data generation in TX IRQ has ~5ms latency
  */
-bool i2s_async_tx_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+bool IRAM_ATTR i2s_async_tx_cb(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
 {
 	/* raise RT diag */
 	gpio_set_level(GPIO_TX_DIAG_PIN, 1);
 	
+	/* stale data or a missed buffer is an xrun */
+	uint32_t now = esp_cpu_get_cycle_count();
+	if(tx_cnt && ((rx_cnt == tx_last_rx) || ((now - tx_last_cyc) > I2S_LATE_CYC)))
+		xrun_cnt++;
+	tx_last_cyc = now;
+	tx_last_rx = rx_cnt;
+	
 	/* get dest buffer & size */
 	tx_buffer = *((int16_t **)event->data);
 	tx_sz = event->size / sizeof(int16_t);
@@ -167,6 +186,14 @@ void i2s_init(void (*ap_cb)(int16_t *dst, int16_t *src, uint32_t len))
     ESP_ERROR_CHECK(i2s_channel_enable(tx_chan));
 }
 
+/*
+ * count of output buffers that went out late or without fresh data
+ */
+uint32_t i2s_get_xruns(void)
+{
+	return xrun_cnt;
+}
+
 /*
  * diags
  */
@@ -7,6 +7,7 @@
 #define __eb_i2s__
 
 void i2s_init(void (*ap_cb)(int16_t *dst, int16_t *src, uint32_t len));
+uint32_t i2s_get_xruns(void);
 void i2s_diag(void);
 
 #endif
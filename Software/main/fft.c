@@ -0,0 +1,579 @@
+/*
+ * fft.c - fixed-point complex & real FFT, radix-4 w/ block floating point
+ * 10-18-26
+ *
+ * Data is Q15 int16, complex values interleaved re/im. Transforms are in
+ * place and unnormalized - each stage checks the peak of its input and
+ * only shifts down as far as needed to guarantee no overflow, so the
+ * true result is buf * 2^exp. Input is bit-reversed then run through
+ * radix-4 DIT stages, w/ a single radix-2 stage first for odd powers of 2.
+ * Plain C so the same code runs on the host as a reference.
+ *
+ * With CONFIG_S3GTA_FFT_PIE the radix-4 stages w/ 4 or more legs run 4
+ * legs at a time on the PIE vector unit, when buf is on 16 bytes and the
+ * caller is a task - IDF doesn't save the vector registers for ISRs. The
+ * twiddle products are truncated rather than rounded there, so results
+ * differ from the C path in the last bit. Host builds w/ FFT_PIE_EMU run
+ * the same data flow through C versions of the instructions.
+ */
+
+#include <math.h>
+#include "dsp_lib.h"
+#include "fft.h"
+
+#if defined(CONFIG_S3GTA_FFT_PIE) || defined(FFT_PIE_EMU)
+#define FFT_PIE
+#endif
+
+/* peak inputs that can't overflow a radix-4 / radix-2 stage */
+#define FFT_R4_MAX	5792		// 32767 / (4*sqrt(2))
+#define FFT_R2_MAX	11585		// 32767 / (2*sqrt(2))
+#define FFT_RS_MAX	13573		// 32767 / (1+sqrt(2)) for real split
+
+/* quarter wave sine table at FFT_MAX_N resolution */
+#define FFT_QTR		(FFT_MAX_N/4)
+static int16_t fft_sin[FFT_QTR+1] DSP_VEC;
+static uint8_t fft_valid = 0;
+
+#ifdef BENCHMARK
+/* clear to force the C radix-4 stages for comparison */
+uint8_t fft_pie = 1;
+#endif
+
+/*
+ * build the twiddle table
+ */
+void fft_init(void)
+{
+	uint16_t i;
+	
+	if(fft_valid)
+		return;
+	
+	for(i=0;i<=FFT_QTR;i++)
+		fft_sin[i] = lrintf(32767.0F * sinf(2.0F * (float)M_PI * (float)i / (float)FFT_MAX_N));
+	
+	fft_valid = 1;
+}
+
+/*
+ * get cos & sin of 2*pi*m/FFT_MAX_N from quarter wave table
+ */
+static inline __attribute__((always_inline)) void fft_twiddle(uint32_t m, int32_t *c, int32_t *s)
+{
+	uint32_t r = m & (FFT_QTR-1);
+	
+	switch((m / FFT_QTR) & 3)
+	{
+		case 0:
+			*c = fft_sin[FFT_QTR-r];
+			*s = fft_sin[r];
+			break;
+		
+		case 1:
+			*c = -fft_sin[r];
+			*s = fft_sin[FFT_QTR-r];
+			break;
+		
+		case 2:
+			*c = -fft_sin[FFT_QTR-r];
+			*s = -fft_sin[r];
+			break;
+		
+		default:
+			*c = fft_sin[r];
+			*s = -fft_sin[FFT_QTR-r];
+			break;
+	}
+}
+
+/*
+ * peak abs value over a buffer
+ */
+static int32_t IRAM_ATTR fft_peak(int16_t *buf, uint32_t len)
+{
+	int32_t v, max = 0;
+	
+	while(len--)
+	{
+		v = *buf++;
+		v = v < 0 ? -v : v;
+		max = v > max ? v : max;
+	}
+	
+	return max;
+}
+
+/*
+ * negate imag parts - used to run the inverse through the forward
+ */
+static void IRAM_ATTR fft_conj(int16_t *buf, uint16_t n)
+{
+	buf++;
+	while(n--)
+	{
+		*buf = dsp_ssat16(-(int32_t)*buf);
+		buf += 2;
+	}
+}
+
+/*
+ * in-place bit reversal permutation of complex data
+ */
+static void IRAM_ATTR fft_bitrev(int16_t *buf, uint16_t n)
+{
+	uint32_t i, j, m;
+	int16_t tr, ti;
+	
+	for(i=0,j=0;i<n;i++)
+	{
+		if(i<j)
+		{
+			tr = buf[2*i];
+			ti = buf[2*i+1];
+			buf[2*i] = buf[2*j];
+			buf[2*i+1] = buf[2*j+1];
+			buf[2*j] = tr;
+			buf[2*j+1] = ti;
+		}
+		
+		/* increment j bit-reversed */
+		m = n>>1;
+		while(j & m)
+		{
+			j ^= m;
+			m >>= 1;
+		}
+		j |= m;
+	}
+}
+
+#ifdef FFT_PIE
+/* twiddle vectors for 4 legs, in the order the butterfly loads them */
+enum fft_pie_tw
+{
+	FFT_TW_ONES,	/* 1 - scales x0 */
+	FFT_TW_W2,
+	FFT_TW_W1,
+	FFT_TW_W1J,		/* -j*w1, so x1*conj() of it is j*t1 */
+	FFT_TW_W3,
+	FFT_TW_W3J,
+	FFT_TW_NUM
+};
+
+#ifndef __XTENSA__
+/*
+ * the instructions, for checking the data flow on the host. cmul mode 2/3
+ * is x * conj(w) into the low/high half, all products truncated by SAR.
+ */
+static void fft_emu_cmul(int16_t *z, const int16_t *x, const int16_t *w, int32_t sar)
+{
+	uint8_t i;
+	
+	for(i=0;i<8;i+=2)
+	{
+		z[i] = (x[i]*w[i] + x[i+1]*w[i+1]) >> sar;
+		z[i+1] = (x[i+1]*w[i] - x[i]*w[i+1]) >> sar;
+	}
+}
+
+static void fft_emu_adds(int16_t *z, const int16_t *x, const int16_t *y, int32_t sign)
+{
+	uint8_t i;
+	
+	for(i=0;i<8;i++)
+		z[i] = dsp_ssat16(x[i] + sign*y[i]);
+}
+#endif
+
+/*
+ * one radix-4 butterfly on 4 legs - x0..x3 at a, c, b, d in, X0..X3 out
+ * to a..d, w/ the lane max & min of the outputs kept in mm
+ */
+static inline void IRAM_ATTR fft_pie_bfly(int16_t *a, int16_t *b, int16_t *c, int16_t *d,
+	const int16_t *tw, int16_t *mm, int32_t sh)
+{
+#ifdef __XTENSA__
+	int32_t sar;
+	
+	/* SAR isn't a register gcc knows about, so put it back */
+	asm volatile(
+		"rsr.sar %[sar]\n\t"
+		"wsr.sar %[sh]\n\t"
+		"ee.vld.128.ip q0, %[a], 0\n\t"			/* x0 >> sh */
+		"ee.vld.128.ip q7, %[tw], 16\n\t"
+		"ee.vmul.s16 q0, q0, q7\n\t"
+		"wsr.sar %[sh15]\n\t"
+		"ee.vld.128.ip q1, %[b], 0\n\t"			/* t2 = x2 * conj(w2) */
+		"ee.vld.128.ip q7, %[tw], 16\n\t"
+		"ee.cmul.s16 q2, q1, q7, 2\n\t"
+		"ee.cmul.s16 q2, q1, q7, 3\n\t"
+		"ee.vadds.s16 q3, q0, q2\n\t"			/* s0 */
+		"ee.vsubs.s16 q4, q0, q2\n\t"			/* d0 */
+		"ee.vld.128.ip q1, %[c], 0\n\t"			/* t1 & j*t1 */
+		"ee.vld.128.ip q7, %[tw], 16\n\t"
+		"ee.cmul.s16 q5, q1, q7, 2\n\t"
+		"ee.cmul.s16 q5, q1, q7, 3\n\t"
+		"ee.vld.128.ip q7, %[tw], 16\n\t"
+		"ee.cmul.s16 q6, q1, q7, 2\n\t"
+		"ee.cmul.s16 q6, q1, q7, 3\n\t"
+		"ee.vld.128.ip q1, %[d], 0\n\t"			/* s1 = t1 + t3 */
+		"ee.vld.128.ip q7, %[tw], 16\n\t"
+		"ee.cmul.s16 q0, q1, q7, 2\n\t"
+		"ee.cmul.s16 q0, q1, q7, 3\n\t"
+		"ee.vadds.s16 q5, q5, q0\n\t"
+		"ee.vld.128.ip q7, %[tw], 0\n\t"			/* j*d1 = j*t1 - j*t3 */
+		"ee.cmul.s16 q0, q1, q7, 2\n\t"
+		"ee.cmul.s16 q0, q1, q7, 3\n\t"
+		"ee.vsubs.s16 q6, q6, q0\n\t"
+		"ee.vadds.s16 q0, q3, q5\n\t"			/* X0 = s0 + s1 */
+		"ee.vsubs.s16 q1, q3, q5\n\t"			/* X2 = s0 - s1 */
+		"ee.vsubs.s16 q2, q4, q6\n\t"			/* X1 = d0 - j*d1 */
+		"ee.vadds.s16 q3, q4, q6\n\t"			/* X3 = d0 + j*d1 */
+		"ee.vst.128.ip q0, %[a], 0\n\t"
+		"ee.vst.128.ip q2, %[b], 0\n\t"
+		"ee.vst.128.ip q1, %[c], 0\n\t"
+		"ee.vst.128.ip q3, %[d], 0\n\t"
+		"ee.vld.128.ip q4, %[mm], 16\n\t"			/* lane peaks */
+		"ee.vld.128.ip q5, %[mm], -16\n\t"
+		"ee.vmax.s16 q4, q4, q0\n\t"
+		"ee.vmax.s16 q4, q4, q1\n\t"
+		"ee.vmax.s16 q4, q4, q2\n\t"
+		"ee.vmax.s16 q4, q4, q3\n\t"
+		"ee.vmin.s16 q5, q5, q0\n\t"
+		"ee.vmin.s16 q5, q5, q1\n\t"
+		"ee.vmin.s16 q5, q5, q2\n\t"
+		"ee.vmin.s16 q5, q5, q3\n\t"
+		"ee.vst.128.ip q4, %[mm], 16\n\t"
+		"ee.vst.128.ip q5, %[mm], -16\n\t"
+		"wsr.sar %[sar]\n\t"
+		: [sar] "=&r" (sar), [tw] "+r" (tw), [mm] "+r" (mm), [a] "+r" (a), [b] "+r" (b), [c] "+r" (c), [d] "+r" (d)
+		: [sh] "r" (sh), [sh15] "r" (sh+15)
+		: "memory");
+#else
+	int16_t x0[8], t1[8], jt1[8], t2[8], t3[8], s0[8], d0[8], s1[8], jd1[8];
+	uint8_t i;
+	
+	for(i=0;i<8;i++)
+		x0[i] = a[i] >> sh;
+	fft_emu_cmul(t2, b, &tw[8*FFT_TW_W2], sh+15);
+	fft_emu_adds(s0, x0, t2, 1);
+	fft_emu_adds(d0, x0, t2, -1);
+	fft_emu_cmul(t1, c, &tw[8*FFT_TW_W1], sh+15);
+	fft_emu_cmul(jt1, c, &tw[8*FFT_TW_W1J], sh+15);
+	fft_emu_cmul(t3, d, &tw[8*FFT_TW_W3], sh+15);
+	fft_emu_adds(s1, t1, t3, 1);
+	fft_emu_cmul(t3, d, &tw[8*FFT_TW_W3J], sh+15);
+	fft_emu_adds(jd1, jt1, t3, -1);
+	fft_emu_adds(a, s0, s1, 1);
+	fft_emu_adds(c, s0, s1, -1);
+	fft_emu_adds(b, d0, jd1, -1);
+	fft_emu_adds(d, d0, jd1, 1);
+	for(i=0;i<8;i++)
+	{
+		mm[i] = a[i] > mm[i] ? a[i] : mm[i];
+		mm[i] = b[i] > mm[i] ? b[i] : mm[i];
+		mm[i] = c[i] > mm[i] ? c[i] : mm[i];
+		mm[i] = d[i] > mm[i] ? d[i] : mm[i];
+		mm[8+i] = a[i] < mm[8+i] ? a[i] : mm[8+i];
+		mm[8+i] = b[i] < mm[8+i] ? b[i] : mm[8+i];
+		mm[8+i] = c[i] < mm[8+i] ? c[i] : mm[8+i];
+		mm[8+i] = d[i] < mm[8+i] ? d[i] : mm[8+i];
+	}
+#endif
+}
+
+/*
+ * radix-4 stage w/ L legs, L a multiple of 4, on the vector unit - returns
+ * the peak of its output
+ */
+static int32_t IRAM_ATTR fft_pie_stage(int16_t *buf, uint32_t n, uint32_t L, int32_t sh)
+{
+	int16_t tw[8*FFT_TW_NUM] DSP_VEC;
+	int16_t mm[16] DSP_VEC;
+	int32_t c, s, max = 0;
+	uint32_t k, j, q, tstride = FFT_MAX_N / (4*L);
+	
+	for(q=0;q<8;q++)
+	{
+		tw[8*FFT_TW_ONES+q] = 1;
+		mm[q] = mm[8+q] = 0;
+	}
+	
+	for(k=0;k<L;k+=4)
+	{
+		/* twiddles for these 4 legs, -j*w = s - jc */
+		for(q=0;q<4;q++)
+		{
+			fft_twiddle((k+q)*tstride, &c, &s);
+			tw[8*FFT_TW_W1+2*q] = c;
+			tw[8*FFT_TW_W1+2*q+1] = s;
+			tw[8*FFT_TW_W1J+2*q] = s;
+			tw[8*FFT_TW_W1J+2*q+1] = -c;
+			fft_twiddle(2*(k+q)*tstride, &c, &s);
+			tw[8*FFT_TW_W2+2*q] = c;
+			tw[8*FFT_TW_W2+2*q+1] = s;
+			fft_twiddle(3*(k+q)*tstride, &c, &s);
+			tw[8*FFT_TW_W3+2*q] = c;
+			tw[8*FFT_TW_W3+2*q+1] = s;
+			tw[8*FFT_TW_W3J+2*q] = s;
+			tw[8*FFT_TW_W3J+2*q+1] = -c;
+		}
+		
+		/* same residue order as the C stage */
+		for(j=k;j<n;j+=4*L)
+			fft_pie_bfly(&buf[2*j], &buf[2*(j+L)], &buf[2*(j+2*L)], &buf[2*(j+3*L)],
+				tw, mm, sh);
+	}
+	
+	/* lane peaks down to one */
+	for(q=0;q<8;q++)
+	{
+		max = mm[q] > max ? mm[q] : max;
+		max = -mm[8+q] > max ? -mm[8+q] : max;
+	}
+	
+	return max;
+}
+#endif
+
+/*
+ * forward complex FFT core - returns exponent, peak of output in *peak
+ */
+static int8_t IRAM_ATTR fft_core(int16_t *buf, uint16_t n, int32_t *peak)
+{
+#ifdef FFT_PIE
+	uint8_t pie = DSP_IS_ALIGNED(buf, DSP_VEC_ALIGN);
+#ifdef ESP_PLATFORM
+	/* vector registers aren't saved for ISRs */
+	pie = pie && !xPortInIsrContext();
+#endif
+#ifdef BENCHMARK
+	pie = pie && fft_pie;
+#endif
+#endif
+	int32_t max, sh, exp = 0;
+	uint32_t L, k, j, i0, i1, i2, i3, tstride;
+	int32_t w1r, w1i, w2r, w2i, w3r, w3i;
+	int32_t x0r, x0i, x1r, x1i, x2r, x2i, x3r, x3i;
+	int32_t t1r, t1i, t2r, t2i, t3r, t3i;
+	int32_t s0r, s0i, d0r, d0i, s1r, s1i, d1r, d1i;
+	
+	/* reorder input */
+	fft_bitrev(buf, n);
+	max = fft_peak(buf, 2*n);
+	
+	/* one radix-2 stage if odd power of 2 */
+	L = 1;
+	if(__builtin_ctz(n) & 1)
+	{
+		sh = max > FFT_R2_MAX ? (max > 2*FFT_R2_MAX ? 2 : 1) : 0;
+		exp += sh;
+		max = 0;
+		for(j=0;j<n;j+=2)
+		{
+			x0r = buf[2*j]>>sh;
+			x0i = buf[2*j+1]>>sh;
+			x1r = buf[2*j+2]>>sh;
+			x1i = buf[2*j+3]>>sh;
+			buf[2*j] = s0r = x0r + x1r;
+			buf[2*j+1] = s0i = x0i + x1i;
+			buf[2*j+2] = d0r = x0r - x1r;
+			buf[2*j+3] = d0i = x0i - x1i;
+			s0r = s0r < 0 ? -s0r : s0r;
+			s0i = s0i < 0 ? -s0i : s0i;
+			d0r = d0r < 0 ? -d0r : d0r;
+			d0i = d0i < 0 ? -d0i : d0i;
+			max = s0r > max ? s0r : max;
+			max = s0i > max ? s0i : max;
+			max = d0r > max ? d0r : max;
+			max = d0i > max ? d0i : max;
+		}
+		L = 2;
+	}
+	
+	/* radix-4 stages - sub-DFTs in bit-reversed order are residues 0,2,1,3 */
+	for(;L<n;L<<=2)
+	{
+		/* scale input just enough to avoid overflow */
+		sh = 0;
+		while((max>>sh) > FFT_R4_MAX)
+			sh++;
+		exp += sh;
+		max = 0;
+		tstride = FFT_MAX_N / (4*L);
+		
+#ifdef FFT_PIE
+		/* 4 legs at a time */
+		if(pie && (L >= 4))
+		{
+			max = fft_pie_stage(buf, n, L, sh);
+			continue;
+		}
+#endif
+		
+		for(k=0;k<L;k++)
+		{
+			/* twiddles for this leg */
+			fft_twiddle(k*tstride, &w1r, &w1i);
+			fft_twiddle(2*k*tstride, &w2r, &w2i);
+			fft_twiddle(3*k*tstride, &w3r, &w3i);
+			
+			for(j=k;j<n;j+=4*L)
+			{
+				i0 = 2*j;
+				i2 = 2*(j+L);
+				i1 = 2*(j+2*L);
+				i3 = 2*(j+3*L);
+				
+				x0r = buf[i0]>>sh;
+				x0i = buf[i0+1]>>sh;
+				x1r = buf[i1]>>sh;
+				x1i = buf[i1+1]>>sh;
+				x2r = buf[i2]>>sh;
+				x2i = buf[i2+1]>>sh;
+				x3r = buf[i3]>>sh;
+				x3i = buf[i3+1]>>sh;
+				
+				/* twiddle mults x * (c - js) */
+				t1r = dsp_rshift_rnd(x1r*w1r + x1i*w1i, 15);
+				t1i = dsp_rshift_rnd(x1i*w1r - x1r*w1i, 15);
+				t2r = dsp_rshift_rnd(x2r*w2r + x2i*w2i, 15);
+				t2i = dsp_rshift_rnd(x2i*w2r - x2r*w2i, 15);
+				t3r = dsp_rshift_rnd(x3r*w3r + x3i*w3i, 15);
+				t3i = dsp_rshift_rnd(x3i*w3r - x3r*w3i, 15);
+				
+				/* butterfly */
+				s0r = x0r + t2r;
+				s0i = x0i + t2i;
+				d0r = x0r - t2r;
+				d0i = x0i - t2i;
+				s1r = t1r + t3r;
+				s1i = t1i + t3i;
+				d1r = t1r - t3r;
+				d1i = t1i - t3i;
+				
+				x0r = s0r + s1r;
+				x0i = s0i + s1i;
+				x1r = d0r + d1i;
+				x1i = d0i - d1r;
+				x2r = s0r - s1r;
+				x2i = s0i - s1i;
+				x3r = d0r - d1i;
+				x3i = d0i + d1r;
+				
+				buf[i0] = x0r;
+				buf[i0+1] = x0i;
+				buf[i2] = x1r;
+				buf[i2+1] = x1i;
+				buf[i1] = x2r;
+				buf[i1+1] = x2i;
+				buf[i3] = x3r;
+				buf[i3+1] = x3i;
+				
+				/* track output peak for next stage */
+				x0r = x0r < 0 ? -x0r : x0r;
+				x0i = x0i < 0 ? -x0i : x0i;
+				x1r = x1r < 0 ? -x1r : x1r;
+				x1i = x1i < 0 ? -x1i : x1i;
+				x2r = x2r < 0 ? -x2r : x2r;
+				x2i = x2i < 0 ? -x2i : x2i;
+				x3r = x3r < 0 ? -x3r : x3r;
+				x3i = x3i < 0 ? -x3i : x3i;
+				max = x0r > max ? x0r : max;
+				max = x0i > max ? x0i : max;
+				max = x1r > max ? x1r : max;
+				max = x1i > max ? x1i : max;
+				max = x2r > max ? x2r : max;
+				max = x2i > max ? x2i : max;
+				max = x3r > max ? x3r : max;
+				max = x3i > max ? x3i : max;
+			}
+		}
+	}
+	
+	*peak = max;
+	return exp;
+}
+
+/*
+ * complex FFT - n complex points in buf, 2*n int16
+ * result is buf * 2^exp. inverse is unnormalized.
+ */
+esp_err_t IRAM_ATTR fft_cplx(int16_t *buf, uint16_t n, uint8_t inverse, int8_t *exp)
+{
+	int32_t peak;
+	
+	/* only powers of 2 in range */
+	if((n < FFT_MIN_N) || (n > FFT_MAX_N) || (n & (n-1)) || !fft_valid)
+		return ESP_ERR_INVALID_ARG;
+	
+	if(inverse)
+		fft_conj(buf, n);
+	*exp = fft_core(buf, n, &peak);
+	if(inverse)
+		fft_conj(buf, n);
+	
+	return ESP_OK;
+}
+
+/*
+ * real FFT - n real points in buf. Output is n/2+1 complex bins packed
+ * into the same n int16 w/ the purely real DC & Nyquist bins sharing
+ * bin 0: buf[0] = DC, buf[1] = Nyquist. Result is buf * 2^exp.
+ */
+esp_err_t IRAM_ATTR fft_real(int16_t *buf, uint16_t n, int8_t *exp)
+{
+	uint32_t m, k, k2, tstride;
+	int32_t peak, sh, wr, wi;
+	int32_t zr, zi, z2r, z2i, ar, ai, br, bi, tr, ti;
+	
+	/* only powers of 2 in range */
+	if((n < FFT_MIN_N) || (n > FFT_MAX_N) || (n & (n-1)) || !fft_valid)
+		return ESP_ERR_INVALID_ARG;
+	
+	/* even/odd samples as n/2 complex */
+	m = n/2;
+	*exp = fft_core(buf, m, &peak);
+	
+	/* split - sums below are 2X so shift by 1 more than needed for X */
+	sh = 1;
+	while((peak>>(sh-1)) > FFT_RS_MAX)
+		sh++;
+	*exp += sh-1;
+	tstride = FFT_MAX_N / n;
+	
+	/* DC & Nyquist */
+	zr = buf[0];
+	zi = buf[1];
+	buf[0] = (zr + zi)>>(sh-1);
+	buf[1] = (zr - zi)>>(sh-1);
+	
+	for(k=1;k<=m/2;k++)
+	{
+		k2 = m - k;
+		zr = buf[2*k];
+		zi = buf[2*k+1];
+		z2r = buf[2*k2];
+		z2i = buf[2*k2+1];
+		
+		/* 2A = Z[k] + conj(Z[m-k]), 2B = Z[k] - conj(Z[m-k]) */
+		ar = zr + z2r;
+		ai = zi - z2i;
+		br = zr - z2r;
+		bi = zi + z2i;
+		
+		/* 2T = W^k * 2B */
+		fft_twiddle(k*tstride, &wr, &wi);
+		tr = dsp_rshift_rnd(br*wr + bi*wi, 15);
+		ti = dsp_rshift_rnd(bi*wr - br*wi, 15);
+		
+		/* X[k] = A - jT, X[m-k] = conj(A) - j*conj(T) */
+		buf[2*k] = (ar + ti)>>sh;
+		buf[2*k+1] = (ai - tr)>>sh;
+		buf[2*k2] = (ar - ti)>>sh;
+		buf[2*k2+1] = (-ai - tr)>>sh;
+	}
+	
+	return ESP_OK;
+}
@@ -0,0 +1,31 @@
+/*
+ * fft.h - fixed-point complex & real FFT, radix-4 w/ block floating point
+ * 10-18-26
+ */
+
+#ifndef __fft__
+#define __fft__
+
+#ifdef ESP_PLATFORM
+#include "main.h"
+#else
+/* host build as a reference - just what fft.c needs from IDF */
+#include <stdint.h>
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_ERR_INVALID_ARG 0x102
+#define IRAM_ATTR
+#endif
+
+#define FFT_MIN_N	64
+#define FFT_MAX_N	4096
+
+#ifdef BENCHMARK
+extern uint8_t fft_pie;
+#endif
+
+void fft_init(void);
+esp_err_t fft_cplx(int16_t *buf, uint16_t n, uint8_t inverse, int8_t *exp);
+esp_err_t fft_real(int16_t *buf, uint16_t n, int8_t *exp);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * fork.c - split audio blocks across both cores
+ * 10-18-26
+ *
+ * The audio ISR on core 1 hands one job per block to a worker task on
+ * core 0 with fork_run(), does its own share of the block, then waits at
+ * fork_join() until the job is done. The worker is woken by task
+ * notification and the join is a spin on a shared state word.
+ *
+ * If the worker hasn't started the job by the time the audio core gets to
+ * the join (core 0 stalled by a flash write, or just slow to wake), the
+ * audio core claims the job and runs it itself. A block never waits on a
+ * core that can't run, and a job that's too small to be worth forking
+ * costs about the same as running it inline.
+ *
+ * Once a job has started on core 0 the join only spins until
+ * FORK_JOIN_DEADLINE after it was posted. Past that it gives up, counts an
+ * overrun & tells the caller, which must not use the job's output - the
+ * worker is still running it. Until the worker finishes, later forks
+ * aren't posted and their joins fail straight away.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_cpu.h"
+#include "esp_attr.h"
+#include "sdkconfig.h"
+#include "fork.h"
+#include "place.h"
+
+/* longest wait for the worker in fork_ping() */
+#define FORK_PING_TIMEOUT (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1333)
+
+/* latest a job can finish after it's posted - 3/4 of a block, leaving the
+ * rest for the audio core to finish up */
+#define FORK_JOIN_DEADLINE (CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ * 1000)
+
+/* job states */
+enum fork_states
+{
+	FORK_IDLE,
+	FORK_POSTED,
+	FORK_RUNNING,
+	FORK_DONE,
+};
+
+static const char *TAG = "fork";
+
+static TaskHandle_t fork_task_hdl;
+static fork_fn fork_job_fn;
+static void *fork_job_arg;
+static volatile uint32_t fork_state;
+static volatile uint32_t fork_job_cyc;		/* run time on core 0 */
+static uint32_t fork_post_cyc;				/* audio core time of post */
+static uint8_t fork_busy;					/* worker still on a late job */
+static fork_stats fork_st;
+
+/*
+ * try to take a posted job
+ */
+static inline __attribute__((always_inline)) uint8_t fork_claim(void)
+{
+	uint32_t expect = FORK_POSTED;
+	
+	return __atomic_compare_exchange_n(&fork_state, &expect, FORK_RUNNING,
+		0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*
+ * worker - runs jobs on core 0
+ */
+static void fork_task(void *pvParameter)
+{
+	uint32_t t;
+	
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		
+		/* may have been taken back already */
+		if(!fork_claim())
+			continue;
+		
+		t = esp_cpu_get_cycle_count();
+		fork_job_fn(fork_job_arg);
+		fork_job_cyc = esp_cpu_get_cycle_count() - t;
+		__atomic_store_n(&fork_state, FORK_DONE, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * start the worker
+ */
+esp_err_t fork_init(void)
+{
+	if(fork_task_hdl)
+		return ESP_OK;
+	
+	fork_st.wake_min = UINT32_MAX;
+	
+	/* above everything else on core 0 */
+	if(place_task_create(PL_FORK, fork_task, NULL, &fork_task_hdl) != pdPASS)
+		return ESP_FAIL;
+	
+	ESP_LOGI(TAG, "Fork worker running on core %d", place_get(PL_FORK)->core);
+	return ESP_OK;
+}
+
+/*
+ * hand a job to core 0 - from the audio ISR, or a task on core 1
+ */
+void IRAM_ATTR fork_run(fork_fn fn, void *arg)
+{
+	BaseType_t hpw = pdFALSE;
+	
+	/* last job ran past its deadline & is still going - leave it be */
+	fork_busy = __atomic_load_n(&fork_state, __ATOMIC_ACQUIRE) == FORK_RUNNING;
+	if(fork_busy)
+		return;
+	
+	fork_job_fn = fn;
+	fork_job_arg = arg;
+	fork_st.forks++;
+	fork_post_cyc = esp_cpu_get_cycle_count();
+	__atomic_store_n(&fork_state, FORK_POSTED, __ATOMIC_RELEASE);
+	
+	/* no worker - it'll be run at the join */
+	if(!fork_task_hdl)
+		return;
+	
+	if(xPortInIsrContext())
+		vTaskNotifyGiveFromISR(fork_task_hdl, &hpw);
+	else
+		xTaskNotifyGive(fork_task_hdl);
+}
+
+/*
+ * wait for the job, or run it here if core 0 hasn't picked it up. Returns
+ * ESP_ERR_TIMEOUT if it wasn't done by the deadline or never got posted.
+ */
+esp_err_t IRAM_ATTR fork_join(void)
+{
+	uint32_t t, wake;
+	uint8_t spun = 0;
+	
+	/* worker tied up by an earlier job */
+	if(fork_busy)
+	{
+		fork_st.overruns++;
+		return ESP_ERR_TIMEOUT;
+	}
+	
+	/* not started - do it ourselves */
+	if(fork_claim())
+	{
+		fork_job_fn(fork_job_arg);
+		fork_st.stolen++;
+		__atomic_store_n(&fork_state, FORK_IDLE, __ATOMIC_RELEASE);
+		return ESP_OK;
+	}
+	
+	/* barrier, up to the deadline */
+	t = esp_cpu_get_cycle_count();
+	while(__atomic_load_n(&fork_state, __ATOMIC_ACQUIRE) != FORK_DONE)
+	{
+		spun = 1;
+		if(esp_cpu_get_cycle_count() - fork_post_cyc > FORK_JOIN_DEADLINE)
+		{
+			/* worker sets FORK_DONE when it gets there */
+			fork_st.overruns++;
+			return ESP_ERR_TIMEOUT;
+		}
+	}
+	
+	/* handoff cost is whatever the job itself doesn't account for */
+	if(spun)
+	{
+		/* only meaningful if core 0 was the critical path */
+		wake = esp_cpu_get_cycle_count();
+		t = wake - t;
+		fork_st.wait_max = t > fork_st.wait_max ? t : fork_st.wait_max;
+		wake = wake - fork_post_cyc - fork_job_cyc;
+		fork_st.wake_last = wake;
+		fork_st.wake_min = wake < fork_st.wake_min ? wake : fork_st.wake_min;
+		fork_st.wake_max = wake > fork_st.wake_max ? wake : fork_st.wake_max;
+	}
+	
+	__atomic_store_n(&fork_state, FORK_IDLE, __ATOMIC_RELEASE);
+	return ESP_OK;
+}
+
+/*
+ * wait for a late job to finish - from a task, before anything it uses
+ * goes away
+ */
+void fork_wait(void)
+{
+	while(__atomic_load_n(&fork_state, __ATOMIC_ACQUIRE) == FORK_RUNNING)
+		vTaskDelay(1);
+}
+
+static void IRAM_ATTR fork_nop(void *arg)
+{
+}
+
+/*
+ * time an empty job through the worker and back - 0 if it never ran
+ */
+uint32_t IRAM_ATTR fork_ping(void)
+{
+	uint32_t t;
+	
+	t = esp_cpu_get_cycle_count();
+	fork_run(fork_nop, NULL);
+	if(fork_busy)
+		return 0;
+	while(__atomic_load_n(&fork_state, __ATOMIC_ACQUIRE) != FORK_DONE)
+	{
+		/* give up after a block */
+		if(esp_cpu_get_cycle_count() - t > FORK_PING_TIMEOUT)
+		{
+			fork_join();
+			return 0;
+		}
+	}
+	t = esp_cpu_get_cycle_count() - t;
+	__atomic_store_n(&fork_state, FORK_IDLE, __ATOMIC_RELEASE);
+	
+	return t;
+}
+
+/*
+ * get the handoff timing
+ */
+const fork_stats *fork_get_stats(void)
+{
+	return &fork_st;
+}
+
+/*
+ * dump handoff timing to the console
+ */
+void fork_log(void)
+{
+	ESP_LOGI(TAG, "%"PRIu32" forks, %"PRIu32" run locally, %"PRIu32" overruns",
+		fork_st.forks, fork_st.stolen, fork_st.overruns);
+	if(fork_st.wake_min != UINT32_MAX)
+		ESP_LOGI(TAG, "wake cyc: last %"PRIu32" min %"PRIu32" max %"PRIu32", join wait max %"PRIu32,
+			fork_st.wake_last, fork_st.wake_min, fork_st.wake_max, fork_st.wait_max);
+}
@@ -0,0 +1,40 @@
+/*
+ * fork.h - split audio blocks across both cores
+ * 10-18-26
+ */
+
+#ifndef __fork__
+#define __fork__
+
+#include "main.h"
+
+/*
+ * a piece of block processing that can run on either core - it may be run
+ * in the audio ISR, so must be IRAM_ATTR. Name effect ones fx_*_Fork so
+ * tools/check_iram.py checks them.
+ */
+typedef void (*fork_fn)(void *arg);
+
+/*
+ * handoff timing, in audio core cycles
+ */
+typedef struct
+{
+	uint32_t forks;			/* jobs posted */
+	uint32_t stolen;		/* jobs the audio core ran itself */
+	uint32_t wake_last;		/* post to join beyond the job's own run time */
+	uint32_t wake_min;
+	uint32_t wake_max;
+	uint32_t wait_max;		/* longest spin at the join */
+	uint32_t overruns;		/* joins that gave up at the deadline */
+} fork_stats;
+
+esp_err_t fork_init(void);
+void fork_run(fork_fn fn, void *arg);
+esp_err_t fork_join(void);
+void fork_wait(void);
+uint32_t fork_ping(void);
+const fork_stats *fork_get_stats(void);
+void fork_log(void);
+
+#endif
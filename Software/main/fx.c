@@ -9,13 +9,36 @@
 #include "fx_vca.h"
 #include "fx_cdl.h"
 #include "fx_filters.h"
+#include "bufclr.h"
+#include "jobpool.h"
+#include "cvmod.h"
+#include "cvcond.h"
+#include "memplan.h"
+#ifdef MULTICORE
+#include "multicore_audio.h"
+#include "fork.h"
+#endif
 
 static const char* TAG = "fx";
 
+/* pattern for measuring how much of fx_mem an effect uses */
+#define FX_MEM_FILL 0xA5A5A5A5
+
 /* external memory buffer */
 int16_t *fx_ext_buffer;
 size_t fx_ext_sz;
 
+/* flash writes in progress & waiting to start */
+static uint32_t fx_flash_ops;
+static uint32_t fx_flash_req;
+
+/* PSRAM fade around flash writes - blocks, & longest wait for it in ms */
+#define FX_EXT_FADE 8
+#define FX_EXT_WAIT 50
+
+/* fade position at the start & end of this block, FX_EXT_FADE = full */
+static uint8_t fx_ext_lvl[2] = {FX_EXT_FADE, FX_EXT_FADE};
+
 /* 32kB pre-allocated internal memory for DSP */
 size_t fx_int_sz;
 uint32_t *fx_mem;
@@ -58,7 +81,7 @@ void fx_bypass_Cleanup(void *dummy)
 /*
  * Bypass audio process is just in-out loopback / bypass
  */
-void fx_bypass_Proc(void *dummy, int16_t *dst, int16_t *src, uint16_t sz)
+void IRAM_ATTR fx_bypass_Proc(void *dummy, int16_t *dst, int16_t *src, uint16_t sz)
 {
 	while(sz--)
 	{
@@ -106,32 +129,53 @@ const fx_struct *effects[FX_NUM_ALGOS] = {
 	&fx_lpf_struct,
 	&fx_hpf_struct,
 	&fx_bpf_struct,
+	&fx_notch_struct,
+	&fx_lp12_struct,
+	&fx_ldr_struct,
+	&fx_cdf_struct,
 };
 
+/*
+ * fill the effect arena w/ a known pattern
+ */
+static void fx_mem_mark(void)
+{
+	uint32_t i;
+	
+	if(!fx_mem)
+		return;
+	
+	for(i=0;i<FX_MAX_MEM/sizeof(uint32_t);i++)
+		fx_mem[i] = FX_MEM_FILL;
+}
+
 /*
  * initialize the effects library
  */
 void fx_init(void)
 {
-	/* allocate ~2MB external buffer memory */
-	fx_int_sz = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
-	ESP_LOGI(TAG, "%d bytes internal available for audio", fx_int_sz);
-	fx_mem = heap_caps_malloc(FX_MAX_MEM, MALLOC_CAP_INTERNAL);
+	/* internal memory for DSP, reserved at boot */
+	fx_mem = memplan_get(MP_FX_MEM, &fx_int_sz);
 	if(fx_mem)
-		ESP_LOGI(TAG, "%d bytes internal reserved for audio", FX_MAX_MEM);
+		ESP_LOGI(TAG, "%d bytes internal reserved for audio", fx_int_sz);
 	else
-		ESP_LOGW(TAG, "Failed getting %d bytes internal for audio", FX_MAX_MEM);
+		ESP_LOGW(TAG, "No internal memory for audio");
 	
-	/* allocate ~2MB external buffer memory */
-	fx_ext_sz = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
-	ESP_LOGI(TAG, "%d bytes PSRAM available for audio", fx_ext_sz);
-	fx_ext_buffer = heap_caps_malloc(fx_ext_sz, MALLOC_CAP_SPIRAM);
+	/* ~2MB external buffer memory, reserved at boot */
+	fx_ext_buffer = memplan_get(MP_FX_EXT, &fx_ext_sz);
 	if(fx_ext_buffer)
 		ESP_LOGI(TAG, "%d bytes PSRAM available for audio buffers", fx_ext_sz);
 	else
-		ESP_LOGW(TAG, "Failed getting %d bytes PSRAM for audio buffers", fx_ext_sz);
+		ESP_LOGW(TAG, "No PSRAM for audio buffers");
+	
+	/* background clearing of delay buffers */
+	bufclr_init();
+	
+	/* background DSP jobs */
+	jobpool_init();
 
 	/* start off with bypass algo */
+	fx_mem_mark();
 	fx_algo = 0;
 	fx = effects[fx_algo]->init(fx_mem);
 }
@@ -151,14 +195,111 @@ void fx_select_algo(uint8_t algo)
 	prev_fx_algo = fx_algo;
 	fx_algo = 0;
 	
+	/* drop its background jobs */
+	jobpool_flush();
+	
+#ifdef MULTICORE
+	/* let a late pipeline stage or fork job finish w/ it */
+	fork_wait();
+#endif
+	
 	/* cleanup previous effect */
 	effects[prev_fx_algo]->cleanup(fx);
 	
-	/* init next effect from effect array */
+	/* init next effect from effect array - it asks for its own CV streams */
+	cvmod_reset();
+	cvcond_reset();
+	fx_mem_mark();
 	fx = effects[algo]->init(fx_mem);
+#ifdef MULTICORE
+	multicore_pipe_reset();
+#endif
 		
 	/* switch to next effect */
 	fx_algo = algo;
+	ESP_LOGI(TAG, "%s: %d frames latency", effects[algo]->name, fx_get_latency());
+}
+
+/*
+ * PSRAM is behind the cache so it's gone while flash is being written.
+ * The audio ISR keeps running then - effects that use fx_ext_buffer must
+ * check this once per block before touching it. It goes false a few
+ * blocks ahead of the write, once the effect has faded out, and comes
+ * back as the fade in starts after it.
+ */
+uint8_t IRAM_ATTR fx_ext_avail(void)
+{
+	return !__atomic_load_n(&fx_flash_ops, __ATOMIC_ACQUIRE) &&
+		(fx_ext_lvl[0] || fx_ext_lvl[1]);
+}
+
+/*
+ * ramp an effect's PSRAM output through this block's part of the fade.
+ * Nothing to do outside of one.
+ */
+void IRAM_ATTR fx_ext_fade(int16_t *buf, uint16_t sz)
+{
+	int32_t gain, step;
+	
+	if((fx_ext_lvl[0] == FX_EXT_FADE) && (fx_ext_lvl[1] == FX_EXT_FADE))
+		return;
+	
+	/* Q12, linear across the block */
+	gain = (fx_ext_lvl[0]<<12)/FX_EXT_FADE;
+	step = (((fx_ext_lvl[1]-fx_ext_lvl[0])*(1<<12))/FX_EXT_FADE)/sz;
+	while(sz--)
+	{
+		*buf = ((int32_t)*buf * gain)>>12;
+		buf++;
+		*buf = ((int32_t)*buf * gain)>>12;
+		buf++;
+		gain += step;
+	}
+}
+
+/*
+ * bracket anything that writes flash, from a task. Begin asks the audio
+ * side to fade PSRAM effects out & waits until a block starts w/o them,
+ * so the write never cuts one off mid-sound. If audio isn't running it
+ * gives up waiting - a block that's already running still finishes before
+ * the cache goes off, since the flash driver can't stop the audio core
+ * mid-ISR, and every block after this sees it. End lets them fade back in.
+ */
+void fx_flash_begin(void)
+{
+	TickType_t t = xTaskGetTickCount();
+	
+	__atomic_add_fetch(&fx_flash_req, 1, __ATOMIC_ACQ_REL);
+	while(__atomic_load_n(&fx_ext_lvl[0], __ATOMIC_ACQUIRE) ||
+		__atomic_load_n(&fx_ext_lvl[1], __ATOMIC_ACQUIRE))
+	{
+		if(xTaskGetTickCount() - t > pdMS_TO_TICKS(FX_EXT_WAIT))
+			break;
+		vTaskDelay(1);
+	}
+	__atomic_add_fetch(&fx_flash_ops, 1, __ATOMIC_ACQ_REL);
+}
+
+void fx_flash_end(void)
+{
+	__atomic_sub_fetch(&fx_flash_ops, 1, __ATOMIC_ACQ_REL);
+	__atomic_sub_fetch(&fx_flash_req, 1, __ATOMIC_ACQ_REL);
+}
+
+/*
+ * step the PSRAM fade once per block - down while a flash write is
+ * waiting or running, back up once it's done
+ */
+static inline __attribute__((always_inline)) void fx_ext_step(void)
+{
+	uint8_t lvl = fx_ext_lvl[1];
+	
+	if(__atomic_load_n(&fx_flash_req, __ATOMIC_ACQUIRE))
+		lvl = lvl ? lvl-1 : 0;
+	else if(!__atomic_load_n(&fx_flash_ops, __ATOMIC_ACQUIRE))
+		lvl = lvl < FX_EXT_FADE ? lvl+1 : FX_EXT_FADE;
+	__atomic_store_n(&fx_ext_lvl[0], fx_ext_lvl[1], __ATOMIC_RELEASE);
+	__atomic_store_n(&fx_ext_lvl[1], lvl, __ATOMIC_RELEASE);
 }
 
 /*
@@ -166,8 +307,48 @@ void fx_select_algo(uint8_t algo)
  */
 void IRAM_ATTR fx_proc(int16_t *dst, int16_t *src, uint16_t sz)
 {
+	const fx_struct *e = effects[fx_algo];
+	const cvgate_event *ev;
+	uint8_t i, n;
+	
+	/* PSRAM fade for this block */
+	fx_ext_step();
+	
+	/* edges on the gate inputs first so proc can act on them this block */
+	if(e->event)
+	{
+		ev = cvgate_events(&n);
+		for(i=0;i<n;i++)
+			e->event(fx, &ev[i]);
+	}
+	
 	/* use effect structure function pointers */
-	effects[fx_algo]->proc(fx, dst, src, sz);
+	if(!e->proc_b)
+		e->proc(fx, dst, src, sz);
+	else
+	{
+#ifdef MULTICORE
+		/* stages on separate cores */
+		multicore_pipe_proc(e, fx, dst, src, sz);
+#else
+		/* both stages here, in place */
+		e->proc(fx, dst, src, sz);
+		e->proc_b(fx, dst, dst, sz);
+#endif
+	}
+}
+
+/*
+ * frames of delay added by the current effect's pipeline - the dry path
+ * needs the same
+ */
+uint16_t IRAM_ATTR fx_get_latency(void)
+{
+#ifdef MULTICORE
+	return effects[fx_algo]->proc_b ? FRAMESZ : 0;
+#else
+	return 0;
+#endif
 }
 
 /*
@@ -194,6 +375,31 @@ char * fx_get_algo_name(void)
 	return (char *)effects[fx_algo]->name;
 }
 
+/*
+ * get name of effect by number
+ */
+char * fx_get_algo_name_idx(uint8_t algo)
+{
+	return algo < FX_NUM_ALGOS ? (char *)effects[algo]->name : "";
+}
+
+/*
+ * high water mark of fx_mem usage by the current effect, in bytes
+ */
+size_t fx_get_mem_used(void)
+{
+	uint32_t i = FX_MAX_MEM/sizeof(uint32_t);
+	
+	if(!fx_mem)
+		return 0;
+	
+	/* find highest word that's been written */
+	while(i && (fx_mem[i-1] == FX_MEM_FILL))
+		i--;
+	
+	return i*sizeof(uint32_t);
+}
+
 /*
  * get name of param by index
  */
@@ -10,11 +10,12 @@
 #include "dsp_lib.h"
 #include "eb_adc.h"
 #include "gfx.h"
+#include "cvgate.h"
 
 #define SAMPLE_RATE     (48000)
 #define FRAMESZ			(64)
 
-#define FX_NUM_ALGOS  6
+#define FX_NUM_ALGOS  10
 #define FX_MAX_PARAMS 3
 #define FX_MAX_MEM (129*1024)
 
@@ -34,17 +35,30 @@ typedef struct
 	void (*cleanup)(void *blk);
 	void (*proc)(void *blk, int16_t *dst, int16_t *src, uint16_t sz);
 	void (*render_parm)(void *blk, uint8_t idx, GFX_RECT *rect);
+	/* optional 2nd stage - w/ MULTICORE it runs on core 0 one block behind,
+	 * and a block where it runs past the fork deadline is silent */
+	void (*proc_b)(void *blk, int16_t *dst, int16_t *src, uint16_t sz);
+	/* optional - gate & trigger edges, just before proc of the same block */
+	void (*event)(void *blk, const cvgate_event *ev);
 } fx_struct;
 
+void fx_bypass_Proc(void *dummy, int16_t *dst, int16_t *src, uint16_t sz);
 void fx_bypass_Cleanup(void *dummy);
 void fx_bypass_Render_Parm(void *blk, uint8_t idx, GFX_RECT *rect);
 
 void fx_init(void);
 void fx_select_algo(uint8_t algo);
+uint8_t fx_ext_avail(void);
+void fx_ext_fade(int16_t *buf, uint16_t sz);
+void fx_flash_begin(void);
+void fx_flash_end(void);
 void fx_proc(int16_t *dst, int16_t *src, uint16_t sz);
+uint16_t fx_get_latency(void);
 uint8_t fx_get_algo(void);
 uint8_t fx_get_num_parms(void);
 char * fx_get_algo_name(void);
+char * fx_get_algo_name_idx(uint8_t algo);
+size_t fx_get_mem_used(void);
 char * fx_get_parm_name(uint8_t idx);
 void fx_render_parm(uint8_t idx);
 
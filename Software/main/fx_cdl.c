@@ -3,24 +3,77 @@
  * 03-14-22 E. Brombaugh
  */
  
+#include <string.h>
 #include "fx_cdl.h"
+#include "bufclr.h"
+#include "dlyline.h"
+#include "fx_filters.h"
+#include "cvcond.h"
+#include "tempo.h"
 
 #define XFADE_BITS 11
 
+/* frames kept in SRAM - ~85ms */
+#define CD_NEAR_LEN 4096
+
+/* fixed resonance for the filtered delay, 12-bit */
+#define CDF_RES 1024
+
+/* delay time CV deadband - keeps noise from restarting the crossfade */
+#define CD_DLY_DEADBAND 16
+
+/* range CV steps & deadband at the step edges */
+#define CD_RANGES 3
+#define CD_RNG_DEADBAND 256
+
+/* delay CV steps w/ a tempo, & how far it can drift before retiming */
+#define CD_SYNC_DIVS 11
+#define CD_SYNC_DRIFT 9
+
+/* freeze - no input & unity feedback, Q12 */
+#define CD_FREEZE_FB 4096
+#define CD_FRZ_NONE 0xffff
+
+/* type flags */
+#define CD_TYPE_RT 4		/* range set by param 3 */
+#define CD_TYPE_CODEC 8		/* 8-bit compressed storage */
+
+/* SRAM staging of the taps - set in menuconfig, off until the bench shows
+ * it beats the per-sample path */
+#ifdef CONFIG_S3GTA_CD_STAGED
+#define CD_STAGED 1
+#else
+#define CD_STAGED 0
+#endif
+
+#ifdef BENCHMARK
+/* the bench flips this to time both paths */
+uint8_t fx_cd_staged = CD_STAGED;
+#else
+#define fx_cd_staged CD_STAGED
+#endif
+
 typedef struct 
 {
 	uint8_t type;			/* algo type */
 	uint8_t rng;			/* short/med/long range */
-	uint16_t rng_raw;		/* raw range from ADC param */
-	int16_t *dlybuf;		/* external delay buffer address */
-	uint32_t len;			/* buffer length */
-	uint8_t init;			/* initial pass flag for cleanout */
-	uint32_t wptr;			/* write pointer */
+	uint8_t rng_base;		/* shift for short range */
+	uint16_t rng_raw;		/* range step from ADC param */
+	dlyline dl;				/* tiered delay line */
+	uint32_t clr;			/* buffer clear ticket */
 	uint32_t roff1, roff2;	/* read offsets - main and xfade */
 	uint16_t xflen, xfcnt;	/* Cross-fade length and counter */
-	int16_t dly;			/* delay value w/ hysteresis */
+	int16_t dly;			/* delay value in use */
+	uint8_t sync;			/* delay set from the tempo */
+	uint8_t div;			/* beat division when synced */
+	uint8_t frz, frz_next;	/* frozen now & from frz_at on */
+	uint16_t frz_at;		/* sample in this block freeze changes */
 	int32_t dcb[2];			/* dc block on feedback */
 	int16_t fb[2];
+	int16_t rd1[2*DLYL_RD_FRAMES] DSP_VEC;	/* staged main tap */
+	int16_t rd2[2*DLYL_RD_FRAMES] DSP_VEC;	/* staged crossfade tap */
+	int16_t wr[2*FRAMESZ] DSP_VEC;			/* staged write block */
+	int16_t near[2*CD_NEAR_LEN] DSP_VEC;	/* recent delay history */
 } fx_cdl_blk;
 
 const char *cd_param_names[] =
@@ -30,6 +83,36 @@ const char *cd_param_names[] =
 	"Range ",
 };
 
+/*
+ * delay into lowpass - two stages so they can be pipelined
+ */
+typedef struct
+{
+	fx_cdl_blk cd;			/* delay - first so the delay procs can use it */
+	fx_filter_blk flt;		/* lowpass on the delay output */
+} fx_cdf_blk;
+
+const char *cdf_param_names[] =
+{
+	"DlyAmt",
+	"Feedbk",
+	"Cutoff",
+};
+
+/* synced delays in twelfths of a beat, straight, triplet & dotted */
+const uint8_t cd_sync_div[CD_SYNC_DIVS] =
+{
+	3, 4, 6, 8, 9, 12, 16, 18, 24, 36, 48,
+};
+
+const char *cd_sync_names[CD_SYNC_DIVS] =
+{
+	"1/16", "1/8T", "1/8", "1/4T", "1/8.", "1/4", "1/2T", "1/4.", "1/2", "1/2.", "1/1",
+};
+
+/* input while frozen */
+static const int16_t cd_silence[2*FRAMESZ];
+
 const char *cd_ranges[] =
 {
 	"Short",
@@ -44,22 +127,39 @@ void * fx_cd_common_Init(uint32_t *mem, uint8_t type)
 {
 	/* set up instance in mem area provided */
 	fx_cdl_blk *blk = (fx_cdl_blk *)mem;
+	cvcond_cfg cc;
+	
+	/* quiet delay time CV, and range CV in steps if it's used */
+	cc = *cvcond_get(1);
+	cc.deadband = CD_DLY_DEADBAND;
+	cvcond_set(1, &cc);
+	if(type & CD_TYPE_RT)
+	{
+		cc = *cvcond_get(3);
+		cc.deadband = CD_RNG_DEADBAND;
+		cc.steps = CD_RANGES;
+		cvcond_set(3, &cc);
+	}
 	
 	/* set type / range */
-	blk->type = type>>2;
-	blk->rng = 3+(type&0x3)*2;
+	blk->type = (type & CD_TYPE_RT) ? 1 : 0;
+	blk->rng_base = (type & CD_TYPE_CODEC) ? 4 : 3;
+	blk->rng = blk->rng_base+(type&0x3)*2;
 	blk->rng_raw = 0;
 	
 	/* init delay buffering */
-	blk->dlybuf = fx_ext_buffer;
-	blk->len = fx_ext_sz / (2*sizeof(int16_t));	// length in samples
-	blk->init = 1;
-	blk->wptr = 0;
+	dlyline_init(&blk->dl, blk->near, CD_NEAR_LEN, fx_ext_buffer, fx_ext_sz,
+		(type & CD_TYPE_CODEC) ? 1 : 0);
+	blk->clr = bufclr_request(fx_ext_buffer, fx_ext_sz);
 	blk->roff1 = 1;
 	blk->roff2 = 0;
 	blk->xfcnt = 0;
 	blk->xflen = 1<<XFADE_BITS;
 	blk->dly = 0;
+	blk->sync = 0;
+	blk->div = 0;
+	blk->frz = blk->frz_next = 0;
+	blk->frz_at = CD_FRZ_NONE;
 	blk->dcb[0] = blk->dcb[1] = 0;
 	blk->fb[0] = blk->fb[1] = 0;
 		
@@ -72,46 +172,86 @@ void * fx_cd_common_Init(uint32_t *mem, uint8_t type)
  */
 void * fx_cdr_Init(uint32_t *mem)
 {
-	return fx_cd_common_Init(mem, 4);
+	return fx_cd_common_Init(mem, CD_TYPE_RT);
 }
 
 /*
- * Clean Delay audio process
+ * Long Delay Range init - compressed storage
  */
-void IRAM_ATTR fx_cd_common_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+void * fx_ldr_Init(uint32_t *mem)
+{
+	return fx_cd_common_Init(mem, CD_TYPE_RT | CD_TYPE_CODEC);
+}
+
+/*
+ * Clean Delay block w/ taps read as spans - needs both read offsets >= sz
+ * so nothing is read that's written in the same block
+ */
+static void IRAM_ATTR fx_cd_staged_Proc(fx_cdl_blk *blk, int16_t *dst, int16_t *src, uint16_t sz, int16_t fb_lvl)
 {
-	fx_cdl_blk *blk = vblk;
 	uint16_t i;
-	int16_t fb_lvl;
-	int32_t rptr;
 	int32_t mix;
-	int16_t out;
+	int16_t out, *rd, *rd2 = NULL;
 	uint8_t chl;
 	
-	/* update delay parameters if not already crossfading */
-	if(!blk->xfcnt)
+	/* burst in the read spans */
+	rd = dlyline_read(&blk->dl, blk->rd1, blk->roff1, sz);
+	if(blk->xfcnt)
+		rd2 = dlyline_read(&blk->dl, blk->rd2, blk->roff2, sz);
+	
+	/* loop over the buffers */
+	for(i=0;i<2*sz;i+=2)
 	{
-		uint8_t rng_upd = 0;
-		
-		/* set range realtime if type == 1 */
-		if(blk->type)
+		for(chl=0;chl<2;chl++)
 		{
-			rng_upd = dsp_ratio_hyst_arb(&blk->rng_raw, adc_param[3], 2);
-			blk->rng = 3+2*blk->rng_raw;
-		}
+			/* mix feedback into write buffer */
+			mix = q12_mac(*(src++)<<12, blk->fb[chl], fb_lvl);
+			blk->wr[i+chl] = q12_sat16(mix);
 		
-		/* get raw delay value and apply hysteresis */
-		if(dsp_gethyst(&blk->dly, adc_param[1]) || rng_upd)
-		{
-			/* compute next delay and start crossfade */
-			blk->roff2 = (blk->dly<<blk->rng) + 1;
-			blk->roff2 = blk->roff2 > blk->len-2 ? blk->len-2 : blk->roff2;
-			blk->xfcnt = blk->xflen;
+			/* get main tap */
+			out = rd[i+chl];
+			
+			/* process crossfade */
+			if(blk->xfcnt)
+			{
+				/* do crossfade mix */
+				mix  = (int32_t)out * blk->xfcnt;
+				mix += rd2[i+chl] * (blk->xflen - blk->xfcnt);
+				out = dsp_ssat16(mix>>XFADE_BITS);
+		
+				/* update crossfade */
+				blk->xfcnt--;
+				if(blk->xfcnt == 0)
+				{
+					/* update current delay */
+					blk->roff1 = blk->roff2;
+					rd = rd2;
+				}
+			}
+	
+			/* dc block on feedback */
+			mix = (int32_t)out - (blk->dcb[chl]>>8); 
+			blk->dcb[chl] += mix;
+			blk->fb[chl] = dsp_ssat16(mix);
+			
+			/* output */
+			*dst++ = out;
 		}
 	}
 	
-	/* get the feedback value */
-	fb_lvl = adc_param[2];
+	/* burst out the write block */
+	dlyline_write(&blk->dl, blk->wr, sz);
+}
+
+/*
+ * Clean Delay per-sample - for delays shorter than a block
+ */
+static void IRAM_ATTR fx_cd_sample_Proc(fx_cdl_blk *blk, int16_t *dst, int16_t *src, uint16_t sz, int16_t fb_lvl)
+{
+	uint16_t i;
+	int32_t mix;
+	int16_t out, frm[2];
+	uint8_t chl;
 	
 	/* loop over the buffers */
 	for(i=0;i<sz;i++)
@@ -119,28 +259,18 @@ void IRAM_ATTR fx_cd_common_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_
 		for(chl=0;chl<2;chl++)
 		{
 			/* mix feedback into write buffer */
-			mix = (*(src++)<<12) + blk->fb[chl] * fb_lvl;
-			blk->dlybuf[2*blk->wptr+chl] = dsp_ssat16(mix>>12);
+			mix = q12_mac(*(src++)<<12, blk->fb[chl], fb_lvl);
+			frm[chl] = q12_sat16(mix);
 			
 			/* get main tap */
-			rptr = blk->wptr-blk->roff1;
-			rptr = rptr < 0 ? blk->len + rptr : rptr;
-			rptr = rptr >= blk->len ? rptr - blk->len : rptr;
-			if(!blk->init || (rptr < blk->wptr))
-				out = blk->dlybuf[2*rptr+chl];
-			else
-				out = 0;
+			out = dlyline_tap(&blk->dl, blk->roff1, chl);
 			
 			/* process crossfade */
 			if(blk->xfcnt)
 			{
 				/* do crossfade mix */
-				rptr = blk->wptr-blk->roff2;
-				rptr = rptr < 0 ? blk->len + rptr : rptr;
-				rptr = rptr >= blk->len ? rptr - blk->len : rptr;
 				mix  = (int32_t)out * blk->xfcnt;
-				if(!blk->init || (rptr < blk->wptr))
-					mix += blk->dlybuf[2*rptr+chl] * (blk->xflen - blk->xfcnt);
+				mix += dlyline_tap(&blk->dl, blk->roff2, chl) * (blk->xflen - blk->xfcnt);
 				out = dsp_ssat16(mix>>XFADE_BITS);
 				
 				/* update crossfade */
@@ -161,14 +291,133 @@ void IRAM_ATTR fx_cd_common_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_
 			*dst++ = out;
 		}
 	
-		/* update write pointer */
-		rptr = blk->wptr;
-		blk->wptr = (blk->wptr + 1) % blk->len;
+		/* add to delay line */
+		dlyline_put(&blk->dl, frm);
+	}
+}
+		
+/*
+ * Clean Delay part of a block - staged if no tap lands inside it. Frozen
+ * it loops what's in the line by taking no input at unity feedback.
+ */
+static void IRAM_ATTR fx_cd_span_Proc(fx_cdl_blk *blk, int16_t *dst, int16_t *src, uint16_t sz, int16_t fb_lvl)
+{
+	uint8_t staged;
+	
+	if(!sz)
+		return;
+	if(blk->frz)
+	{
+		src = (int16_t *)cd_silence;
+		fb_lvl = CD_FREEZE_FB;
+	}
+	
+	/* stage through SRAM unless a tap lands inside this block */
+	staged = fx_cd_staged && (blk->roff1 >= sz) && (!blk->xfcnt || (blk->roff2 >= sz));
+	if(staged)
+		fx_cd_staged_Proc(blk, dst, src, sz, fb_lvl);
+	else
+		fx_cd_sample_Proc(blk, dst, src, sz, fb_lvl);
+}
+
+/*
+ * Clean Delay audio process
+ */
+void IRAM_ATTR fx_cd_common_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+{
+	fx_cdl_blk *blk = vblk;
+	int16_t fb_lvl;
+	uint16_t n;
+	
+	/* silent until the buffer has been cleared or around a flash write,
+	 * w/ the line held where it was */
+	if(!bufclr_done(blk->clr) || !fx_ext_avail())
+	{
+		memset(dst, 0, 2*sz*sizeof(int16_t));
+		blk->frz = blk->frz_next;
+		blk->frz_at = CD_FRZ_NONE;
+		return;
+	}
+	
+	/* update delay parameters if not already crossfading */
+	if(!blk->xfcnt)
+	{
+		const tempo_info *t = tempo_get();
+		uint8_t rng_upd = 0;
+		uint16_t rng;
+		uint32_t roff, drift;
 		
-		/* clear init flag if write ptr wrapped */
-		if(rptr > blk->wptr)
-			blk->init = 0;
+		if(t->src != TEMPO_SRC_NONE)
+		{
+			/* with a tempo the delay CV picks a beat division */
+			rng = cvcond_level(adc_param[1], CD_SYNC_DIVS);
+			roff = (t->period * cd_sync_div[rng]) / (12<<8);
+			roff = roff > blk->dl.max ? blk->dl.max : (roff ? roff : 1);
+			
+			/* retime on a new division or once the clock has moved */
+			drift = roff > blk->roff1 ? roff - blk->roff1 : blk->roff1 - roff;
+			if(!blk->sync || (rng != blk->div) || (drift > (blk->roff1>>CD_SYNC_DRIFT)))
+			{
+				blk->roff2 = roff;
+				blk->xfcnt = blk->xflen;
+				blk->div = rng;
+				blk->sync = 1;
+			}
+		}
+		else
+		{
+			/* set range realtime if type == 1 */
+			if(blk->type)
+			{
+				rng = cvcond_level(adc_param[3], CD_RANGES);
+				rng_upd = rng != blk->rng_raw;
+				blk->rng_raw = rng;
+				blk->rng = blk->rng_base+2*blk->rng_raw;
+			}
+			
+			/* delay CV is deadbanded at the ADC - any change is real */
+			if((adc_param[1] != blk->dly) || rng_upd || blk->sync)
+			{
+				blk->dly = adc_param[1];
+				blk->sync = 0;
+				/* compute next delay and start crossfade */
+				blk->roff2 = (blk->dly<<blk->rng) + 1;
+				blk->roff2 = blk->roff2 > blk->dl.max ? blk->dl.max : blk->roff2;
+				blk->xfcnt = blk->xflen;
+			}
+		}
+	}
+	
+	/* get the feedback value */
+	fb_lvl = adc_param[2];
+	
+	/* split the block where a gate changes freeze */
+	n = blk->frz_at < sz ? blk->frz_at : sz;
+	fx_cd_span_Proc(blk, dst, src, n, fb_lvl);
+	if(blk->frz_at != CD_FRZ_NONE)
+	{
+		blk->frz = blk->frz_next;
+		blk->frz_at = CD_FRZ_NONE;
+		fx_cd_span_Proc(blk, dst+2*n, src+2*n, sz-n, fb_lvl);
 	}
+	
+	/* fading out for a flash write or back in after */
+	fx_ext_fade(dst, sz);
+}
+
+/*
+ * Clean Delay gate input - a gate holds freeze, a trigger toggles it.
+ * The last edge in a block wins.
+ */
+void IRAM_ATTR fx_cd_Event(void *vblk, const cvgate_event *ev)
+{
+	fx_cdl_blk *blk = vblk;
+	
+	if(ev->mode == CVGATE_TRIG)
+		blk->frz_next = !blk->frz_next;
+	else
+		blk->frz_next = ev->edge == CVGATE_RISE;
+	blk->frz_at = ev->offset;
 }
 
 /*
@@ -183,8 +432,15 @@ void fx_cdl_Render_Parm(void *vblk, uint8_t idx, GFX_RECT *rect)
 	switch(idx)
 	{
 		case 1:	// Delay
+			if(blk->sync)
+			{
+				/* division & what it comes to at this tempo */
+				ms = blk->roff2 / (SAMPLE_RATE/1000);
+				sprintf(txtbuf, "%-4s%5"PRIu32"ms ", cd_sync_names[blk->div], ms);
+				break;
+			}
 			ms = (blk->dly<<blk->rng) + 1;
-			ms = ms > blk->len-2 ? blk->len-2 : ms;
+			ms = ms > blk->dl.max ? blk->dl.max : ms;
 			ms = ms / (SAMPLE_RATE/1000);
 			sprintf(txtbuf, "%6"PRIu32" ms ", ms);
 			break;
@@ -216,5 +472,82 @@ fx_struct fx_cdr_struct =
 	fx_bypass_Cleanup,
 	fx_cd_common_Proc,
 	fx_cdl_Render_Parm,
+	NULL,
+	fx_cd_Event,
 };
 
+
+/*
+ * long delay range struct
+ */
+fx_struct fx_ldr_struct =
+{
+	"LngDly",
+	3,
+	cd_param_names,
+	fx_ldr_Init,
+	fx_bypass_Cleanup,
+	fx_cd_common_Proc,
+	fx_cdl_Render_Parm,
+	NULL,
+	fx_cd_Event,
+};
+
+/*
+ * Filtered Delay init - medium range delay then lowpass
+ */
+void * fx_cdf_Init(uint32_t *mem)
+{
+	fx_cdf_blk *blk = (fx_cdf_blk *)mem;
+	
+	fx_cd_common_Init(mem, 1);
+	fx_filters_Init((uint32_t *)&blk->flt);
+	
+	return (void *)blk;
+}
+
+/*
+ * Filtered Delay 2nd stage - lowpass w/ cutoff from param 3
+ */
+void IRAM_ATTR fx_cdf_Filter_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+{
+	fx_cdf_blk *blk = vblk;
+	
+	fx_lp_Apply(&blk->flt, dst, src, sz, adc_param[3], CDF_RES);
+}
+
+/*
+ * Render parameter for filtered delay
+ */
+void fx_cdf_Render_Parm(void *vblk, uint8_t idx, GFX_RECT *rect)
+{
+	fx_cdf_blk *blk = vblk;
+	char txtbuf[32];
+	float32_t cutoff;
+	
+	if(idx != 3)
+	{
+		fx_cdl_Render_Parm(&blk->cd, idx, rect);
+		return;
+	}
+	
+	cutoff = ((float32_t)SAMPLE_RATE / 2) * ((float32_t)blk->flt.fc/32768.0F) / 1000.0F;
+	sprintf(txtbuf, "%4.2f kHz ", cutoff);
+	gfx_drawstrrect(rect, txtbuf);
+}
+
+/*
+ * filtered delay struct
+ */
+fx_struct fx_cdf_struct =
+{
+	"DlyLPF",
+	3,
+	cdf_param_names,
+	fx_cdf_Init,
+	fx_bypass_Cleanup,
+	fx_cd_common_Proc,
+	fx_cdf_Render_Parm,
+	fx_cdf_Filter_Proc,
+	fx_cd_Event,
+};
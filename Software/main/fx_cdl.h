@@ -9,6 +9,11 @@
 #include "fx.h"
 
 extern fx_struct fx_cdr_struct;
+extern fx_struct fx_ldr_struct;
+extern fx_struct fx_cdf_struct;
+#ifdef BENCHMARK
+extern uint8_t fx_cd_staged;
+#endif
 
 #endif
 
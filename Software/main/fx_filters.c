@@ -3,15 +3,36 @@
  * 03-29-20 E. Brombaugh
  */
  
+#include <string.h>
 #include "fx_filters.h"
-#include "ifilter_mg4_v1.h"
+#include "cvmod.h"
+#include "fork.h"
+#include "jobpool.h"
 
-typedef struct 
+/* cutoff CV bandwidth, Hz */
+#define FX_FILTER_CV_BW 2000
+
+/* standalone filters split L & R across the cores */
+#ifdef MULTICORE
+#define FX_FILTER_SPLIT 1
+#else
+#define FX_FILTER_SPLIT 0
+#endif
+
+/* standalone filter - the cutoff stream & output have to outlast the ISR
+ * in case the L job on core 0 runs late */
+typedef struct
 {
-	uint8_t type;
-	int16_t fc;
-	ifmg4_state fs[2];
-} fx_filter_blk;
+	fx_filter_blk flt;
+	int16_t fcm[FRAMESZ];
+	int16_t out[2*FRAMESZ] DSP_VEC;
+	int16_t *src;
+	uint16_t sz;
+	uint8_t mod;
+} fx_filter_split_blk;
+
+typedef void (*fx_filter_chl_fn)(ifmg4_stereo_state *, int16_t *, int16_t *, uint16_t, uint8_t);
+typedef void (*fx_filter_chl_mod_fn)(ifmg4_stereo_state *, int16_t *, int16_t *, int16_t *, uint16_t, uint8_t);
 
 const char *filter_param_names[] =
 {
@@ -20,74 +41,209 @@ const char *filter_param_names[] =
 	"",
 };
 
+/*
+ * build the coefficient table - background job on core 0
+ */
+static void fx_filters_Lut(void *vblk)
+{
+	init_ifilter_mg4_lut();
+}
+
+/*
+ * table is ready - from the audio ISR at the start of a block
+ */
+static void IRAM_ATTR fx_filters_Done(void *vblk)
+{
+	fx_filter_blk *blk = vblk;
+	
+	blk->ready = 1;
+}
+
 /*
  * Common filter init
  */
-void * fx_filters_Init(uint32_t *mem, uint8_t type)
+void * fx_filters_Init(uint32_t *mem)
 {
 	/* set up instance in mem area provided */
 	fx_filter_blk *blk = 	(fx_filter_blk *)mem;
 	
-	/* set channel and type */
-	blk->type = type;
+	blk->fc = 0;
 		
-	/* initialize filter blocks */
-	init_ifilter_mg4(&blk->fs[0]);
-	init_ifilter_mg4(&blk->fs[1]);
+	/* initialize filter block */
+	init_ifilter_mg4_block(&blk->fs);
+	
+	/* first filter since boot builds the table in the background & passes
+	 * dry until it's done. W/o the job pool it's built here instead. */
+	blk->ready = ifilter_mg4_lut_ready();
+	if(!blk->ready &&
+		(jobpool_submit(JOB_PRIO_HIGH, fx_filters_Lut, fx_filters_Done, blk) != ESP_OK))
+	{
+		init_ifilter_mg4_lut();
+		blk->ready = 1;
+	}
 	
 	/* return pointer */
 	return (void *)blk;
 }
 
 /*
- * low-pass init
- */
-void * fx_lpf_Init(uint32_t *mem)
-{
-	return fx_filters_Init(mem, 0);
-}
-
-/*
- * high-pass init
+ * cutoff control curve - 12-bit in, cubed for something like exponential
  */
-void * fx_hpf_Init(uint32_t *mem)
+static inline __attribute__((always_inline)) int32_t fx_filters_fc_curve(int16_t ctl)
 {
-	return fx_filters_Init(mem, 2);
+	int32_t fc = ctl<<3;
+	
+	return (((fc*fc)>>15)*fc)>>15;
 }
 
 /*
- * band-pass init
+ * run a block w/ L on core 0 & R here. Both write the private out buffer,
+ * which only goes to dst if the join made the deadline - otherwise the L
+ * job is still writing it, so the block is silent like a late pipeline
+ * stage.
  */
-void * fx_bpf_Init(uint32_t *mem)
+static inline __attribute__((always_inline)) void fx_filters_split(
+	fx_filter_split_blk *sblk, int16_t *dst, int16_t *src, int16_t *fcm,
+	uint16_t sz, fork_fn job, fx_filter_chl_fn chl, fx_filter_chl_mod_fn chl_mod)
 {
-	return fx_filters_Init(mem, 3);
+	sblk->src = src;
+	sblk->sz = sz;
+	sblk->mod = fcm != NULL;
+	fork_run(job, sblk);
+	
+	if(fcm)
+		chl_mod(&sblk->flt.fs, sblk->out, src, fcm, sz, 1);
+	else
+		chl(&sblk->flt.fs, sblk->out, src, sz, 1);
+	
+	if(fork_join() != ESP_OK)
+	{
+		memset(dst, 0, 2*sz*sizeof(int16_t));
+		return;
+	}
+	memcpy(dst, sblk->out, 2*sz*sizeof(int16_t));
 }
 
 /*
- * VCA audio process
+ * Common filter audio process - inlined into each mode-specific proc below
+ * so the kernels are picked at compile time. Cutoff & resonance controls
+ * are 12-bit. fc_mod is an optional per-sample cutoff stream on the same
+ * scale, which takes over from fc_ctl. With split set vblk must be a
+ * fx_filter_split_blk & the block is filtered across both cores.
  */
-void IRAM_ATTR fx_filters_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+static inline __attribute__((always_inline)) void fx_filters_common_Proc(
+	void *vblk, int16_t *dst, int16_t *src, uint16_t sz, const uint8_t mode,
+	int16_t fc_ctl, int16_t res_ctl, const int16_t *fc_mod,
+	void (*kernel)(ifmg4_stereo_state *, int16_t *, int16_t *, uint16_t),
+	void (*kernel_mod)(ifmg4_stereo_state *, int16_t *, int16_t *, int16_t *, uint16_t),
+	const uint8_t split, fork_fn job, fx_filter_chl_fn chl, fx_filter_chl_mod_fn chl_mod)
 {
 	fx_filter_blk *blk = vblk;
-	int32_t fc, res;
+	int32_t fc, res, fc_acc, fc_step;
+	int16_t fcm_stk[FRAMESZ], *fcm;
+	uint16_t i;
+	
+	/* no coefficients yet - dry */
+	if(!blk->ready)
+	{
+		fx_bypass_Proc(NULL, dst, src, sz);
+		return;
+	}
 	
 	/* update filter params for this pass */
-	fc = adc_param[1]<<3;
-	fc = (((fc*fc)>>15)*fc)>>15;
-	blk->fc = fc;
-	res = adc_param[2]<<3;
-	set_ifilter_mg4(&blk->fs[0], fc, res, blk->type);
-	dupe_ifilter_mg4(&blk->fs[0], &blk->fs[1]);
+	if(fc_mod && (sz > FRAMESZ))
+		fc_mod = NULL;
+	fc = fx_filters_fc_curve(fc_mod ? fc_mod[sz-1] : fc_ctl);
+	res = res_ctl<<3;
+	set_ifilter_mg4_block(&blk->fs, fc, res, mode);
+	fcm = split ? ((fx_filter_split_blk *)vblk)->fcm : fcm_stk;
 	
-	/* loop over the buffer */
-	while(sz--)
+	if(fc_mod && (blk->fs.bypass == mode))
 	{
-		/* run the filters */
-		*dst++ = ifilter_mg4(&blk->fs[0], *src++);
-		*dst++ = ifilter_mg4(&blk->fs[1], *src++);
+		/* CV stream - cutoff per sample, held below bypass */
+		for(i=0;i<sz;i++)
+		{
+			fc_acc = fx_filters_fc_curve(fc_mod[i]);
+			fcm[i] = fc_acc > MG4_FC_MAX ? MG4_FC_MAX : fc_acc;
+		}
 	}
+	else if((fc != blk->fc) && (sz <= FRAMESZ) &&
+		(fc <= MG4_FC_MAX) && (blk->fc <= MG4_FC_MAX))
+	{
+		/* cutoff moved - ramp it across the block to avoid zipper noise */
+		fc_acc = blk->fc<<8;
+		fc_step = ((fc - blk->fc)<<8)/sz;
+		for(i=0;i<sz;i++)
+		{
+			fc_acc += fc_step;
+			fcm[i] = fc_acc>>8;
+		}
+	}
+	else if(blk->fs.bypass == mode)
+	{
+		/* static cutoff - run the filter over the whole buffer */
+		fcm = NULL;
+	}
+	else
+	{
+		/* cutoff out of range - bypassed or disabled */
+		ifilter_mg4_block(&blk->fs, dst, src, sz);
+		blk->fc = fc;
+		return;
+	}
+	blk->fc = fc;
+	
+	if(split && (sz <= FRAMESZ))
+		fx_filters_split(vblk, dst, src, fcm, sz, job, chl, chl_mod);
+	else if(fcm)
+		kernel_mod(&blk->fs, dst, src, fcm, sz);
+	else
+		kernel(&blk->fs, dst, src, sz);
 }
 
+/*
+ * generate init and audio process for each filter mode, plus a version
+ * that takes its controls from the caller for use inside other effects.
+ * The standalone filters take cutoff as a CV stream for filter FM, and
+ * w/ MULTICORE hand the L channel to core 0 as fx_*_Fork.
+ */
+#define FX_FILTER(name, mode) \
+void * fx_##name##_Init(uint32_t *mem) \
+{ \
+	cvmod_request(1, FX_FILTER_CV_BW); \
+	return fx_filters_Init(mem); \
+} \
+void IRAM_ATTR fx_##name##_Apply(void *vblk, int16_t *dst, int16_t *src, uint16_t sz, \
+	int16_t fc_ctl, int16_t res_ctl) \
+{ \
+	fx_filters_common_Proc(vblk, dst, src, sz, mode, fc_ctl, res_ctl, NULL, \
+		ifilter_mg4_block_##name, ifilter_mg4_block_mod_##name, 0, NULL, NULL, NULL); \
+} \
+static void IRAM_ATTR fx_##name##_Fork(void *vblk) \
+{ \
+	fx_filter_split_blk *sblk = vblk; \
+	if(sblk->mod) \
+		ifilter_mg4_chl_mod_##name(&sblk->flt.fs, sblk->out, sblk->src, sblk->fcm, sblk->sz, 0); \
+	else \
+		ifilter_mg4_chl_##name(&sblk->flt.fs, sblk->out, sblk->src, sblk->sz, 0); \
+} \
+void IRAM_ATTR fx_##name##_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz) \
+{ \
+	const int16_t *cv; \
+	uint8_t flat; \
+	cv = cvmod_get(1, &flat); \
+	fx_filters_common_Proc(vblk, dst, src, sz, mode, \
+		adc_param[1], adc_param[2], cv && !flat ? cv : NULL, \
+		ifilter_mg4_block_##name, ifilter_mg4_block_mod_##name, \
+		FX_FILTER_SPLIT, fx_##name##_Fork, ifilter_mg4_chl_##name, ifilter_mg4_chl_mod_##name); \
+}
+
+FX_FILTER(lp, MG4_LP)
+FX_FILTER(hp, MG4_HP)
+FX_FILTER(bp, MG4_BP)
+FX_FILTER(notch, MG4_NOTCH)
+FX_FILTER(lp12, MG4_LP12)
+
 /*
  * Render parameter for clean delay - either delay in ms or feedback %
  */
@@ -122,9 +278,9 @@ fx_struct fx_lpf_struct =
 	"LPF",
 	2,
 	filter_param_names,
-	fx_lpf_Init,
+	fx_lp_Init,
 	fx_bypass_Cleanup,
-	fx_filters_Proc,
+	fx_lp_Proc,
 	fx_filters_Render_Parm,
 };
 
@@ -136,23 +292,50 @@ fx_struct fx_hpf_struct =
 	"HPF",
 	2,
 	filter_param_names,
-	fx_hpf_Init,
+	fx_hp_Init,
 	fx_bypass_Cleanup,
-	fx_filters_Proc,
+	fx_hp_Proc,
 	fx_filters_Render_Parm,
 };
 
 /*
- * low-pass filter struct
+ * band-pass filter struct
  */
 fx_struct fx_bpf_struct =
 {
 	"BPF",
 	2,
 	filter_param_names,
-	fx_bpf_Init,
+	fx_bp_Init,
 	fx_bypass_Cleanup,
-	fx_filters_Proc,
+	fx_bp_Proc,
 	fx_filters_Render_Parm,
 };
 
+/*
+ * notch filter struct
+ */
+fx_struct fx_notch_struct =
+{
+	"Notch",
+	2,
+	filter_param_names,
+	fx_notch_Init,
+	fx_bypass_Cleanup,
+	fx_notch_Proc,
+	fx_filters_Render_Parm,
+};
+
+/*
+ * 12dB low-pass filter struct
+ */
+fx_struct fx_lp12_struct =
+{
+	"LPF12",
+	2,
+	filter_param_names,
+	fx_lp12_Init,
+	fx_bypass_Cleanup,
+	fx_lp12_Proc,
+	fx_filters_Render_Parm,
+};
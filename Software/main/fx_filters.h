@@ -7,10 +7,25 @@
 #define __fx_filters__
 
 #include "fx.h"
+#include "ifilter_mg4_v1.h"
+
+typedef struct 
+{
+	uint8_t ready;		/* coefficient table built */
+	int16_t fc;
+	ifmg4_stereo_state fs;
+} fx_filter_blk;
+
+/* filter stages for use inside other effects */
+void * fx_filters_Init(uint32_t *mem);
+void fx_lp_Apply(void *vblk, int16_t *dst, int16_t *src, uint16_t sz,
+	int16_t fc_ctl, int16_t res_ctl);
 
 extern fx_struct fx_lpf_struct;
 extern fx_struct fx_hpf_struct;
 extern fx_struct fx_bpf_struct;
+extern fx_struct fx_notch_struct;
+extern fx_struct fx_lp12_struct;
 
 #endif
 
@@ -4,6 +4,10 @@
  */
  
 #include "fx_vca.h"
+#include "cvmod.h"
+
+/* gain CV bandwidth, Hz */
+#define VCA_CV_BW 2000
 
 typedef struct 
 {
@@ -28,6 +32,9 @@ void * fx_vca_Init(uint32_t *mem)
 	/* initialize gain slewing */
 	blk->gain = 0;
 	
+	/* gain CV at audio rate for AM */
+	cvmod_request(1, VCA_CV_BW);
+	
 	/* return pointer */
 	return (void *)blk;
 }
@@ -35,11 +42,28 @@ void * fx_vca_Init(uint32_t *mem)
 /*
  * VCA audio process
  */
-void fx_vca_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
+void IRAM_ATTR fx_vca_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
 {
 	fx_vca_blk *blk = vblk;
 	int16_t next_gain, gain_slope;
 	int32_t mix;
+	const int16_t *cv;
+	uint8_t flat;
+	
+	/* gain per sample from the CV stream when it's moving */
+	cv = cvmod_get(1, &flat);
+	if(cv && !flat && (sz <= FRAMESZ))
+	{
+		while(sz--)
+		{
+			mix = q12_mac(0, *src++, *cv);
+			*dst++ = q12_sat16(mix);
+			mix = q12_mac(0, *src++, *cv++);
+			*dst++ = q12_sat16(mix);
+		}
+		blk->gain = *(cv-1);
+		return;
+	}
 	
 	/* get the gain value & calc slew */
 	next_gain = adc_param[1];
@@ -48,10 +72,10 @@ void fx_vca_Proc(void *vblk, int16_t *dst, int16_t *src, uint16_t sz)
 	/* loop over the buffer */
 	while(sz--)
 	{
-		mix = *src++ * blk->gain;
-		*dst++ = dsp_ssat16(mix>>12);
-		mix = *src++ * blk->gain;
-		*dst++ = dsp_ssat16(mix>>12);
+		mix = q12_mac(0, *src++, blk->gain);
+		*dst++ = q12_sat16(mix);
+		mix = q12_mac(0, *src++, blk->gain);
+		*dst++ = q12_sat16(mix);
 		blk->gain += gain_slope;
 	}
 }
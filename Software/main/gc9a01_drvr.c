@@ -22,14 +22,12 @@
 #include "esp_log.h"
 #include "esp_lcd_gc9a01.h"
 #include "gc9a01_drvr.h"
+#include "memplan.h"
 
 /* tag for logging */
 static const char* TAG = "gc9a01_drvr";
 
-//To speed up transfers, every SPI transfer sends a bunch of rows. This define specifies how many. More means more memory use,
-//but less overhead for setting up / finishing transfers.
-#define BUF_ROWS 16
-#define BUFSZ (BUF_ROWS*GC9A01_TFTWIDTH)
+#define BUFSZ GC9A01_BUFSZ
 
 /* swap bytes */
 #define __REVSH(x) ((((x)>>8)&0xff)|(((x)&0xff)<<8))
@@ -120,9 +118,8 @@ void GC9A01_init(void)
     ESP_ERROR_CHECK(esp_lcd_panel_invert_color(panel_handle, true));
     ESP_ERROR_CHECK(esp_lcd_panel_mirror(panel_handle, true, false));
 	
-	// alloc draw buffer
-    ESP_LOGI(TAG, "Alloc draw buffer");
-    drawbuf = heap_caps_malloc(BUFSZ * sizeof(uint16_t), MALLOC_CAP_DMA);
+	// planned draw buffer
+    drawbuf = memplan_get(MP_LCD_DRAW, NULL);
     assert(drawbuf);
 	
 	/* set dimensions for clipping */
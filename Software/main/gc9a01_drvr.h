@@ -16,6 +16,11 @@
 #define GC9A01_TFTWIDTH 240
 #define GC9A01_TFTHEIGHT 240
 
+//To speed up transfers, every SPI transfer sends a bunch of rows. This define specifies how many. More means more memory use,
+//but less overhead for setting up / finishing transfers.
+#define GC9A01_BUF_ROWS 16
+#define GC9A01_BUFSZ (GC9A01_BUF_ROWS*GC9A01_TFTWIDTH)
+
 extern GFX_DRIVER GC9A01_drvr;
 
 void GC9A01_init(void);
@@ -8,25 +8,13 @@
 // Modified by paul.kellett@maxim.abel.co.uk July 2000
 
 #include <math.h>
+#include <string.h>
 #include "ifilter_mg4_v1.h"
+#include "dsp_fixed.h"
 
 #define UNITY (8388608)
 #define SAT_LIM (10*UNITY)
-
-/*
- * S8.23 mult
- */
-inline int32_t s823mult(int32_t x, int32_t y)
-{
-	int64_t result;
-	
-	result = (int64_t)x * (int64_t)y;
-	//result += (1<<22);
-	result >>= 23;
-	//result = result > 0x7fffffff ? 0x7fffffff : result;
-	//result = result < -0x8000000 ? -0x8000000 : result;
-	return result;
-}
+#define CLIP_K ((int32_t)(0.166667F*(float32_t)UNITY))
 
 /*
  * init_mg4 - initialize the filter state
@@ -62,11 +50,11 @@ void IRAM_ATTR set_ifilter_mg4(ifmg4_state *f, int16_t fc, int16_t res, uint8_t
 	
 	// Set coefficients given frequency & resonance [0.0...1.0]
 	f->q = UNITY - ifc;
-	f->p = ifc + s823mult(s823mult((0.8F*(float32_t)UNITY), ifc), f->q);
+	f->p = ifc + s823_mul(s823_mul((0.8F*(float32_t)UNITY), ifc), f->q);
 	f->f = f->p + f->p - UNITY;
-	f->q = s823mult(ires, (UNITY + (s823mult(f->q, UNITY - f->q + 
-		s823mult((5.6F*(float32_t)UNITY), s823mult(f->q, f->q)))>>1)));
-	f->gain = UNITY + ires + s823mult(ires<<1, UNITY-ifc);
+	f->q = s823_mul(ires, (UNITY + (s823_mul(f->q, UNITY - f->q + 
+		s823_mul((5.6F*(float32_t)UNITY), s823_mul(f->q, f->q)))>>1)));
+	f->gain = UNITY + ires + s823_mul(ires<<1, UNITY-ifc);
 
 	// Bypass - explicitly, or if cutoff is > 90%
 	f->bypass = bypass;
@@ -110,15 +98,15 @@ int16_t IRAM_ATTR ifilter_mg4(ifmg4_state *f, int16_t input)
 	in = (int32_t)input<<8;
 	
 	/* Filter */
-	in -= s823mult(f->q, f->b4);			// feedback
+	in -= s823_mul(f->q, f->b4);			// feedback
 	f->t1 = f->b1;
-	f->b1 = s823mult(in + f->b0, f->p) - s823mult(f->b1, f->f);
+	f->b1 = s823_mul(in + f->b0, f->p) - s823_mul(f->b1, f->f);
 	f->t2 = f->b2;
-	f->b2 = s823mult(f->b1 + f->t1, f->p) - s823mult(f->b2, f->f);
+	f->b2 = s823_mul(f->b1 + f->t1, f->p) - s823_mul(f->b2, f->f);
 	f->t1 = f->b3;
-	f->b3 = s823mult(f->b2 + f->t2, f->p) - s823mult(f->b3, f->f);
-	f->b4 = s823mult(f->b3 + f->t1, f->p) - s823mult(f->b4, f->f);
-	f->b4 = f->b4 - s823mult(s823mult(s823mult(f->b4, f->b4), f->b4), (0.166667F*(float32_t)UNITY));	// clipping
+	f->b3 = s823_mul(f->b2 + f->t2, f->p) - s823_mul(f->b3, f->f);
+	f->b4 = s823_mul(f->b3 + f->t1, f->p) - s823_mul(f->b4, f->f);
+	f->b4 = f->b4 - s823_mul(s823_mul(s823_mul(f->b4, f->b4), f->b4), (0.166667F*(float32_t)UNITY));	// clipping
 	f->b0 = in;
 	
 	/* saturate feedback to prevent overflow & NaN */
@@ -129,7 +117,7 @@ int16_t IRAM_ATTR ifilter_mg4(ifmg4_state *f, int16_t input)
 	switch(f->bypass)
 	{
 		case 0: // Lowpass  output:  b4
-			out = s823mult(f->gain, f->b4);
+			out = s823_mul(f->gain, f->b4);
 			break;
 		
 		default:
@@ -138,11 +126,11 @@ int16_t IRAM_ATTR ifilter_mg4(ifmg4_state *f, int16_t input)
 			break;
 		
 		case 2: // Highpass output:  in - b4;
-			out = in - s823mult(f->gain, f->b4);
+			out = in - s823_mul(f->gain, f->b4);
 			break;
 		
 		case 3: // Bandpass output:  3.0f * (b3 - b4);
-			out = s823mult(f->gain, (3 * (f->b3-f->b4)));
+			out = s823_mul(f->gain, (3 * (f->b3-f->b4)));
 			break;
 	}
 
@@ -152,3 +140,426 @@ int16_t IRAM_ATTR ifilter_mg4(ifmg4_state *f, int16_t input)
 }
 
 
+
+/*
+ * coefficient table over cutoff: p, resonance slope & gain slopes for the
+ * 24dB & 12dB outputs. q and gain are linear in resonance so only cutoff
+ * needs a table axis.
+ */
+static int32_t mg4_lut[MG4_LUT_SZ][4];
+static uint32_t mg4_lut_valid = 0;
+
+/*
+ * init_ifilter_mg4_lut - build coefficient table from the full formula.
+ * Too slow for the audio core, so the effects run it as a background job.
+ */
+void init_ifilter_mg4_lut(void)
+{
+	int32_t i, ifc, q;
+	
+	if(__atomic_load_n(&mg4_lut_valid, __ATOMIC_ACQUIRE))
+		return;
+	
+	for(i=0;i<MG4_LUT_SZ;i++)
+	{
+		/* same math as set_ifilter_mg4() w/ resonance factored out */
+		ifc = (i<<MG4_LUT_FRAC)<<8;
+		q = UNITY - ifc;
+		mg4_lut[i][0] = ifc + s823_mul(s823_mul((0.8F*(float32_t)UNITY), ifc), q);
+		mg4_lut[i][1] = UNITY + (s823_mul(q, UNITY - q + 
+			s823_mul((5.6F*(float32_t)UNITY), s823_mul(q, q)))>>1);
+		mg4_lut[i][2] = UNITY + 2*(UNITY - ifc);
+		
+		/* b2 is tapped inside the same 4 pole loop so it loses as much at
+		 * DC, but peaks up to 1.8x higher at resonance. This holds its peak
+		 * to the 24dB output's, letting the passband drop some instead. */
+		mg4_lut[i][3] = UNITY + s823_mul((1.9F*(float32_t)UNITY), s823_mul(ifc, UNITY - ifc));
+	}
+	
+	__atomic_store_n(&mg4_lut_valid, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * ifilter_mg4_lut_ready - is the coefficient table built
+ */
+uint8_t ifilter_mg4_lut_ready(void)
+{
+	return __atomic_load_n(&mg4_lut_valid, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * coefficients by interpolated lookup
+ * fc = cutoff [0,1] in Q15, ires = resonance [0,1] in S8.23
+ * mode picks the gain compensation for the output used
+ */
+static inline __attribute__((always_inline)) void ifilter_mg4_lut(
+	int32_t fc, int32_t ires, const uint8_t mode,
+	int32_t *p, int32_t *f, int32_t *q, int32_t *gain)
+{
+	int32_t idx = fc >> MG4_LUT_FRAC, frac = fc & ((1<<MG4_LUT_FRAC)-1);
+	const int32_t *t0 = mg4_lut[idx], *t1 = mg4_lut[idx+1];
+	const uint8_t g = mode == MG4_LP12 ? 3 : 2;
+	
+	*p = t0[0] + (((t1[0]-t0[0]) * frac) >> MG4_LUT_FRAC);
+	*f = *p + *p - UNITY;
+	*q = s823_mul(ires, t0[1] + (((t1[1]-t0[1]) * frac) >> MG4_LUT_FRAC));
+	*gain = UNITY + s823_mul(ires, t0[g] + (((t1[g]-t0[g]) * frac) >> MG4_LUT_FRAC));
+}
+
+/*
+ * init_ifilter_mg4_block - initialize the stereo filter state. The table
+ * from init_ifilter_mg4_lut() must be built before the filter is run.
+ */
+void init_ifilter_mg4_block(ifmg4_stereo_state *f)
+{
+	set_ifilter_mg4_block(f, 0, 0, 0);
+	memset(f->b, 0, sizeof(f->b));
+}
+
+/*
+ * set_ifilter_mg4_block - set stereo filter parameters. Same args as
+ * set_ifilter_mg4() but both channels share a single set of coeffs
+ * which come from the lookup table, and bypass takes any ifmg4_modes.
+ */
+void IRAM_ATTR set_ifilter_mg4_block(ifmg4_stereo_state *f, int16_t fc, int16_t res, uint8_t bypass)
+{
+	fc = fc < 0 ? 0 : fc;
+	f->res = res<<8;
+	ifilter_mg4_lut(fc, f->res, bypass, &f->p, &f->f, &f->q, &f->gain);
+
+	// Bypass - explicitly, or if cutoff is > 90%
+	f->mode = bypass;
+	f->bypass = bypass;
+	if(fc > MG4_FC_MAX)
+	{
+		if((bypass <= MG4_BYPASS) || (bypass >= MG4_NOTCH))
+			f->bypass = MG4_BYPASS;	// bypassed
+		else
+			f->bypass = MG4_OFF;	// disabled
+	}
+}
+
+/*
+ * stereo block filter core - mode is a constant at each call site so the
+ * output select drops out of the loop. State lives in locals for the whole
+ * block and L/R are interleaved so each channel's multiplies have the
+ * other's to cover their latency - how much that buys on the S3 is up to
+ * the bench. If fcm is non-NULL the coeffs are looked up again for every
+ * frame from the per-frame cutoff it points to.
+ */
+static inline __attribute__((always_inline)) void ifilter_mg4_block_core(
+	ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fcm,
+	uint16_t sz, const uint8_t mode)
+{
+	int32_t p = f->p, fb = f->f, q = f->q, gain = f->gain, fc;
+	int32_t b0l = f->b[0][0], b1l = f->b[1][0], b2l = f->b[2][0],
+		b3l = f->b[3][0], b4l = f->b[4][0];
+	int32_t b0r = f->b[0][1], b1r = f->b[1][1], b2r = f->b[2][1],
+		b3r = f->b[3][1], b4r = f->b[4][1];
+	int32_t inl, inr, t1l, t1r, t2l, t2r, outl, outr;
+	
+	while(sz--)
+	{
+		/* per-frame cutoff */
+		if(fcm)
+		{
+			fc = *fcm++;
+			fc = fc < 0 ? 0 : fc;
+			fc = fc > MG4_FC_MAX ? MG4_FC_MAX : fc;
+			ifilter_mg4_lut(fc, f->res, mode, &p, &fb, &q, &gain);
+		}
+		
+		/* convert to S8.23 */
+		inl = (int32_t)*src++<<8;
+		inr = (int32_t)*src++<<8;
+		
+		/* feedback */
+		inl -= s823_mul(q, b4l);
+		inr -= s823_mul(q, b4r);
+		
+		/* four ladder stages */
+		t1l = b1l;
+		t1r = b1r;
+		b1l = s823_mul(inl + b0l, p) - s823_mul(b1l, fb);
+		b1r = s823_mul(inr + b0r, p) - s823_mul(b1r, fb);
+		t2l = b2l;
+		t2r = b2r;
+		b2l = s823_mul(b1l + t1l, p) - s823_mul(b2l, fb);
+		b2r = s823_mul(b1r + t1r, p) - s823_mul(b2r, fb);
+		t1l = b3l;
+		t1r = b3r;
+		b3l = s823_mul(b2l + t2l, p) - s823_mul(b3l, fb);
+		b3r = s823_mul(b2r + t2r, p) - s823_mul(b3r, fb);
+		b4l = s823_mul(b3l + t1l, p) - s823_mul(b4l, fb);
+		b4r = s823_mul(b3r + t1r, p) - s823_mul(b4r, fb);
+		
+		/* clipping */
+		b4l = b4l - s823_mul(s823_mul(s823_mul(b4l, b4l), b4l), CLIP_K);
+		b4r = b4r - s823_mul(s823_mul(s823_mul(b4r, b4r), b4r), CLIP_K);
+		b0l = inl;
+		b0r = inr;
+		
+		/* saturate feedback to prevent overflow & NaN */
+		b4l = b4l >  SAT_LIM ?  SAT_LIM : b4l;
+		b4l = b4l < -SAT_LIM ? -SAT_LIM : b4l;
+		b4r = b4r >  SAT_LIM ?  SAT_LIM : b4r;
+		b4r = b4r < -SAT_LIM ? -SAT_LIM : b4r;
+		
+		/* select output - resolved at compile time */
+		switch(mode)
+		{
+			default:
+			case MG4_LP: // Lowpass  output:  b4
+				outl = s823_mul(gain, b4l);
+				outr = s823_mul(gain, b4r);
+				break;
+			
+			case MG4_HP: // Highpass output:  in - b4;
+				outl = inl - s823_mul(gain, b4l);
+				outr = inr - s823_mul(gain, b4r);
+				break;
+			
+			case MG4_BP: // Bandpass output:  3.0f * (b3 - b4);
+				outl = s823_mul(gain, (3 * (b3l-b4l)));
+				outr = s823_mul(gain, (3 * (b3r-b4r)));
+				break;
+			
+			case MG4_NOTCH: // Notch output:  in - bandpass
+				outl = inl - s823_mul(gain, (3 * (b3l-b4l)));
+				outr = inr - s823_mul(gain, (3 * (b3r-b4r)));
+				break;
+			
+			case MG4_LP12: // 12dB Lowpass output:  b2
+				outl = s823_mul(gain, b2l);
+				outr = s823_mul(gain, b2r);
+				break;
+		}
+		
+		/* convert output back to int16 */
+		*dst++ = dsp_ssat16((outl + 128) >> 8);
+		*dst++ = dsp_ssat16((outr + 128) >> 8);
+	}
+	
+	/* save state */
+	if(fcm)
+	{
+		f->p = p;
+		f->f = fb;
+		f->q = q;
+		f->gain = gain;
+	}
+	f->b[0][0] = b0l;
+	f->b[1][0] = b1l;
+	f->b[2][0] = b2l;
+	f->b[3][0] = b3l;
+	f->b[4][0] = b4l;
+	f->b[0][1] = b0r;
+	f->b[1][1] = b1r;
+	f->b[2][1] = b2r;
+	f->b[3][1] = b3r;
+	f->b[4][1] = b4r;
+}
+
+/*
+ * one channel of the stereo state on its own - same math as the stereo
+ * core, so the two halves can run on different cores and still match it
+ * bit for bit. Only the interleaved samples & state for chl are touched.
+ * Channel 0 saves the coeffs a modulated block ends on, so the other one
+ * can run at the same time w/o writing them.
+ */
+static inline __attribute__((always_inline)) void ifilter_mg4_chl_core(
+	ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fcm,
+	uint16_t sz, uint8_t chl, const uint8_t mode)
+{
+	int32_t p = f->p, fb = f->f, q = f->q, gain = f->gain, fc;
+	int32_t b0 = f->b[0][chl], b1 = f->b[1][chl], b2 = f->b[2][chl],
+		b3 = f->b[3][chl], b4 = f->b[4][chl];
+	int32_t in, t1, t2, out;
+	
+	src += chl;
+	dst += chl;
+	while(sz--)
+	{
+		/* per-frame cutoff */
+		if(fcm)
+		{
+			fc = *fcm++;
+			fc = fc < 0 ? 0 : fc;
+			fc = fc > MG4_FC_MAX ? MG4_FC_MAX : fc;
+			ifilter_mg4_lut(fc, f->res, mode, &p, &fb, &q, &gain);
+		}
+		
+		/* convert to S8.23 */
+		in = (int32_t)*src<<8;
+		src += 2;
+		
+		/* feedback */
+		in -= s823_mul(q, b4);
+		
+		/* four ladder stages */
+		t1 = b1;
+		b1 = s823_mul(in + b0, p) - s823_mul(b1, fb);
+		t2 = b2;
+		b2 = s823_mul(b1 + t1, p) - s823_mul(b2, fb);
+		t1 = b3;
+		b3 = s823_mul(b2 + t2, p) - s823_mul(b3, fb);
+		b4 = s823_mul(b3 + t1, p) - s823_mul(b4, fb);
+		
+		/* clipping */
+		b4 = b4 - s823_mul(s823_mul(s823_mul(b4, b4), b4), CLIP_K);
+		b0 = in;
+		
+		/* saturate feedback to prevent overflow & NaN */
+		b4 = b4 >  SAT_LIM ?  SAT_LIM : b4;
+		b4 = b4 < -SAT_LIM ? -SAT_LIM : b4;
+		
+		/* select output - resolved at compile time */
+		switch(mode)
+		{
+			default:
+			case MG4_LP: // Lowpass  output:  b4
+				out = s823_mul(gain, b4);
+				break;
+			
+			case MG4_HP: // Highpass output:  in - b4;
+				out = in - s823_mul(gain, b4);
+				break;
+			
+			case MG4_BP: // Bandpass output:  3.0f * (b3 - b4);
+				out = s823_mul(gain, (3 * (b3-b4)));
+				break;
+			
+			case MG4_NOTCH: // Notch output:  in - bandpass
+				out = in - s823_mul(gain, (3 * (b3-b4)));
+				break;
+			
+			case MG4_LP12: // 12dB Lowpass output:  b2
+				out = s823_mul(gain, b2);
+				break;
+		}
+		
+		/* convert output back to int16 */
+		*dst = dsp_ssat16((out + 128) >> 8);
+		dst += 2;
+	}
+	
+	/* save state */
+	if(fcm && !chl)
+	{
+		f->p = p;
+		f->f = fb;
+		f->q = q;
+		f->gain = gain;
+	}
+	f->b[0][chl] = b0;
+	f->b[1][chl] = b1;
+	f->b[2][chl] = b2;
+	f->b[3][chl] = b3;
+	f->b[4][chl] = b4;
+}
+
+/*
+ * generate the per-mode kernels - one static and one modulated cutoff
+ * version for each output mode, in stereo & single channel, so nothing is
+ * decided per sample and adding modes doesn't touch the existing inner
+ * loops.
+ */
+#define IFMG4_KERNELS(name, mode) \
+void IRAM_ATTR ifilter_mg4_block_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, uint16_t sz) \
+{ \
+	ifilter_mg4_block_core(f, dst, src, NULL, sz, mode); \
+} \
+void IRAM_ATTR ifilter_mg4_block_mod_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fc, uint16_t sz) \
+{ \
+	ifilter_mg4_block_core(f, dst, src, fc, sz, mode); \
+} \
+void IRAM_ATTR ifilter_mg4_chl_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, uint16_t sz, uint8_t chl) \
+{ \
+	ifilter_mg4_chl_core(f, dst, src, NULL, sz, chl, mode); \
+} \
+void IRAM_ATTR ifilter_mg4_chl_mod_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fc, uint16_t sz, uint8_t chl) \
+{ \
+	ifilter_mg4_chl_core(f, dst, src, fc, sz, chl, mode); \
+}
+
+IFMG4_KERNELS(lp, MG4_LP)
+IFMG4_KERNELS(hp, MG4_HP)
+IFMG4_KERNELS(bp, MG4_BP)
+IFMG4_KERNELS(notch, MG4_NOTCH)
+IFMG4_KERNELS(lp12, MG4_LP12)
+
+/*
+ * ifilter_mg4_block - run the filter on a block of interleaved stereo
+ * sz = number of stereo frames
+ */
+void IRAM_ATTR ifilter_mg4_block(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, uint16_t sz)
+{
+	switch(f->bypass)
+	{
+		case MG4_LP:
+			ifilter_mg4_block_lp(f, dst, src, sz);
+			break;
+		
+		case MG4_HP:
+			ifilter_mg4_block_hp(f, dst, src, sz);
+			break;
+		
+		case MG4_BP:
+			ifilter_mg4_block_bp(f, dst, src, sz);
+			break;
+		
+		case MG4_NOTCH:
+			ifilter_mg4_block_notch(f, dst, src, sz);
+			break;
+		
+		case MG4_LP12:
+			ifilter_mg4_block_lp12(f, dst, src, sz);
+			break;
+		
+		case MG4_OFF:
+			memset(dst, 0, 2*sz*sizeof(int16_t));
+			break;
+		
+		default:
+		case MG4_BYPASS:
+			memcpy(dst, src, 2*sz*sizeof(int16_t));
+			break;
+	}
+}
+
+/*
+ * ifilter_mg4_block_mod - run the filter on a block of interleaved stereo
+ * with a separate cutoff for each frame. Mode & resonance come from the
+ * last set_ifilter_mg4_block(). Cutoff is clamped to the usable range
+ * rather than switching to bypass partway through a block.
+ */
+void IRAM_ATTR ifilter_mg4_block_mod(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fc, uint16_t sz)
+{
+	switch(f->mode)
+	{
+		case MG4_LP:
+			ifilter_mg4_block_mod_lp(f, dst, src, fc, sz);
+			break;
+		
+		case MG4_HP:
+			ifilter_mg4_block_mod_hp(f, dst, src, fc, sz);
+			break;
+		
+		case MG4_BP:
+			ifilter_mg4_block_mod_bp(f, dst, src, fc, sz);
+			break;
+		
+		case MG4_NOTCH:
+			ifilter_mg4_block_mod_notch(f, dst, src, fc, sz);
+			break;
+		
+		case MG4_LP12:
+			ifilter_mg4_block_mod_lp12(f, dst, src, fc, sz);
+			break;
+		
+		default:
+		case MG4_BYPASS:
+			memcpy(dst, src, 2*sz*sizeof(int16_t));
+			break;
+	}
+}
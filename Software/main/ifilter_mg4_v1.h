@@ -6,7 +6,33 @@
 #ifndef __ifilter_mg4__
 #define __ifilter_mg4__
 
+#ifdef ESP_PLATFORM
 #include "fx.h"
+#else
+/* host build for the tests - just what the filter needs */
+#include <stdint.h>
+#include "dsp_align.h"
+typedef float float32_t;
+#define IRAM_ATTR
+#endif
+
+/* coeff lookup - cutoff is split into 2^MG4_LUT_BITS segments */
+#define MG4_LUT_BITS 8
+#define MG4_LUT_FRAC (15-MG4_LUT_BITS)
+#define MG4_LUT_SZ ((1<<MG4_LUT_BITS)+1)
+#define MG4_FC_MAX (29491)			// 0.9 - above this filter is bypassed
+
+/* filter modes - 0-4 match the original bypass values */
+enum ifmg4_modes
+{
+	MG4_LP,				// 24dB lowpass
+	MG4_BYPASS,			// bypass
+	MG4_HP,				// highpass
+	MG4_BP,				// bandpass
+	MG4_OFF,			// disabled - output muted
+	MG4_NOTCH,			// notch
+	MG4_LP12,			// 12dB lowpass
+};
 
 typedef struct {
 	int32_t f, p, q;				// filter coefficients
@@ -16,9 +42,39 @@ typedef struct {
 	uint8_t bypass;					// filter bypass
 } ifmg4_state;
 
+/* stereo version - shared coeffs, L/R state interleaved for block processing */
+typedef struct {
+	int32_t f, p, q;				// filter coefficients
+	int32_t gain;					// DC gain correction
+	int32_t res;					// resonance in S8.23 for modulation
+	uint8_t mode;					// requested filter mode
+	uint8_t bypass;					// active filter mode
+	int32_t b[5][2] DSP_VEC;		// filter buffers, [stage][chl]
+} ifmg4_stereo_state;
+
 void init_ifilter_mg4(ifmg4_state *f);
 void set_ifilter_mg4(ifmg4_state *f, int16_t fc, int16_t res, uint8_t bypass);
 void dupe_ifilter_mg4(ifmg4_state *f1, ifmg4_state *f2);
 int16_t ifilter_mg4(ifmg4_state *f, int16_t input);
+void init_ifilter_mg4_lut(void);
+uint8_t ifilter_mg4_lut_ready(void);
+void init_ifilter_mg4_block(ifmg4_stereo_state *f);
+void set_ifilter_mg4_block(ifmg4_stereo_state *f, int16_t fc, int16_t res, uint8_t bypass);
+void ifilter_mg4_block(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, uint16_t sz);
+void ifilter_mg4_block_mod(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fc, uint16_t sz);
+
+/* per-mode kernels w/o any mode dispatch - caller must handle bypass/off.
+ * The _chl ones run just one channel of the interleaved block. */
+#define IFMG4_KERNEL_PROTOS(name) \
+void ifilter_mg4_block_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, uint16_t sz); \
+void ifilter_mg4_block_mod_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fc, uint16_t sz); \
+void ifilter_mg4_chl_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, uint16_t sz, uint8_t chl); \
+void ifilter_mg4_chl_mod_##name(ifmg4_stereo_state *f, int16_t *dst, int16_t *src, int16_t *fc, uint16_t sz, uint8_t chl);
+
+IFMG4_KERNEL_PROTOS(lp)
+IFMG4_KERNEL_PROTOS(hp)
+IFMG4_KERNEL_PROTOS(bp)
+IFMG4_KERNEL_PROTOS(notch)
+IFMG4_KERNEL_PROTOS(lp12)
 
 #endif
@@ -0,0 +1,241 @@
+/*
+ * jobpool.c - background DSP jobs on core 0
+ * 10-18-26
+ *
+ * Effects post work that's too slow for a block and doesn't need to be in
+ * one - recomputing tables, preparing impulse responses, analysis for the
+ * display - with jobpool_submit(), from init, a task or the audio ISR. A
+ * low priority task on core 0 runs queued jobs highest priority first, in
+ * order of submission within a priority.
+ *
+ * Each job's done callback runs on the audio side from jobpool_complete(),
+ * which the audio callback calls at the start of every block, so an effect
+ * can pick up the results between blocks without any locking of its own.
+ *
+ * Jobs live in a fixed table of slots, each moved through its states with
+ * compare & swap, so submitting never allocates or blocks. Effects must
+ * not outlive their jobs: fx_select_algo() calls jobpool_flush() before
+ * tearing one down.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "jobpool.h"
+#include "place.h"
+
+/* slot states */
+enum jobpool_states
+{
+	JOB_FREE,
+	JOB_CLAIMED,		/* being filled in */
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_DONE,
+	JOB_DELIVERING,		/* done callback running */
+};
+
+typedef struct
+{
+	job_fn run;
+	job_fn done;
+	void *arg;
+	uint32_t seq;			/* submission order */
+	int64_t post_us;
+	uint8_t prio;
+	uint32_t state;
+} jobpool_slot;
+
+static const char *TAG = "jobpool";
+
+static TaskHandle_t jobpool_task_hdl;
+static jobpool_slot jobpool_slots[JOBPOOL_SLOTS];
+static uint32_t jobpool_seq;
+static jobpool_stats jobpool_st;
+
+/*
+ * move a slot from one state to another if nobody beat us to it
+ */
+static inline __attribute__((always_inline)) uint8_t jobpool_move(jobpool_slot *s, uint32_t from, uint32_t to)
+{
+	return __atomic_compare_exchange_n(&s->state, &from, to,
+		0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/*
+ * oldest queued job at the highest priority, or NULL
+ */
+static jobpool_slot *jobpool_next(void)
+{
+	jobpool_slot *s, *best = NULL;
+	uint8_t i;
+	
+	for(i=0;i<JOBPOOL_SLOTS;i++)
+	{
+		s = &jobpool_slots[i];
+		if(__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != JOB_QUEUED)
+			continue;
+		if(!best || (s->prio < best->prio) ||
+			((s->prio == best->prio) && ((int32_t)(s->seq - best->seq) < 0)))
+			best = s;
+	}
+	
+	return best;
+}
+
+/*
+ * worker - runs jobs on core 0 until the queue is empty
+ */
+static void jobpool_task(void *pvParameter)
+{
+	jobpool_slot *s;
+	
+	while(1)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		
+		while((s = jobpool_next()))
+		{
+			/* may have been flushed */
+			if(!jobpool_move(s, JOB_QUEUED, JOB_RUNNING))
+				continue;
+			
+			s->run(s->arg);
+			__atomic_store_n(&s->state, JOB_DONE, __ATOMIC_RELEASE);
+		}
+	}
+}
+
+/*
+ * start the worker
+ */
+esp_err_t jobpool_init(void)
+{
+	if(jobpool_task_hdl)
+		return ESP_OK;
+	
+	if(place_task_create(PL_JOBS, jobpool_task, NULL, &jobpool_task_hdl) != pdPASS)
+		return ESP_FAIL;
+	
+	ESP_LOGI(TAG, "Job pool running on core %d", place_get(PL_JOBS)->core);
+	return ESP_OK;
+}
+
+/*
+ * queue a job - from any task or ISR. done may be NULL.
+ */
+esp_err_t IRAM_ATTR jobpool_submit(uint8_t prio, job_fn run, job_fn done, void *arg)
+{
+	BaseType_t hpw = pdFALSE;
+	jobpool_slot *s;
+	uint8_t i;
+	
+	if(!run || (prio >= JOB_NUM_PRIOS) || !jobpool_task_hdl)
+		return ESP_ERR_INVALID_ARG;
+	
+	/* grab a free slot */
+	for(i=0;i<JOBPOOL_SLOTS;i++)
+		if(jobpool_move(&jobpool_slots[i], JOB_FREE, JOB_CLAIMED))
+			break;
+	if(i == JOBPOOL_SLOTS)
+	{
+		__atomic_fetch_add(&jobpool_st.rejected, 1, __ATOMIC_RELAXED);
+		return ESP_ERR_NO_MEM;
+	}
+	
+	s = &jobpool_slots[i];
+	s->run = run;
+	s->done = done;
+	s->arg = arg;
+	s->prio = prio;
+	s->seq = __atomic_fetch_add(&jobpool_seq, 1, __ATOMIC_RELAXED);
+	s->post_us = esp_timer_get_time();
+	__atomic_fetch_add(&jobpool_st.submitted, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->state, JOB_QUEUED, __ATOMIC_RELEASE);
+	
+	if(xPortInIsrContext())
+		vTaskNotifyGiveFromISR(jobpool_task_hdl, &hpw);
+	else
+		xTaskNotifyGive(jobpool_task_hdl);
+	
+	return ESP_OK;
+}
+
+/*
+ * deliver finished jobs - from the audio callback at the start of a block
+ */
+void IRAM_ATTR jobpool_complete(void)
+{
+	jobpool_slot *s;
+	uint32_t lat;
+	uint8_t i;
+	
+	for(i=0;i<JOBPOOL_SLOTS;i++)
+	{
+		s = &jobpool_slots[i];
+		if(__atomic_load_n(&s->state, __ATOMIC_ACQUIRE) != JOB_DONE)
+			continue;
+		if(!jobpool_move(s, JOB_DONE, JOB_DELIVERING))
+			continue;
+		
+		if(s->done)
+			s->done(s->arg);
+		
+		lat = esp_timer_get_time() - s->post_us;
+		jobpool_st.lat_last = lat;
+		jobpool_st.lat_max = lat > jobpool_st.lat_max ? lat : jobpool_st.lat_max;
+		jobpool_st.completed++;
+		__atomic_store_n(&s->state, JOB_FREE, __ATOMIC_RELEASE);
+	}
+}
+
+/*
+ * drop every job w/o its done callback, waiting out any that's being
+ * filled in, running or delivered - from a task, before the memory jobs
+ * refer to goes away. Each slot is only left once it's free.
+ */
+void jobpool_flush(void)
+{
+	jobpool_slot *s;
+	uint32_t state;
+	uint8_t i;
+	
+	for(i=0;i<JOBPOOL_SLOTS;i++)
+	{
+		s = &jobpool_slots[i];
+		
+		while((state = __atomic_load_n(&s->state, __ATOMIC_ACQUIRE)) != JOB_FREE)
+		{
+			/* not started, or finished & not delivered - drop it */
+			if(((state == JOB_QUEUED) || (state == JOB_DONE)) &&
+				jobpool_move(s, state, JOB_FREE))
+			{
+				jobpool_st.flushed++;
+				break;
+			}
+			
+			/* being submitted, run, or delivered on the audio core */
+			if(state != JOB_QUEUED && state != JOB_DONE)
+				vTaskDelay(1);
+		}
+	}
+}
+
+/*
+ * get throughput & latency
+ */
+const jobpool_stats *jobpool_get_stats(void)
+{
+	return &jobpool_st;
+}
+
+/*
+ * dump stats to the console
+ */
+void jobpool_log(void)
+{
+	ESP_LOGI(TAG, "%"PRIu32" submitted, %"PRIu32" completed, %"PRIu32" rejected, %"PRIu32" flushed",
+		jobpool_st.submitted, jobpool_st.completed, jobpool_st.rejected, jobpool_st.flushed);
+	ESP_LOGI(TAG, "latency us: last %"PRIu32" max %"PRIu32, jobpool_st.lat_last, jobpool_st.lat_max);
+}
@@ -0,0 +1,49 @@
+/*
+ * jobpool.h - background DSP jobs on core 0
+ * 10-18-26
+ */
+
+#ifndef __jobpool__
+#define __jobpool__
+
+#include "main.h"
+
+/* jobs in flight at once */
+#define JOBPOOL_SLOTS 16
+
+/* job priorities - lower runs first */
+enum jobpool_prios
+{
+	JOB_PRIO_HIGH,
+	JOB_PRIO_LOW,
+	JOB_NUM_PRIOS
+};
+
+/*
+ * job body on core 0, or completion on the audio core. Done callbacks run
+ * in the audio ISR so must be IRAM_ATTR - name them fx_*_Done so
+ * tools/check_iram.py checks them.
+ */
+typedef void (*job_fn)(void *arg);
+
+/*
+ * throughput & latency
+ */
+typedef struct
+{
+	uint32_t submitted;
+	uint32_t completed;		/* done callbacks delivered */
+	uint32_t rejected;		/* no free slot */
+	uint32_t flushed;		/* dropped by an effect change */
+	uint32_t lat_last;		/* submit to done callback, us */
+	uint32_t lat_max;
+} jobpool_stats;
+
+esp_err_t jobpool_init(void);
+esp_err_t jobpool_submit(uint8_t prio, job_fn run, job_fn done, void *arg);
+void jobpool_complete(void);
+void jobpool_flush(void);
+const jobpool_stats *jobpool_get_stats(void);
+void jobpool_log(void);
+
+#endif
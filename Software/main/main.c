@@ -13,11 +13,19 @@
 #include "eb_i2s.h"
 #include "eb_adc.h"
 #include "button.h"
+#include "tempo.h"
 #include "audio.h"
 #include "splash.h"
+#include "telem.h"
+#include "memplan.h"
+#include "place.h"
+#include "cpuload.h"
 #ifdef MULTICORE
 #include "multicore_audio.h"
 #endif
+#ifdef BENCHMARK
+#include "bench.h"
+#endif
 
 /* tag for logging */
 static const char *TAG = "main";
@@ -39,6 +47,21 @@ void app_main(void)
 	printf("Build Date: %s\n\r", bdate);
 	printf("Build Time: %s\n\r", btime);
 	printf("\n");
+	place_self(PL_UI);
+	
+#ifdef BENCHMARK
+	/* cycle counts before anything else is running */
+    ESP_LOGI(TAG, "Benchmarks");
+	bench_run();
+#endif
+	
+	/* reserve real-time buffers before anything else touches the heap */
+    ESP_LOGI(TAG, "Reserve memory");
+	memplan_init();
+	
+	/* measure CPU load from here on */
+    ESP_LOGI(TAG, "Start load monitor");
+	cpuload_init();
 	
 	/* init ADC */
     ESP_LOGI(TAG, "Init ADC");
@@ -63,6 +86,10 @@ void app_main(void)
     ESP_LOGI(TAG, "Init button");
 	button_init();
 	
+	/* sync input */
+    ESP_LOGI(TAG, "Init sync");
+	tempo_init();
+	
 	/* init the touch ring to run in background */
     ESP_LOGI(TAG, "Start Touch Ring handler");
 	touch_ring_init();
@@ -86,6 +113,13 @@ void app_main(void)
     ESP_LOGI(TAG, "Init menu");
 	menu_init();
 	
+	/* everything is allocated from here on */
+	memplan_lock();
+	
+	/* everything is running - check it's where it should be */
+	place_report();
+	place_check();
+	
 	/* report buffer info */
 	//i2s_diag();
 	
@@ -94,6 +128,7 @@ void app_main(void)
     while(1)
 	{
 		menu_update();
+		memplan_check();
 		
         vTaskDelay(pdMS_TO_TICKS(20));
     }
@@ -13,8 +13,20 @@
 #include "esp_err.h"
 #include "esp_timer.h"
 
-/* uncomment this for multicore audio */
+/* multicore audio - set in menuconfig */
+#include "sdkconfig.h"
+#ifdef CONFIG_S3GTA_MULTICORE
 #define MULTICORE
+#endif
+
+/* uncomment this to log DSP benchmarks at startup */
+//#define BENCHMARK
+
+/* abort on heap allocations after boot from the audio side - set in
+ * menuconfig, off by default so they're only counted */
+#ifdef CONFIG_S3GTA_MEMPLAN_STRICT
+#define MEMPLAN_STRICT
+#endif
 
 typedef float float32_t;
 
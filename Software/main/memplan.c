@@ -0,0 +1,205 @@
+/*
+ * memplan.c - boot-time plan for real-time buffers
+ * 10-18-26
+ *
+ * Every buffer the audio, LCD and DMA paths need for the life of the
+ * firmware is listed in one table with its size, alignment and heap
+ * capabilities, and all of them are reserved together at boot before
+ * anything else can fragment the heaps. Modules pick up their region with
+ * memplan_get() when they init.
+ *
+ * Once startup is done memplan_lock() prints the memory map, and from then
+ * on the heap hooks count any allocation on either core. The main loop
+ * reports them with memplan_check(). With MEMPLAN_STRICT, off unless
+ * S3GTA_MEMPLAN_STRICT is set, one from the audio core or any ISR aborts
+ * instead. Tasks
+ * on core 0 are only counted - NVS saves and newlib's float formatting
+ * allocate internally there, and aborting a settings save would be worse
+ * than the allocation.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_cpu.h"
+#include "memplan.h"
+#include "fx.h"
+#include "bufclr.h"
+#include "gc9a01_drvr.h"
+#include "dsp_align.h"
+#include "place.h"
+
+static const char *TAG = "memplan";
+
+typedef struct
+{
+	const char *name;
+	size_t sz;				/* bytes or MEMPLAN_REST */
+	size_t align;
+	uint32_t caps;
+} memplan_region;
+
+/*
+ * the plan - most constrained capabilities first
+ */
+static const memplan_region memplan[MP_NUM_REGIONS] =
+{
+	{"lcd_draw",	GC9A01_BUFSZ*sizeof(uint16_t),	DSP_VEC_ALIGN,	MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL},
+	{"bufclr_zero",	BUFCLR_CHUNK,					BUFCLR_ALIGN,	MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL},
+	{"fx_mem",		FX_MAX_MEM,						DSP_VEC_ALIGN,	MALLOC_CAP_INTERNAL},
+	{"fx_ext",		MEMPLAN_REST,					BUFCLR_ALIGN,	MALLOC_CAP_SPIRAM},
+};
+
+/* reserved addresses & actual sizes */
+static void *memplan_addr[MP_NUM_REGIONS];
+static size_t memplan_sz[MP_NUM_REGIONS];
+
+/* allocations seen after lock, per core */
+static uint8_t memplan_locked;
+static volatile uint32_t memplan_late[2];
+static volatile size_t memplan_late_sz;
+static volatile uint32_t memplan_late_caps;
+static uint32_t memplan_late_rpt[2];
+
+/*
+ * reserve everything in the plan - call first thing at boot
+ */
+esp_err_t memplan_init(void)
+{
+	const memplan_region *r;
+	esp_err_t ret = ESP_OK;
+	size_t sz;
+	uint8_t i;
+	
+	for(i=0;i<MP_NUM_REGIONS;i++)
+	{
+		r = &memplan[i];
+		sz = r->sz;
+		if(sz == MEMPLAN_REST)
+		{
+			/* leave room to align */
+			sz = heap_caps_get_largest_free_block(r->caps);
+			sz = sz > r->align ? (sz - r->align) & ~(r->align-1) : 0;
+		}
+		
+		memplan_addr[i] = sz ? heap_caps_aligned_calloc(r->align, 1, sz, r->caps) : NULL;
+		if(memplan_addr[i])
+			memplan_sz[i] = sz;
+		else
+		{
+			ESP_LOGW(TAG, "Failed reserving %d bytes for %s", sz, r->name);
+			memplan_sz[i] = 0;
+			ret = ESP_ERR_NO_MEM;
+		}
+	}
+	
+	return ret;
+}
+
+/*
+ * get a planned region & optionally its size
+ */
+void *memplan_get(uint8_t id, size_t *sz)
+{
+	if(id >= MP_NUM_REGIONS)
+		return NULL;
+	
+	if(sz)
+		*sz = memplan_sz[id];
+	return memplan_addr[id];
+}
+
+/*
+ * describe heap capabilities for the map
+ */
+static const char *memplan_caps_name(uint32_t caps)
+{
+	if(caps & MALLOC_CAP_SPIRAM)
+		return "psram";
+	else if(caps & MALLOC_CAP_DMA)
+		return "int dma";
+	else
+		return "int";
+}
+
+/*
+ * end of boot - print the map & start watching for allocations
+ */
+void memplan_lock(void)
+{
+	uint8_t i;
+	
+	ESP_LOGI(TAG, "Memory map:");
+	for(i=0;i<MP_NUM_REGIONS;i++)
+		ESP_LOGI(TAG, "  %-12s %p %8d %-8s align %d", memplan[i].name, memplan_addr[i],
+			memplan_sz[i], memplan_caps_name(memplan[i].caps), memplan[i].align);
+	ESP_LOGI(TAG, "Heap left: int %d (largest %d), dma %d, psram %d",
+		heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+		heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL),
+		heap_caps_get_free_size(MALLOC_CAP_DMA),
+		heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+	
+#ifdef CONFIG_HEAP_USE_HOOKS
+	memplan_late_rpt[0] = memplan_late[0];
+	memplan_late_rpt[1] = memplan_late[1];
+	memplan_locked = 1;
+	ESP_LOGI(TAG, "Locked - no more heap allocations expected");
+#else
+	ESP_LOGW(TAG, "CONFIG_HEAP_USE_HOOKS not set - late allocations won't be caught");
+#endif
+}
+
+/*
+ * number of heap allocations on a core since lock
+ */
+uint32_t memplan_late_allocs(uint8_t core)
+{
+	return core < 2 ? memplan_late[core] : 0;
+}
+
+/*
+ * report any new late allocations - from the main loop
+ */
+void memplan_check(void)
+{
+	uint8_t i;
+	
+	for(i=0;i<2;i++)
+	{
+		if(memplan_late[i] != memplan_late_rpt[i])
+		{
+			ESP_LOGW(TAG, "%"PRIu32" heap allocations on core %d after boot, last %d bytes caps 0x%"PRIx32,
+				memplan_late[i] - memplan_late_rpt[i], i, memplan_late_sz, memplan_late_caps);
+			memplan_late_rpt[i] = memplan_late[i];
+		}
+	}
+}
+
+#ifdef CONFIG_HEAP_USE_HOOKS
+/*
+ * heap hooks - called by the heap on every malloc/free on either core,
+ * possibly w/ the cache disabled
+ */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+	if(!memplan_locked)
+		return;
+	
+#ifdef MEMPLAN_STRICT
+	/* the real-time side must never touch the heap */
+	if(xPortInIsrContext())
+		abort();
+#ifdef MULTICORE
+	if(esp_cpu_get_core_id() == PLACE_AUDIO_CORE)
+		abort();
+#endif
+#endif
+	memplan_late[esp_cpu_get_core_id()]++;
+	memplan_late_sz = size;
+	memplan_late_caps = caps;
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif
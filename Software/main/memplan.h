@@ -0,0 +1,39 @@
+/*
+ * memplan.h - boot-time plan for real-time buffers
+ * 10-18-26
+ *
+ * Limitation: the plan is only guaranteed for what's in the table. The
+ * heap stays open after memplan_lock() and the hooks can only see an
+ * allocation once it's been made, not stop it. With MEMPLAN_STRICT
+ * (S3GTA_MEMPLAN_STRICT in menuconfig) one from the audio core or an ISR
+ * aborts, so the first one fails loudly. Core 0 tasks are only counted, on the telemetry page and
+ * in the log, since IDF's NVS and newlib allocate there on their own.
+ */
+
+#ifndef __memplan__
+#define __memplan__
+
+#include "main.h"
+
+/* size for a region that takes the largest block left */
+#define MEMPLAN_REST 0
+
+/*
+ * planned regions, in allocation order
+ */
+enum memplan_regions
+{
+	MP_LCD_DRAW,
+	MP_BUFCLR_ZERO,
+	MP_FX_MEM,
+	MP_FX_EXT,
+	MP_NUM_REGIONS
+};
+
+esp_err_t memplan_init(void);
+void *memplan_get(uint8_t id, size_t *sz);
+void memplan_lock(void);
+uint32_t memplan_late_allocs(uint8_t core);
+void memplan_check(void);
+
+#endif
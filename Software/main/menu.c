@@ -4,6 +4,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <math.h>
 #include "main.h"
 #include "nvs_flash.h"
@@ -19,6 +20,13 @@
 #include "dsp_lib.h"
 #include "eb_i2s.h"
 #include "touch_ring.h"
+#include "telem.h"
+#include "memplan.h"
+#include "cpuload.h"
+#include "telring.h"
+#include "cvcal.h"
+#include "tempo.h"
+#include "place.h"
 #ifdef MULTICORE
 #include "multicore_audio.h"
 #endif
@@ -26,7 +34,10 @@
 #define MENU_INTERVAL 50000
 #define MENU_MAX_PARAMS (FX_MAX_PARAMS+1)
 #define MENU_VU_WIDTH 50
-#define MENU_NUMBTNS 2
+#define MENU_NUMBTNS 3
+#define MENU_LOAD_DIV 4
+#define MENU_PLACE_DIV 20
+#define MENU_GRAPH_WIDTH (CPULOAD_HIST+2)
 
 enum save_flags
 {
@@ -35,18 +46,42 @@ enum save_flags
 	SAVE_ALGO = 4,
 };
 
+enum menu_pages
+{
+	MENU_PG_MAIN,
+	MENU_PG_TELEM,
+	MENU_PG_LOAD,
+	MENU_PG_CAL,
+	MENU_NUM_PAGES,
+};
+
 static const char* TAG = "menu";
 static int16_t menu_item_values[FX_NUM_ALGOS][MENU_MAX_PARAMS];
-static uint8_t menu_reset, menu_act_item, menu_save_mask;
+static uint8_t menu_reset, menu_act_item, menu_save_mask, menu_page, menu_load_cnt, menu_place_cnt;
 static uint8_t menu_value_scoreboard[FX_NUM_ALGOS];
 static uint16_t menu_algo, menu_save_counter;
 static uint64_t menu_time;
 static char txtbuf[32];
 static btn_widg menu_btns[MENU_NUMBTNS];
+
+/* CV calibration - channel, reference & a slow average of the reading */
+static uint8_t menu_cal_chl, menu_cal_step;
+static int32_t menu_cal_acc;
+
+/* NVS stays open so saves don't allocate */
+static nvs_handle_t menu_nvs;
+static uint8_t menu_nvs_ok;
 static const char *btn_names[MENU_NUMBTNS] =
 {
 	"<",
 	">",
+	"pg",
+};
+static const float btn_angles[MENU_NUMBTNS] =
+{
+	-3.1416F/5.0F,
+	3.1416F/5.0F,
+	4.0F*3.1416F/5.0F,
 };
 
 /*
@@ -56,6 +91,9 @@ esp_err_t menu_load_state(void)
 {
 	uint8_t i,j, commit=0;
 	
+	/* audio is already running - PSRAM effects fade out till it's done */
+	fx_flash_begin();
+	
     /* Initialize NVS */
     esp_err_t err = nvs_flash_init();
     if(err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND)
@@ -70,8 +108,7 @@ esp_err_t menu_load_state(void)
 
 	/* Open NVS */
     ESP_LOGI(TAG, "menu_load_values: Opening NVS");
-    nvs_handle_t my_handle;
-    err = nvs_open("storage", NVS_READWRITE, &my_handle);
+    err = nvs_open("storage", NVS_READWRITE, &menu_nvs);
     if(err != ESP_OK)
 	{
         ESP_LOGW(TAG, "menu_load_values: Error (%s) opening NVS", esp_err_to_name(err));
@@ -80,29 +117,29 @@ esp_err_t menu_load_state(void)
 	{
 		/* get algo */
 		menu_algo = 0;
-		err = nvs_get_u16(my_handle, "menu_algo", &menu_algo);
+		err = nvs_get_u16(menu_nvs, "menu_algo", &menu_algo);
 		ESP_LOGI(TAG, "menu_load_state: menu_algo = %d, err = %s", menu_algo, esp_err_to_name(err));
 		if(err == ESP_ERR_NVS_NOT_FOUND)
 		{
 			ESP_LOGI(TAG, "created menu_algo = %d, err = %s", menu_algo, esp_err_to_name(err));
-			err = nvs_set_u16(my_handle, "menu_algo", menu_algo);
+			err = nvs_set_u16(menu_nvs, "menu_algo", menu_algo);
 			commit = 1;
 		}
 		else if(menu_algo >= FX_NUM_ALGOS)
 		{
 			ESP_LOGI(TAG, "Bad menu_algo = %d, resetting to 0", menu_algo);
 			menu_algo = 0;
-			err = nvs_set_u16(my_handle, "menu_algo", menu_algo);
+			err = nvs_set_u16(menu_nvs, "menu_algo", menu_algo);
 			commit = 1;
 		}
 		
 		/* get active item */
 		menu_act_item = 0;
-		err = nvs_get_u8(my_handle, "menu_act_item", &menu_act_item);
+		err = nvs_get_u8(menu_nvs, "menu_act_item", &menu_act_item);
 		ESP_LOGI(TAG, "menu_load_state: menu_act_item = %d, err = %s", menu_act_item, esp_err_to_name(err));
 		if(err == ESP_ERR_NVS_NOT_FOUND)
 		{
-			err = nvs_set_u8(my_handle, "menu_act_item", menu_act_item);
+			err = nvs_set_u8(menu_nvs, "menu_act_item", menu_act_item);
 			ESP_LOGI(TAG, "created menu_act_item = %d, err = %s", menu_act_item, esp_err_to_name(err));
 			commit = 1;
 		}
@@ -115,11 +152,11 @@ esp_err_t menu_load_state(void)
 			{
 				int16_t raw_param = 0;
 				sprintf(txtbuf, "pvalues_%2d_%2d", i, j);
-				err = nvs_get_i16(my_handle, txtbuf, &raw_param);
+				err = nvs_get_i16(menu_nvs, txtbuf, &raw_param);
 				//ESP_LOGI(TAG, "get: %s = %d, err = %s", txtbuf, raw_param, esp_err_to_name(err));
 				if(err == ESP_ERR_NVS_NOT_FOUND)
 				{
-					err = nvs_set_i16(my_handle, txtbuf, raw_param);
+					err = nvs_set_i16(menu_nvs, txtbuf, raw_param);
 					ESP_LOGI(TAG, "created: %s = %d, err = %s", txtbuf, raw_param, esp_err_to_name(err));
 					commit = 1;
 				}
@@ -129,13 +166,14 @@ esp_err_t menu_load_state(void)
 		
 		if(commit)
 		{
-			err = nvs_commit(my_handle);
+			err = nvs_commit(menu_nvs);
 			ESP_LOGI(TAG, "commit: err = %s", esp_err_to_name(err));
 		} 
 		
-        nvs_close(my_handle);
+		menu_nvs_ok = 1;
 	}
 
+	fx_flash_end();
 	return ESP_OK;
 }
 
@@ -145,29 +183,32 @@ esp_err_t menu_load_state(void)
 void menu_save_state(void)
 {
 	esp_err_t err;
+	uint32_t xruns = i2s_get_xruns();
+	int64_t t = esp_timer_get_time();
 
-	/* Open NVS */
-    nvs_handle_t my_handle;
-    err = nvs_open("storage", NVS_READWRITE, &my_handle);
-    if(err != ESP_OK)
+	/* NVS opened at load */
+    if(!menu_nvs_ok)
 	{
-        ESP_LOGW(TAG, "menu_save_value: Error (%s) opening NVS", esp_err_to_name(err));
+        ESP_LOGW(TAG, "menu_save_value: NVS not open");
     }
 	else
 	{
 		//ESP_LOGI(TAG, "menu_save_value: Success Opening NVS");
 		
+		/* PSRAM effects fade out until it's written */
+		fx_flash_begin();
+		
 		/* algo */
 		if(menu_save_mask & SAVE_ALGO)
 		{
-			err = nvs_set_u16(my_handle, "menu_algo", menu_algo);
+			err = nvs_set_u16(menu_nvs, "menu_algo", menu_algo);
 			//ESP_LOGI(TAG, "set menu_algo = %d, err = %s", menu_algo, esp_err_to_name(err));
 		}
 		
 		/* active param */
 		if(menu_save_mask & SAVE_ACT)
 		{
-			err = nvs_set_u8(my_handle, "menu_act_item", menu_act_item);
+			err = nvs_set_u8(menu_nvs, "menu_act_item", menu_act_item);
 			//ESP_LOGI(TAG, "set menu_act_item = %d, err = %s", menu_act_item, esp_err_to_name(err));
 		}
 		
@@ -182,7 +223,7 @@ void menu_save_state(void)
 					if(menu_value_scoreboard[i] & (1<<j))
 					{
 						sprintf(txtbuf, "pvalues_%2d_%2d", i, j);
-						err = nvs_set_i16(my_handle, txtbuf, menu_item_values[i][j]);
+						err = nvs_set_i16(menu_nvs, txtbuf, menu_item_values[i][j]);
 						//ESP_LOGI(TAG, "set %s = %d, err = %s", txtbuf, menu_item_values[i][j], esp_err_to_name(err));
 					}
 				}
@@ -193,13 +234,157 @@ void menu_save_state(void)
 		menu_save_mask = 0;
 		
         // Commit written value.
-        err = nvs_commit(my_handle);
+        err = nvs_commit(menu_nvs);
         //ESP_LOGI(TAG, "commit: %s", esp_err_to_name(err));
+		fx_flash_end();
+		if(err != ESP_OK)
+			ESP_LOGW(TAG, "menu_save_state: commit error %s", esp_err_to_name(err));
 		
-        nvs_close(my_handle);
+		/* audio must ride through flash writes w/o dropouts */
+		ESP_LOGI(TAG, "menu_save_state: %lld us, %"PRIu32" audio xruns",
+			esp_timer_get_time() - t, i2s_get_xruns() - xruns);
+	}
+}
+
+/*
+ * periodic updates to telemetry page
+ */
+static void menu_telem_update(void)
+{
+	const telem_info *t;
+	uint8_t i;
+	
+	telem_update();
+	t = telem_get();
+	
+	/* heaps in kB */
+	sprintf(txtbuf, "int   %4d %4d", (int)(t->internal.free>>10), (int)(t->internal.min_free>>10));
+	gfx_drawstr(40, 90, txtbuf);
+	sprintf(txtbuf, "psram %4d %4d", (int)(t->psram.free>>10), (int)(t->psram.min_free>>10));
+	gfx_drawstr(40, 100, txtbuf);
+	sprintf(txtbuf, "dma   %4d %4d", (int)(t->dma.free>>10), (int)(t->dma.min_free>>10));
+	gfx_drawstr(40, 110, txtbuf);
+	
+	/* static sections in kB */
+	sprintf(txtbuf, "iram %3dk dram %3dk", (int)(t->iram>>10), (int)(t->dram>>10));
+	gfx_drawstr(40, 120, txtbuf);
+	
+	/* arena peak for this effect */
+	sprintf(txtbuf, "arena %6d/%d", (int)t->arena[fx_get_algo()], FX_MAX_MEM);
+	gfx_drawstr(40, 130, txtbuf);
+	
+	/* heap allocations since boot finished */
+	sprintf(txtbuf, "late alloc %3d %3d", (int)memplan_late_allocs(0), (int)memplan_late_allocs(1));
+	gfx_drawstr(40, 140, txtbuf);
+	
+	/* stack headroom, two per line */
+	for(i=0;i<t->num_tasks;i++)
+	{
+		sprintf(txtbuf, "%-5.5s%5d", t->tasks[i].name, (int)t->tasks[i].headroom);
+		gfx_drawstr(40+80*(i&1), 150+10*(i>>1), txtbuf);
+	}
+}
+
+/*
+ * one core's load & its graph
+ */
+static void menu_load_core(const cpuload_info *c, uint8_t core, int16_t y)
+{
+	uint16_t isr = c->audio[core] + c->isr[core] + c->other[core];
+	
+	sprintf(txtbuf, "c%d %3d.%d%% isr%3d.%d%%", core, c->load[core]/10, c->load[core]%10,
+		isr/10, isr%10);
+	gfx_drawstr(40, y, txtbuf);
+	gfx_set_forecolor(core ? GFX_RED : GFX_GREEN);
+	widg_graph(120-MENU_GRAPH_WIDTH/2, y+10, MENU_GRAPH_WIDTH, 30, c->hist[core],
+		CPULOAD_HIST, c->hist_idx);
+	gfx_set_forecolor(GFX_WHITE);
+}
+
+/*
+ * periodic updates to load page
+ */
+static void menu_load_update(void)
+{
+	const cpuload_info *c = cpuload_get();
+	const cpuload_task *t;
+	uint8_t i;
+	
+	menu_load_core(c, 0, 50);
+	menu_load_core(c, 1, 95);
+	
+	/* busiest tasks */
+	for(i=0;i<3;i++)
+	{
+		if(i < c->num_tasks)
+		{
+			t = &c->tasks[i];
+			sprintf(txtbuf, "%-10.10s %c %3d.%d%%", t->name, t->core == 0 ? '0' :
+				(t->core == 1 ? '1' : '*'), t->load/10, t->load%10);
+		}
+		else
+			sprintf(txtbuf, "%20s", "");
+		gfx_drawstr(40, 145+10*i, txtbuf);
 	}
 }
 
+/*
+ * start calibrating a channel from the first reference
+ */
+static void menu_cal_start(uint8_t chl)
+{
+	menu_cal_chl = chl;
+	menu_cal_step = 0;
+	menu_cal_acc = adc_avg[chl]<<3;
+}
+
+/*
+ * periodic updates to calibration page
+ */
+static void menu_cal_update(void)
+{
+	int16_t mv;
+	uint8_t i;
+	
+	/* 8 tick average to steady the reading */
+	menu_cal_acc += adc_avg[menu_cal_chl] - (menu_cal_acc>>3);
+	
+	mv = cvcal_ref_mv(menu_cal_step);
+	sprintf(txtbuf, "CV%d: apply %d.%03dV ", menu_cal_chl+1, mv/1000, mv%1000);
+	gfx_drawstr(40, 70, txtbuf);
+	sprintf(txtbuf, "step %d/%d raw %4d", menu_cal_step+1, CVCAL_REFS, (int)(menu_cal_acc>>3));
+	gfx_drawstr(40, 80, txtbuf);
+	
+	/* all channels as they read now */
+	for(i=0;i<ADC_NUMVALS;i++)
+	{
+		mv = adc_mv[i];
+		sprintf(txtbuf, "CV%d %4d %c%d.%03dV %c", i+1, adc_avg[i], mv < 0 ? '-' : ' ',
+			abs(mv)/1000, abs(mv)%1000, cvcal_is_cal(i) ? '*' : ' ');
+		gfx_drawstr(40, 110+10*i, txtbuf);
+	}
+}
+
+/*
+ * calibration page buttons - > captures the reference, < skips to the
+ * next channel. The last reference checks & saves the channel.
+ */
+static void menu_cal_button(uint8_t btn)
+{
+	if(btn == 1)
+	{
+		cvcal_capture(menu_cal_chl, menu_cal_step, menu_cal_acc>>3);
+		if(++menu_cal_step < CVCAL_REFS)
+			return;
+		
+		gfx_drawstr(40, 160, cvcal_commit(menu_cal_chl) == ESP_OK ? "saved      " : "failed     ");
+	}
+	else
+		gfx_drawstr(40, 160, "           ");
+	
+	menu_cal_start((menu_cal_chl + 1) % ADC_NUMVALS);
+}
+
 /*
  * periodic menu updates to dynamic stuff
  */
@@ -207,22 +392,35 @@ void menu_timer_callback(void)
 {
 	uint8_t i;
 	
+	/* telemetry page has its own display */
+	if(menu_page == MENU_PG_TELEM)
+		menu_telem_update();
+	else if(menu_page == MENU_PG_CAL)
+		menu_cal_update();
+	
+	/* CPU load history keeps rolling on every page */
+	if(++menu_load_cnt >= MENU_LOAD_DIV)
+	{
+		menu_load_cnt = 0;
+		cpuload_update();
+		if(menu_page == MENU_PG_LOAD)
+			menu_load_update();
+	}
+	
+	/* keep watching for tasks that land on the audio core */
+	if(++menu_place_cnt >= MENU_PLACE_DIV)
+	{
+		menu_place_cnt = 0;
+		place_poll();
+	}
+	
 	/* update load */
 	gfx_set_forecolor(GFX_WHITE);
-#ifdef MULTICORE
-	uint64_t period = mc_period;
-	uint64_t duration = mc_duration;
-#else
-	uint64_t period = audio_load[0] - audio_load[2];
-	uint64_t duration = audio_load[1] - audio_load[0];
-#endif
-	uint64_t load;
 	
 	/* update load indicator */
-	if(period != 0)
+	if(telring_drain() && (menu_page == MENU_PG_MAIN))
 	{
-		load = 100*duration/period;
-		sprintf(txtbuf, "%2llu%% ", load);
+		sprintf(txtbuf, "%2d%% ", telring_get()->load/10);
 		gfx_drawstr(80, 80, txtbuf);
 	}
 	
@@ -235,18 +433,25 @@ void menu_timer_callback(void)
 		{
 			ESP_LOGI(TAG, "menu_timer_callback: Saving State");
 			menu_save_state();
-			gfx_set_forecolor(GFX_GREEN);
-			gfx_fillcircle(196, 83, 3);
-			gfx_set_forecolor(GFX_WHITE);
+			if(menu_page == MENU_PG_MAIN)
+			{
+				gfx_set_forecolor(GFX_GREEN);
+				gfx_fillcircle(196, 83, 3);
+				gfx_set_forecolor(GFX_WHITE);
+			}
 		}
 	}
 	
 	/* update algo params */
 	for(i=1;i<4;i++)
-	{
 		menu_item_values[menu_algo][i] = adc_param[i];
+	
+	/* rest is main page only */
+	if(menu_page != MENU_PG_MAIN)
+		return;
+	
+	for(i=1;i<4;i++)
 		fx_render_parm(i);
-	}
 	
 	/* update mix */
 	widg_sliderH(70, 130, 100, 8, adc_val[0]/41);
@@ -268,9 +473,12 @@ void menu_sched_save(uint8_t mask)
 	if(mask & SAVE_VALUE)
 		menu_value_scoreboard[menu_algo] |= 1<<menu_act_item;
 	menu_save_counter = 5000000/MENU_INTERVAL;	 // 5 sec
-	gfx_set_forecolor(GFX_RED);
-	gfx_fillcircle(196, 83, 3);
-	gfx_set_forecolor(GFX_WHITE);
+	if(menu_page == MENU_PG_MAIN)
+	{
+		gfx_set_forecolor(GFX_RED);
+		gfx_fillcircle(196, 83, 3);
+		gfx_set_forecolor(GFX_WHITE);
+	}
 }
 
 /*
@@ -284,6 +492,49 @@ void menu_render(void)
 	/* set constants */
 	gfx_set_forecolor(GFX_WHITE);
 	
+	/* telemetry page */
+	if(menu_reset && (menu_page == MENU_PG_TELEM))
+	{
+		menu_reset = 0;
+		
+		/* title & algo name */
+		gfx_drawstrctr(120, 30, "Telemetry");
+		rect.x0 = 40;
+		rect.y0 = 70;
+		rect.x1 = 200;
+		rect.y1 = rect.y0+7;
+		gfx_clrrect(&rect);
+		sprintf(txtbuf, "Algo: %s", fx_get_algo_name());
+		txtbuf[20] = 0;	// max 20 chars 
+		gfx_drawstr(40, 70, txtbuf);
+		
+		/* labels */
+		gfx_drawstr(40, 80, "heap  free  min");
+		gfx_drawstr(40, 140, "stack free");
+	}
+	
+	/* CPU load page */
+	if(menu_reset && (menu_page == MENU_PG_LOAD))
+	{
+		menu_reset = 0;
+		gfx_drawstrctr(120, 30, "CPU Load");
+		
+		/* untimed ISRs that hit idle still read as idle */
+		gfx_drawstr(40, 180, "isr: audio,adc,sync");
+		gfx_drawstr(40, 190, "timed, rest a floor");
+		menu_load_update();
+	}
+	
+	/* CV calibration page */
+	if(menu_reset && (menu_page == MENU_PG_CAL))
+	{
+		menu_reset = 0;
+		gfx_drawstrctr(120, 30, "CV Cal");
+		gfx_drawstr(40, 90, "> capture < next CV");
+		menu_cal_start(0);
+		menu_cal_update();
+	}
+	
 	/* refresh static items */
 	if(menu_reset)
 	{
@@ -371,6 +622,9 @@ void menu_init(void)
 	ESP_LOGI(TAG, "menu_init: try to load state...");
 	menu_load_state();
 	ESP_LOGI(TAG, "menu_init: state loaded.");
+	
+	/* CV calibration is in NVS too */
+	cvcal_init();
 #ifdef MULTICORE
 			multicore_audio_select_algo(menu_algo);
 #else
@@ -383,7 +637,7 @@ void menu_init(void)
 	for(i=0;i<MENU_NUMBTNS;i++)
 	{
 		/* create button @ circular location */
-		th = (i*2-1) * 3.1416F/5.0F;
+		th = btn_angles[i];
 		btn_min[i] = th - .31416F;
 		btn_max[i] = th + .31416F;
 		//printf("%d, %8.4f, %8.4f\n", i, btn_min[i], btn_max[i]);
@@ -404,10 +658,11 @@ void menu_init(void)
 	widg_gradient_init(MENU_VU_WIDTH);
 	
 	/* initial draw of menu */
+	menu_page = MENU_PG_MAIN;
 	gfx_clrscreen();
 	menu_render();
-	widg_button_render(&menu_btns[0], 0);
-	widg_button_render(&menu_btns[1], 0);
+	for(i=0;i<MENU_NUMBTNS;i++)
+		widg_button_render(&menu_btns[i], 0);
 
 	/* set time for next update */
 	menu_time = esp_timer_get_time() + MENU_INTERVAL;
@@ -418,7 +673,7 @@ void menu_init(void)
  */
 void menu_update(void)
 {
-	uint8_t state, re, fe;
+	uint8_t state, re, fe, i;
 	float val;
 	
 	/* virtual buttons */
@@ -442,7 +697,9 @@ void menu_update(void)
 			//printf("button %d off\n", fe);
 			
 			/* update menu_algo */
-			if(fe == 1)
+			if((menu_page == MENU_PG_CAL) && (fe != 2))
+				menu_cal_button(fe);
+			else if(fe == 1)
 			{
 				if(menu_algo < FX_NUM_ALGOS-1)
 					menu_algo++;
@@ -451,6 +708,25 @@ void menu_update(void)
 			{
 				if(menu_algo > 0)
 					menu_algo--;
+			}
+			else if(fe == 2)
+			{
+				/* next page */
+				menu_page = (menu_page + 1) % MENU_NUM_PAGES;
+				gfx_clrscreen();
+				menu_reset = 1;
+				menu_render();
+				for(i=0;i<MENU_NUMBTNS;i++)
+					widg_button_render(&menu_btns[i], 0);
+				if(menu_page == MENU_PG_TELEM)
+				{
+					telem_update();
+					telem_log();
+					telring_log();
+					tempo_log();
+				}
+				else if(menu_page == MENU_PG_LOAD)
+					cpuload_log();
 			}	
 		}
 		
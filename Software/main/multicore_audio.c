@@ -3,15 +3,33 @@
  * 12-28-24 E. Brombaugh
  */
 
+#include <string.h>
 #include "main.h"
 #include "audio.h"
 #include "fx.h"
+#include "place.h"
+#include "fork.h"
 
 /* tag for logging */
 static const char *TAG = "multicore_audio";
 
 uint8_t request_algo;
-uint64_t mc_duration, mc_period;
+
+/* 2-stage pipeline - 1st stage output for this block & the last one */
+static int16_t mc_pipe_mid[2][2*FRAMESZ] DSP_VEC;
+static uint8_t mc_pipe_idx;
+
+/* 2nd stage output - only copied out if it made the deadline */
+static int16_t mc_pipe_out[2*FRAMESZ] DSP_VEC;
+
+/* 2nd stage job */
+static struct
+{
+	const fx_struct *e;
+	void *blk;
+	int16_t *dst, *src;
+	uint16_t sz;
+} mc_pipe_job;
 
 /*
  * Audio Task - runs on 2nd core
@@ -30,10 +48,6 @@ void audio_task( void * pvParameters )
 		if(request_algo != fx_get_algo())
 			fx_select_algo(request_algo);
 		
-		/* update CPU load */
-		mc_period = audio_load[0] - audio_load[2];
-		mc_duration = audio_load[1] - audio_load[0];
-		
 		/* pass some time */
 		vTaskDelay(pdMS_TO_TICKS(20));
 	}
@@ -47,23 +61,59 @@ void multicore_audio_init(void)
 	/* init algo request */
 	request_algo = 0;
 	
+	/* core 0 worker for effects that split blocks */
+	fork_init();
+	
 	/* start audio task on 2nd core */
-	int32_t pvParameters = 0;
-	TaskHandle_t pxCreatedTask;
-	BaseType_t task_result = xTaskCreatePinnedToCore(
-		audio_task,			// task function
-		"audio_task",		// name
-		8192,				// stack size
-		&pvParameters,		// parameters to task
-		1,					// priority
-		&pxCreatedTask,		// handle to task
-		1					// core #
-	);
-	if(task_result != pdPASS)
-		ESP_LOGW(TAG, "Error creating audio task: %d", task_result);
-	else
+	if(place_task_create(PL_AUDIO, audio_task, NULL, NULL) == pdPASS)
 		ESP_LOGI(TAG, "Created audio task");
+}
 
+/*
+ * 2nd stage - on core 0
+ */
+static void IRAM_ATTR mc_pipe_stage_b(void *arg)
+{
+	mc_pipe_job.e->proc_b(mc_pipe_job.blk, mc_pipe_job.dst, mc_pipe_job.src, mc_pipe_job.sz);
+}
+
+/*
+ * run a 2-stage effect as a pipeline - core 0 finishes the last block
+ * while this core starts on the current one, so the output is a block
+ * late. From the audio ISR. If the 2nd stage misses its deadline the block
+ * is silent, and this block's 1st stage output is dropped so it doesn't
+ * overwrite what core 0 is still reading.
+ */
+void IRAM_ATTR multicore_pipe_proc(const fx_struct *e, void *blk, int16_t *dst, int16_t *src, uint16_t sz)
+{
+	/* 2nd stage of the last block */
+	mc_pipe_job.e = e;
+	mc_pipe_job.blk = blk;
+	mc_pipe_job.dst = mc_pipe_out;
+	mc_pipe_job.src = mc_pipe_mid[mc_pipe_idx^1];
+	mc_pipe_job.sz = sz;
+	fork_run(mc_pipe_stage_b, NULL);
+	
+	/* 1st stage of this block */
+	e->proc(blk, mc_pipe_mid[mc_pipe_idx], src, sz);
+	
+	/* swap halves once both are done */
+	if(fork_join() != ESP_OK)
+	{
+		memset(dst, 0, 2*sz*sizeof(int16_t));
+		return;
+	}
+	memcpy(dst, mc_pipe_out, 2*sz*sizeof(int16_t));
+	mc_pipe_idx ^= 1;
+}
+
+/*
+ * clear the pipeline when the effect changes
+ */
+void multicore_pipe_reset(void)
+{
+	memset(mc_pipe_mid, 0, sizeof(mc_pipe_mid));
+	mc_pipe_idx = 0;
 }
 
 /*
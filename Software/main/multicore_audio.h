@@ -6,10 +6,11 @@
 #ifndef __multicore_audio__
 #define __multicore_audio__
 
-/* CPU loading stats */
-extern uint64_t mc_duration, mc_period;
+#include "fx.h"
 
 void multicore_audio_init(void);
 void multicore_audio_select_algo(uint8_t algo);
+void multicore_pipe_proc(const fx_struct *e, void *blk, int16_t *dst, int16_t *src, uint16_t sz);
+void multicore_pipe_reset(void);
 
 #endif
\ No newline at end of file
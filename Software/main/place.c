@@ -0,0 +1,227 @@
+/*
+ * place.c - core, priority & stack for every task
+ * 10-18-26
+ *
+ * All of the firmware's tasks are created from one table, set up in the
+ * "Task placement" menu of menuconfig. The main task and the esp_timer task
+ * that runs the ADC & button timers are IDF's, so they're listed with the
+ * settings IDF gives them.
+ *
+ * With MULTICORE core 1 belongs to audio - the I2S interrupt is allocated
+ * there by the audio task and all DSP runs in it. place_check() walks the
+ * scheduler's task list and flags anything else that can run on core 1,
+ * pinned or not, so SPI flushes, touch scans and timers can never preempt
+ * a block. It runs once at startup and place_poll() repeats it from the
+ * menu tick, so tasks started later by IDF or a driver are caught too.
+ */
+
+#include <string.h>
+#include "esp_task.h"
+#include "sdkconfig.h"
+#include "place.h"
+#include "telem.h"
+
+/* room for a snapshot of every task in the system */
+#define PLACE_MAX_TASKS 24
+
+static const char *TAG = "place";
+
+/* IDF core settings as FreeRTOS core IDs */
+#if defined(CONFIG_ESP_MAIN_TASK_AFFINITY_CPU1)
+#define PLACE_MAIN_CORE 1
+#elif defined(CONFIG_ESP_MAIN_TASK_AFFINITY_NO_AFFINITY)
+#define PLACE_MAIN_CORE tskNO_AFFINITY
+#else
+#define PLACE_MAIN_CORE 0
+#endif
+
+#if defined(CONFIG_ESP_TIMER_TASK_AFFINITY_CPU1)
+#define PLACE_TIMER_CORE 1
+#elif defined(CONFIG_ESP_TIMER_TASK_AFFINITY_NO_AFFINITY)
+#define PLACE_TIMER_CORE tskNO_AFFINITY
+#else
+#define PLACE_TIMER_CORE 0
+#endif
+
+/*
+ * the table
+ */
+static const place_entry place_tbl[PL_NUM] =
+{
+	{"audio",		PLACE_AUDIO_CORE,				CONFIG_S3GTA_AUDIO_TASK_PRIO,	CONFIG_S3GTA_AUDIO_TASK_STACK,	"I2S ISR, fx changes"},
+	{"fork",		PLACE_UI_CORE,					CONFIG_S3GTA_FORK_TASK_PRIO,	CONFIG_S3GTA_FORK_TASK_STACK,	"split blocks"},
+	{"main",		PLACE_MAIN_CORE,				CONFIG_S3GTA_UI_TASK_PRIO,		CONFIG_ESP_MAIN_TASK_STACK_SIZE,	"menu, LCD SPI"},
+	{"touch",		CONFIG_S3GTA_TOUCH_TASK_CORE,	CONFIG_S3GTA_TOUCH_TASK_PRIO,	CONFIG_S3GTA_TOUCH_TASK_STACK,	"touch ring scan"},
+	{"bufclr",		CONFIG_S3GTA_BUFCLR_TASK_CORE,	CONFIG_S3GTA_BUFCLR_TASK_PRIO,	CONFIG_S3GTA_BUFCLR_TASK_STACK,	"delay clears"},
+	{"jobs",		PLACE_UI_CORE,					CONFIG_S3GTA_JOBS_TASK_PRIO,	CONFIG_S3GTA_JOBS_TASK_STACK,	"background DSP"},
+	{"esp_timer",	PLACE_TIMER_CORE,				ESP_TASK_TIMER_PRIO,			CONFIG_ESP_TIMER_TASK_STACK_SIZE,	"button timer"},
+};
+
+/* tasks that belong on the audio core besides ours */
+static const char *place_audio_ok[] =
+{
+	"IDLE1",
+	"ipc1",
+};
+
+/* handles of what's been started */
+static TaskHandle_t place_hdl[PL_NUM];
+
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+static TaskStatus_t place_snap[PLACE_MAX_TASKS];
+#endif
+
+/* offenders at the last check */
+static uint8_t place_bad;
+
+/*
+ * get a table entry
+ */
+const place_entry *place_get(uint8_t id)
+{
+	return id < PL_NUM ? &place_tbl[id] : NULL;
+}
+
+/*
+ * start a task from the table & track its stack
+ */
+BaseType_t place_task_create(uint8_t id, TaskFunction_t fn, void *arg, TaskHandle_t *handle)
+{
+	const place_entry *p = place_get(id);
+	BaseType_t ret;
+	
+	if(!p)
+		return pdFAIL;
+	
+	ret = xTaskCreatePinnedToCore(fn, p->name, p->stack, arg, p->prio, &place_hdl[id], p->core);
+	if(ret != pdPASS)
+	{
+		ESP_LOGW(TAG, "Error creating %s task: %d", p->name, ret);
+		place_hdl[id] = NULL;
+	}
+	else
+		telem_add_task(place_hdl[id], p->name, p->stack);
+	
+	if(handle)
+		*handle = place_hdl[id];
+	return ret;
+}
+
+/*
+ * apply the table to a task IDF started for us - from that task
+ */
+void place_self(uint8_t id)
+{
+	const place_entry *p = place_get(id);
+	
+	if(!p)
+		return;
+	
+	place_hdl[id] = xTaskGetCurrentTaskHandle();
+	vTaskPrioritySet(NULL, p->prio);
+	telem_add_task(place_hdl[id], p->name, p->stack);
+}
+
+/*
+ * core ID as text
+ */
+static const char *place_core_name(BaseType_t core)
+{
+	return core == 0 ? "0" : (core == 1 ? "1" : "any");
+}
+
+/*
+ * print the table & where things actually ended up
+ */
+void place_report(void)
+{
+	const place_entry *p;
+	TaskHandle_t h;
+	uint8_t i;
+	
+	ESP_LOGI(TAG, "Task placement:");
+	for(i=0;i<PL_NUM;i++)
+	{
+		p = &place_tbl[i];
+		h = place_hdl[i];
+		if(!h)
+			h = xTaskGetHandle(p->name);
+		
+		if(h)
+			ESP_LOGI(TAG, "  %-10s core %-3s prio %2d stack %5"PRIu32"  %s", p->name,
+				place_core_name(xTaskGetCoreID(h)), uxTaskPriorityGet(h), p->stack, p->note);
+		else
+			ESP_LOGI(TAG, "  %-10s not running", p->name);
+	}
+}
+
+/*
+ * count what but audio can be scheduled on the audio core, w/ a warning
+ * for each if log is set
+ */
+static uint8_t place_scan(uint8_t log)
+{
+#if !defined(MULTICORE) || !defined(CONFIG_FREERTOS_USE_TRACE_FACILITY)
+	return 0;
+#else
+	UBaseType_t n, i;
+	BaseType_t core;
+	uint8_t j, ok, bad = 0;
+	
+	n = uxTaskGetSystemState(place_snap, PLACE_MAX_TASKS, NULL);
+	if(!n)
+	{
+		if(log)
+			ESP_LOGW(TAG, "More than %d tasks - can't check the audio core", PLACE_MAX_TASKS);
+		return 0;
+	}
+	
+	for(i=0;i<n;i++)
+	{
+		core = xTaskGetCoreID(place_snap[i].xHandle);
+		if((core != PLACE_AUDIO_CORE) && (core != tskNO_AFFINITY))
+			continue;
+		
+		ok = place_snap[i].xHandle == place_hdl[PL_AUDIO];
+		for(j=0;j<sizeof(place_audio_ok)/sizeof(place_audio_ok[0]);j++)
+			ok |= !strcmp(place_snap[i].pcTaskName, place_audio_ok[j]);
+		if(ok)
+			continue;
+		
+		if(log)
+			ESP_LOGW(TAG, "%s (prio %d) can run on audio core %d", place_snap[i].pcTaskName,
+				place_snap[i].uxCurrentPriority, PLACE_AUDIO_CORE);
+		bad++;
+	}
+	
+	return bad;
+#endif
+}
+
+/*
+ * find anything but audio that can be scheduled on the audio core. Returns
+ * the number of offenders
+ */
+uint8_t place_check(void)
+{
+#ifndef MULTICORE
+	ESP_LOGI(TAG, "Audio shares core %d w/ the UI - nothing to check", PLACE_MAIN_CORE);
+#elif !defined(CONFIG_FREERTOS_USE_TRACE_FACILITY)
+	ESP_LOGW(TAG, "CONFIG_FREERTOS_USE_TRACE_FACILITY not set - can't check the audio core");
+#else
+	place_bad = place_scan(1);
+	if(!place_bad)
+		ESP_LOGI(TAG, "Only audio on core %d", PLACE_AUDIO_CORE);
+#endif
+	return place_bad;
+}
+
+/*
+ * check again quietly - from the menu tick. Reports in full when the
+ * number of offenders changes.
+ */
+void place_poll(void)
+{
+	if(place_scan(0) != place_bad)
+		place_check();
+}
@@ -0,0 +1,49 @@
+/*
+ * place.h - core, priority & stack for every task
+ * 10-18-26
+ */
+
+#ifndef __place__
+#define __place__
+
+#include "main.h"
+
+/* audio owns core 1 w/ MULTICORE, everything else goes on core 0 */
+#define PLACE_AUDIO_CORE 1
+#define PLACE_UI_CORE 0
+
+/*
+ * one task or timer service
+ */
+typedef struct
+{
+	const char *name;		/* task name, also used by telem */
+	BaseType_t core;		/* or tskNO_AFFINITY */
+	UBaseType_t prio;
+	uint32_t stack;
+	const char *note;
+} place_entry;
+
+/*
+ * everything we run, plus the IDF tasks our code runs in
+ */
+enum place_ids
+{
+	PL_AUDIO,
+	PL_FORK,
+	PL_UI,
+	PL_TOUCH,
+	PL_BUFCLR,
+	PL_JOBS,
+	PL_TIMER,
+	PL_NUM
+};
+
+const place_entry *place_get(uint8_t id);
+BaseType_t place_task_create(uint8_t id, TaskFunction_t fn, void *arg, TaskHandle_t *handle);
+void place_self(uint8_t id);
+void place_report(void);
+uint8_t place_check(void);
+void place_poll(void);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * telem.c - runtime memory & stack telemetry
+ * 10-18-26
+ *
+ * Collects heap, stack, effect arena and static section usage so buffers
+ * can be sized from measurements. Call telem_update() periodically from
+ * the UI and read the results with telem_get().
+ */
+
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "telem.h"
+
+static const char *TAG = "telem";
+
+static telem_info telem;
+
+/* linker symbols bounding static IRAM & DRAM */
+extern int _iram_start, _iram_end, _data_start, _heap_start;
+
+/*
+ * register a task to track stack headroom for
+ */
+void telem_add_task(TaskHandle_t handle, const char *name, uint32_t stack_sz)
+{
+	telem_task *t;
+	
+	if(!handle || (telem.num_tasks >= TELEM_MAX_TASKS))
+		return;
+	
+	t = &telem.tasks[telem.num_tasks++];
+	t->name = name;
+	t->handle = handle;
+	t->stack_sz = stack_sz;
+	t->headroom = stack_sz;
+}
+
+/*
+ * sample one heap capability
+ */
+static void telem_heap_get(telem_heap *h, uint32_t caps)
+{
+	h->free = heap_caps_get_free_size(caps);
+	h->min_free = heap_caps_get_minimum_free_size(caps);
+	h->largest = heap_caps_get_largest_free_block(caps);
+}
+
+/*
+ * refresh everything - from task context
+ */
+void telem_update(void)
+{
+	uint8_t i;
+	size_t used;
+	
+	/* heaps */
+	telem_heap_get(&telem.internal, MALLOC_CAP_INTERNAL);
+	telem_heap_get(&telem.psram, MALLOC_CAP_SPIRAM);
+	telem_heap_get(&telem.dma, MALLOC_CAP_DMA);
+	
+	/* stacks - IDF reports the high water mark in bytes */
+	for(i=0;i<telem.num_tasks;i++)
+		telem.tasks[i].headroom = uxTaskGetStackHighWaterMark(telem.tasks[i].handle);
+	
+	/* arena peak for the running effect */
+	used = fx_get_mem_used();
+	i = fx_get_algo();
+	telem.arena[i] = used > telem.arena[i] ? used : telem.arena[i];
+	
+	/* static sections */
+	telem.iram = (size_t)&_iram_end - (size_t)&_iram_start;
+	telem.dram = (size_t)&_heap_start - (size_t)&_data_start;
+}
+
+/*
+ * get latest results
+ */
+const telem_info *telem_get(void)
+{
+	return &telem;
+}
+
+/*
+ * dump latest results to the console
+ */
+void telem_log(void)
+{
+	uint8_t i;
+	
+	ESP_LOGI(TAG, "heap int: %d free, %d min, %d largest",
+		telem.internal.free, telem.internal.min_free, telem.internal.largest);
+	ESP_LOGI(TAG, "heap psram: %d free, %d min, %d largest",
+		telem.psram.free, telem.psram.min_free, telem.psram.largest);
+	ESP_LOGI(TAG, "heap dma: %d free, %d min, %d largest",
+		telem.dma.free, telem.dma.min_free, telem.dma.largest);
+	ESP_LOGI(TAG, "static: iram %d, dram %d", telem.iram, telem.dram);
+	for(i=0;i<telem.num_tasks;i++)
+		ESP_LOGI(TAG, "stack %s: %"PRIu32" of %"PRIu32" free", telem.tasks[i].name,
+			telem.tasks[i].headroom, telem.tasks[i].stack_sz);
+	for(i=0;i<FX_NUM_ALGOS;i++)
+		if(telem.arena[i])
+			ESP_LOGI(TAG, "arena %s: %d of %d", fx_get_algo_name_idx(i),
+				telem.arena[i], FX_MAX_MEM);
+}
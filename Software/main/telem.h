@@ -0,0 +1,52 @@
+/*
+ * telem.h - runtime memory & stack telemetry
+ * 10-18-26
+ */
+
+#ifndef __telem__
+#define __telem__
+
+#include "main.h"
+#include "fx.h"
+
+#define TELEM_MAX_TASKS 6
+
+/*
+ * heap state for one capability
+ */
+typedef struct
+{
+	size_t free;
+	size_t min_free;
+	size_t largest;
+} telem_heap;
+
+/*
+ * stack state for one task
+ */
+typedef struct
+{
+	const char *name;
+	TaskHandle_t handle;
+	uint32_t stack_sz;
+	uint32_t headroom;		/* bytes never touched */
+} telem_task;
+
+/*
+ * everything at once
+ */
+typedef struct
+{
+	telem_heap internal, psram, dma;
+	uint8_t num_tasks;
+	telem_task tasks[TELEM_MAX_TASKS];
+	size_t arena[FX_NUM_ALGOS];	/* peak bytes of fx_mem seen per effect */
+	size_t iram, dram;			/* static section usage */
+} telem_info;
+
+void telem_add_task(TaskHandle_t handle, const char *name, uint32_t stack_sz);
+void telem_update(void);
+const telem_info *telem_get(void);
+void telem_log(void);
+
+#endif
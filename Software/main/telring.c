@@ -0,0 +1,164 @@
+/*
+ * telring.c - lock-free telemetry from the audio path to the UI
+ * 10-18-26
+ *
+ * The audio callback pushes one record per block into a single-producer,
+ * single-consumer ring: levels, clip counts, load and a few decimated
+ * output samples. The UI drains it at its own rate and keeps the results.
+ * Each side only ever writes its own index, published with release and
+ * read with acquire, so neither core takes a lock or sees a torn record.
+ *
+ * If the UI falls behind and the ring fills, blocks are folded into an
+ * overflow record that goes out with the next block that fits. Peaks and
+ * clip counts are never lost; only the scope samples from those blocks
+ * are. Peaks are held on the UI side until telring_take_peak() reads them,
+ * so a meter sees the largest sample since it last looked.
+ */
+
+#include <string.h>
+#include "telring.h"
+
+static const char *TAG = "telring";
+
+/* ring & free-running indexes */
+static telring_rec telring_buf[TELRING_LEN];
+static uint32_t telring_head;		/* written by the audio path */
+static uint32_t telring_tail;		/* written by the UI */
+
+/* producer side - blocks that didn't fit */
+static telring_rec telring_ovr;
+static uint32_t telring_ovr_cnt;
+static uint32_t telring_merged;
+
+/* consumer side */
+static telring_stats telring_st;
+
+/*
+ * fold one record into another
+ */
+static inline __attribute__((always_inline)) void telring_merge(telring_rec *dst, const telring_rec *src)
+{
+	uint8_t i;
+	
+	for(i=0;i<TELRING_CHLS;i++)
+	{
+		dst->peak[i] = src->peak[i] > dst->peak[i] ? src->peak[i] : dst->peak[i];
+		dst->clip[i] = dst->clip[i] + src->clip[i] > UINT16_MAX ? UINT16_MAX : dst->clip[i] + src->clip[i];
+	}
+	
+	/* load stays right on average */
+	dst->cyc += src->cyc;
+	dst->period += src->period;
+}
+
+/*
+ * publish a block - from the audio ISR
+ */
+void IRAM_ATTR telring_push(telring_rec *rec)
+{
+	uint32_t head = telring_head;
+	uint32_t tail = __atomic_load_n(&telring_tail, __ATOMIC_ACQUIRE);
+	
+	/* full - hold it for later */
+	if(head - tail >= TELRING_LEN)
+	{
+		telring_merge(&telring_ovr, rec);
+		telring_ovr_cnt++;
+		__atomic_store_n(&telring_merged, telring_merged+1, __ATOMIC_RELAXED);
+		return;
+	}
+	
+	/* catch up on anything held over */
+	if(telring_ovr_cnt)
+	{
+		telring_merge(rec, &telring_ovr);
+		memset(&telring_ovr, 0, sizeof(telring_rec));
+		telring_ovr_cnt = 0;
+	}
+	
+	telring_buf[head & (TELRING_LEN-1)] = *rec;
+	__atomic_store_n(&telring_head, head+1, __ATOMIC_RELEASE);
+}
+
+/*
+ * read everything waiting - from the UI. Returns the number of blocks.
+ */
+uint16_t telring_drain(void)
+{
+	uint32_t head = __atomic_load_n(&telring_head, __ATOMIC_ACQUIRE);
+	uint32_t tail = telring_tail;
+	uint64_t cyc = 0, period = 0;
+	const telring_rec *rec;
+	uint16_t n, load;
+	uint8_t i;
+	
+	for(n=0;tail != head;tail++,n++)
+	{
+		rec = &telring_buf[tail & (TELRING_LEN-1)];
+		
+		for(i=0;i<TELRING_CHLS;i++)
+		{
+			if(rec->peak[i] > telring_st.peak[i])
+				telring_st.peak[i] = rec->peak[i];
+			telring_st.clips[i] += rec->clip[i];
+		}
+		
+		cyc += rec->cyc;
+		period += rec->period;
+		if(rec->period)
+		{
+			load = 1000ULL*rec->cyc/rec->period;
+			telring_st.load_max = load > telring_st.load_max ? load : telring_st.load_max;
+		}
+		
+		for(i=0;i<TELRING_SCOPE;i++)
+		{
+			telring_st.scope[telring_st.scope_idx] = rec->scope[i];
+			telring_st.scope_idx = (telring_st.scope_idx + 1) % TELRING_SCOPE_HIST;
+		}
+	}
+	
+	/* hand the slots back */
+	__atomic_store_n(&telring_tail, tail, __ATOMIC_RELEASE);
+	
+	if(period)
+		telring_st.load = 1000*cyc/period;
+	telring_st.blocks += n;
+	telring_st.merged = __atomic_load_n(&telring_merged, __ATOMIC_RELAXED);
+	return n;
+}
+
+/*
+ * get drained results
+ */
+const telring_stats *telring_get(void)
+{
+	return &telring_st;
+}
+
+/*
+ * get a channel's peak since the last call & start holding again
+ */
+int16_t telring_take_peak(uint8_t chl)
+{
+	int16_t result;
+	
+	if(chl >= TELRING_CHLS)
+		return 0;
+	
+	result = telring_st.peak[chl];
+	telring_st.peak[chl] = 0;
+	return result;
+}
+
+/*
+ * dump results to the console
+ */
+void telring_log(void)
+{
+	ESP_LOGI(TAG, "%"PRIu32" blocks, %"PRIu32" merged, load %d.%d%% max %d.%d%%",
+		telring_st.blocks, telring_st.merged, telring_st.load/10, telring_st.load%10,
+		telring_st.load_max/10, telring_st.load_max%10);
+	ESP_LOGI(TAG, "clips in %"PRIu32"/%"PRIu32" out %"PRIu32"/%"PRIu32, telring_st.clips[1],
+		telring_st.clips[0], telring_st.clips[3], telring_st.clips[2]);
+}
@@ -0,0 +1,55 @@
+/*
+ * telring.h - lock-free telemetry from the audio path to the UI
+ * 10-18-26
+ */
+
+#ifndef __telring__
+#define __telring__
+
+#include "main.h"
+#include "audio.h"
+
+/* records in flight - a power of 2, ~85ms of blocks */
+#define TELRING_LEN 64
+
+/* scope samples per block & history kept for the UI */
+#define TELRING_SCOPE 8
+#define TELRING_SCOPE_HIST 256
+
+/* channels - in R/L, out R/L as the I2S interleaves them */
+#define TELRING_CHLS 4
+
+/*
+ * one block from the audio path
+ */
+typedef struct
+{
+	int16_t peak[TELRING_CHLS];		/* abs peak */
+	uint16_t clip[TELRING_CHLS];	/* samples at full scale, saturating */
+	uint32_t cyc;					/* callback run time */
+	uint32_t period;				/* since the last block started */
+	int16_t scope[TELRING_SCOPE];	/* decimated output, L+R */
+} telring_rec;
+
+/*
+ * everything the UI has drained so far
+ */
+typedef struct
+{
+	uint32_t blocks;				/* records read */
+	uint32_t merged;				/* blocks folded into the next one on overrun */
+	int16_t peak[TELRING_CHLS];		/* held until taken */
+	uint32_t clips[TELRING_CHLS];	/* since boot */
+	uint16_t load;					/* callback over period at last drain, 0.1% */
+	uint16_t load_max;				/* worst single block, 0.1% */
+	int16_t scope[TELRING_SCOPE_HIST];	/* oldest at scope_idx */
+	uint16_t scope_idx;
+} telring_stats;
+
+void telring_push(telring_rec *rec);
+uint16_t telring_drain(void);
+const telring_stats *telring_get(void);
+int16_t telring_take_peak(uint8_t chl);
+void telring_log(void);
+
+#endif
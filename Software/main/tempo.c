@@ -0,0 +1,354 @@
+/*
+ * tempo.c - sync input & tap tempo clock
+ * 10-18-26
+ *
+ * Sync pulses from the back board jack are timestamped in a GPIO interrupt
+ * on core 0 to the microsecond, and taps on the tempo button by the button
+ * timer. Both just post the time to a small ring. Once per block
+ * tempo_block() drains them on the audio core and runs the clock there,
+ * so it has a single writer and effects read it w/o any locking.
+ *
+ * Sync is tracked by a PLL: each pulse is compared to where the clock
+ * predicted it, and the error nudges the phase by half and the period by
+ * an eighth. Pulses that miss by more than a quarter period are ignored,
+ * and if two in a row do, the clock relocks to the new rate. Taps average
+ * the last few intervals and put the beat on the last tap. When pulses
+ * stop, or after the last tap, the clock runs on at its last tempo until
+ * the tap button is held to clear it.
+ */
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "tempo.h"
+#include "fx.h"
+#include "cpuload.h"
+
+/* back board sync jack, inverted by the input transistor */
+#define TEMPO_SYNC_PIN GPIO_NUM_9
+
+/* sync pulses per beat */
+#define TEMPO_PPQN CONFIG_S3GTA_SYNC_PPQN
+
+/* limits, us */
+#define TEMPO_PULSE_MIN 4000
+#define TEMPO_BEAT_MIN 200000
+#define TEMPO_BEAT_MAX 2000000
+
+/* timestamps in flight from each source - a power of 2 */
+#define TEMPO_RING_LEN 8
+
+/* taps averaged */
+#define TEMPO_TAPS 4
+
+/* PLL gains as shifts - phase 1/2, period 1/8 */
+#define TEMPO_KP 1
+#define TEMPO_KF 3
+
+/* misses in a row before relocking */
+#define TEMPO_RELOCK 2
+
+/* pulses missed before sync counts as gone */
+#define TEMPO_LIVE_PULSES 4
+
+static const char *TAG = "tempo";
+
+/*
+ * timestamps from an interrupt or task to the audio core
+ */
+typedef struct
+{
+	int64_t t[TEMPO_RING_LEN];
+	uint32_t head;
+	uint32_t tail;
+} tempo_ring;
+
+static tempo_ring tempo_sync_ring, tempo_tap_ring;
+static uint8_t tempo_clear_req;
+
+/* clock - only touched by tempo_block() */
+static int64_t tempo_anchor;		/* start of the current beat, us Q8 */
+static uint32_t tempo_per;			/* beat, us Q8 */
+static uint32_t tempo_beat;
+
+/* sync PLL */
+static uint8_t tempo_lock, tempo_miss;
+static int64_t tempo_pred;			/* last pulse the PLL accounted for, us Q8 */
+static uint32_t tempo_pp;			/* pulse period, us Q8 */
+static uint32_t tempo_pulses;		/* since lock */
+static int64_t tempo_last_sync;		/* us */
+
+/* taps */
+static int64_t tempo_last_tap;		/* us */
+static uint32_t tempo_tap_iv[TEMPO_TAPS];
+static uint8_t tempo_taps;
+
+static tempo_info tempo_inf;
+
+/*
+ * post a timestamp - one writer per ring
+ */
+static inline void IRAM_ATTR tempo_post(tempo_ring *r, int64_t t)
+{
+	uint32_t head = r->head;
+	
+	/* full - the clock hasn't been run for a while, drop it */
+	if(head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= TEMPO_RING_LEN)
+		return;
+	r->t[head & (TEMPO_RING_LEN-1)] = t;
+	__atomic_store_n(&r->head, head+1, __ATOMIC_RELEASE);
+}
+
+/*
+ * take the oldest timestamp - 0 if none
+ */
+static inline uint8_t IRAM_ATTR tempo_take(tempo_ring *r, int64_t *t)
+{
+	uint32_t tail = r->tail;
+	
+	if(tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+		return 0;
+	*t = r->t[tail & (TEMPO_RING_LEN-1)];
+	__atomic_store_n(&r->tail, tail+1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+/*
+ * sync jack edge - GPIO interrupt on core 0
+ */
+static void IRAM_ATTR tempo_sync_isr(void *arg)
+{
+	uint32_t cyc = esp_cpu_get_cycle_count();
+	
+	tempo_post(&tempo_sync_ring, esp_timer_get_time());
+	cpuload_isr_add(esp_cpu_get_cycle_count() - cyc);
+}
+
+/*
+ * tap - from the button timer, w/ the time the press started
+ */
+void tempo_tap(int64_t t)
+{
+	tempo_post(&tempo_tap_ring, t);
+}
+
+/*
+ * forget the tempo - from the button timer on a long press
+ */
+void tempo_clear(void)
+{
+	__atomic_store_n(&tempo_clear_req, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * put a beat at anchor - counts on if the free running clock hadn't
+ * already got there
+ */
+static void IRAM_ATTR tempo_set(int64_t anchor, uint32_t per, uint8_t src)
+{
+	if(tempo_inf.src == TEMPO_SRC_NONE)
+		tempo_beat = 0;
+	else if(anchor - tempo_anchor > (int64_t)(per>>1))
+		tempo_beat++;
+	tempo_anchor = anchor;
+	tempo_per = per;
+	tempo_inf.src = src;
+}
+
+/*
+ * time between events, saturated
+ */
+static inline uint32_t IRAM_ATTR tempo_since(int64_t t, int64_t last)
+{
+	return (t - last) > UINT32_MAX ? UINT32_MAX : (uint32_t)(t - last);
+}
+
+/*
+ * one sync pulse into the PLL
+ */
+static void IRAM_ATTR tempo_sync_edge(int64_t t)
+{
+	int64_t tq = t<<8;
+	int32_t dt, err;
+	uint32_t n, iv;
+	
+	iv = tempo_since(t, tempo_last_sync);
+	tempo_last_sync = t;
+	
+	/* first pair of pulses in range sets rate & phase */
+	if(!tempo_lock)
+	{
+		if((iv >= TEMPO_PULSE_MIN) && (iv*TEMPO_PPQN >= TEMPO_BEAT_MIN) &&
+			(iv*TEMPO_PPQN <= TEMPO_BEAT_MAX))
+		{
+			tempo_pp = iv<<8;
+			tempo_pred = tq;
+			tempo_pulses = 0;
+			tempo_miss = 0;
+			tempo_lock = 1;
+			tempo_set(tq, tempo_pp*TEMPO_PPQN, TEMPO_SRC_SYNC);
+		}
+		return;
+	}
+	
+	/* gone for more than a beat - start over */
+	if(iv > TEMPO_BEAT_MAX)
+	{
+		tempo_lock = 0;
+		return;
+	}
+	
+	/* nearest predicted pulse & how far off it is */
+	dt = tq - tempo_pred;
+	n = (dt + (tempo_pp>>1)) / tempo_pp;
+	if(!n)
+		return;		/* glitch right after a pulse */
+	err = dt - (int32_t)(n*tempo_pp);
+	
+	/* way off - a couple in a row & the rate has changed */
+	if((err > (int32_t)(tempo_pp>>2)) || (err < -(int32_t)(tempo_pp>>2)))
+	{
+		if(++tempo_miss >= TEMPO_RELOCK)
+			tempo_lock = 0;
+		return;
+	}
+	tempo_miss = 0;
+	
+	/* correct phase & rate */
+	tempo_pred += n*tempo_pp + (err>>TEMPO_KP);
+	tempo_pp += (err/(int32_t)n)>>TEMPO_KF;
+	tempo_pp = tempo_pp < (TEMPO_PULSE_MIN<<8) ? (TEMPO_PULSE_MIN<<8) : tempo_pp;
+	tempo_pulses += n;
+	
+	/* beat follows the PLL on every pulse that starts one */
+	tempo_per = tempo_pp*TEMPO_PPQN;
+	if(!(tempo_pulses % TEMPO_PPQN))
+		tempo_set(tempo_pred, tempo_per, TEMPO_SRC_SYNC);
+}
+
+/*
+ * one tap - ignored while sync is running
+ */
+static void IRAM_ATTR tempo_tap_edge(int64_t t)
+{
+	uint32_t iv = tempo_since(t, tempo_last_tap), sum = 0;
+	uint8_t i;
+	
+	tempo_last_tap = t;
+	if(tempo_inf.live)
+		return;
+	
+	/* too slow - this is the first tap of a new run */
+	if((iv > TEMPO_BEAT_MAX) || (iv < TEMPO_BEAT_MIN))
+	{
+		tempo_taps = 0;
+		return;
+	}
+	
+	for(i=TEMPO_TAPS-1;i;i--)
+		tempo_tap_iv[i] = tempo_tap_iv[i-1];
+	tempo_tap_iv[0] = iv;
+	tempo_taps = tempo_taps < TEMPO_TAPS ? tempo_taps+1 : TEMPO_TAPS;
+	for(i=0;i<tempo_taps;i++)
+		sum += tempo_tap_iv[i];
+	
+	tempo_set(t<<8, (sum/tempo_taps)<<8, TEMPO_SRC_TAP);
+}
+
+/*
+ * update the clock for this block - from the audio callback before the
+ * effect runs
+ */
+void IRAM_ATTR tempo_block(void)
+{
+	int64_t now = esp_timer_get_time(), t;
+	uint32_t d;
+	
+	if(__atomic_load_n(&tempo_clear_req, __ATOMIC_ACQUIRE))
+	{
+		tempo_clear_req = 0;
+		tempo_lock = 0;
+		tempo_taps = 0;
+		tempo_inf.src = TEMPO_SRC_NONE;
+	}
+	
+	/* new edges */
+	while(tempo_take(&tempo_sync_ring, &t))
+		tempo_sync_edge(t);
+	tempo_inf.live = tempo_lock &&
+		(now - tempo_last_sync < (int64_t)TEMPO_LIVE_PULSES*(tempo_pp>>8));
+	while(tempo_take(&tempo_tap_ring, &t))
+		tempo_tap_edge(t);
+	
+	if(tempo_inf.src == TEMPO_SRC_NONE)
+		return;
+	
+	/* free running - keep the anchor within a beat */
+	now <<= 8;
+	while(now - tempo_anchor >= tempo_per)
+	{
+		tempo_anchor += tempo_per;
+		tempo_beat++;
+	}
+	d = now > tempo_anchor ? now - tempo_anchor : 0;
+	
+	tempo_inf.period = ((uint64_t)tempo_per * SAMPLE_RATE) / 1000000;
+	tempo_inf.beat = tempo_beat;
+	tempo_inf.phase = ((uint64_t)d<<16) / tempo_per;
+	tempo_inf.next = ((uint64_t)(tempo_per - d) * SAMPLE_RATE) / (1000000<<8);
+}
+
+/*
+ * the clock as of this block - from the audio core
+ */
+const tempo_info * IRAM_ATTR tempo_get(void)
+{
+	return &tempo_inf;
+}
+
+/*
+ * tempo for display, 0.1 BPM
+ */
+uint32_t tempo_bpm10(void)
+{
+	return tempo_inf.src != TEMPO_SRC_NONE ?
+		((uint64_t)600000000<<8) / tempo_per : 0;
+}
+
+/*
+ * dump the clock to the console
+ */
+void tempo_log(void)
+{
+	static const char *src_names[] = {"none", "tap", "sync"};
+	uint32_t bpm10 = tempo_bpm10();
+	
+	ESP_LOGI(TAG, "%s%s, %"PRIu32".%"PRIu32" BPM, beat %"PRIu32, src_names[tempo_inf.src],
+		tempo_inf.live ? " (live)" : "", bpm10/10, bpm10%10, tempo_inf.beat);
+}
+
+/*
+ * set up the sync input
+ */
+esp_err_t tempo_init(void)
+{
+	esp_err_t err;
+	
+	gpio_config_t io_conf = {
+		.pin_bit_mask = 1ULL<<TEMPO_SYNC_PIN,
+		.mode = GPIO_MODE_INPUT,
+		.pull_up_en = GPIO_PULLUP_ENABLE,
+		.pull_down_en = GPIO_PULLDOWN_DISABLE,
+		.intr_type = GPIO_INTR_NEGEDGE,
+	};
+	gpio_config(&io_conf);
+	
+	/* IRAM so pulses are still caught while flash is written */
+	err = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+	if((err != ESP_OK) && (err != ESP_ERR_INVALID_STATE))
+		return err;
+	err = gpio_isr_handler_add(TEMPO_SYNC_PIN, tempo_sync_isr, NULL);
+	
+	ESP_LOGI(TAG, "Sync on GPIO%d, %d PPQN", TEMPO_SYNC_PIN, TEMPO_PPQN);
+	return err;
+}
@@ -0,0 +1,40 @@
+/*
+ * tempo.h - sync input & tap tempo clock
+ * 10-18-26
+ */
+
+#ifndef __tempo__
+#define __tempo__
+
+#include "main.h"
+
+/* where the tempo came from */
+enum tempo_srcs
+{
+	TEMPO_SRC_NONE,
+	TEMPO_SRC_TAP,
+	TEMPO_SRC_SYNC,
+};
+
+/*
+ * the clock as of the start of the current audio block
+ */
+typedef struct
+{
+	uint8_t src;			/* TEMPO_SRC_NONE if there's no tempo */
+	uint8_t live;			/* sync pulses still arriving */
+	uint32_t period;		/* one beat in samples, Q8 */
+	uint32_t beat;			/* beats since the clock started */
+	uint16_t phase;			/* through the current beat, Q16 */
+	uint32_t next;			/* samples to the next beat */
+} tempo_info;
+
+esp_err_t tempo_init(void);
+void tempo_block(void);
+void tempo_tap(int64_t t);
+const tempo_info *tempo_get(void);
+void tempo_clear(void);
+uint32_t tempo_bpm10(void);
+void tempo_log(void);
+
+#endif
@@ -12,6 +12,7 @@
 #include "driver/touch_pad.h"
 #include "math.h"
 #include "touch_ring.h"
+#include "place.h"
 
 #define TOUCH_BUTTON_NUM    4
 #define TOUCH_CHANGE_CONFIG 0
@@ -177,7 +178,7 @@ void touch_ring_init(void)
 	num_btns = 0;
 
     /* Start task to read values by pads. */
-    xTaskCreate(&touch_ring_read_task, "touch_pad_read_task", 4096, NULL, 5, NULL);
+	place_task_create(PL_TOUCH, touch_ring_read_task, NULL, NULL);
 }
 
 /*
@@ -121,6 +121,41 @@ void widg_sliderH(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t v)
 			gfx_drawhline(y+t, x, x+w);
 }
 
+/*
+ * Rolling graph of a ring of 0-100 values, newest on the right
+ */
+void widg_graph(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *v,
+	uint16_t n, uint16_t oldest)
+{
+	GFX_RECT rect;
+	uint16_t fore, max, rows, c, t, lvl, start;
+	
+	if((w > GRAD_MAX_WIDTH) || (n < w-2))
+		return;
+	
+	/* bounding box */
+	rect.x0 = x;
+	rect.y0 = y;
+	rect.x1 = rect.x0+w;
+	rect.y1 = rect.y0+h;
+	gfx_drawrect(&rect);
+	
+	/* last w-2 samples */
+	fore = gfx_getcolor(gfx_get_forecolor());
+	max = w-2;
+	rows = h-1;
+	start = oldest + n - max;
+	
+	/* blit to display line at a time from the top */
+	for(t=0;t<rows;t++)
+	{
+		lvl = 100*(rows-1-t);
+		for(c=0;c<max;c++)
+			gradient[1][c] = v[(start+c)%n]*rows > lvl ? fore : 0;
+		gfx_bitblt(x+1, y+1+t, max, 1, gradient[1]);
+	}
+}
+
 /*
  * render a button widget
  */
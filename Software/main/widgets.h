@@ -21,6 +21,8 @@ void widg_bargraphH(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t v);
 esp_err_t widg_gradient_init(int16_t width);
 void widg_bargraphHG(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t v);
 void widg_sliderH(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t v);
+void widg_graph(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *v,
+	uint16_t n, uint16_t oldest);
 void widg_button_render(btn_widg *btn, uint8_t state);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+/*
+ * bench_mg4.c - host timing of the ladder filter, per-sample path vs. the
+ * stereo block kernels
+ * 10-18-26
+ *
+ * The same cases as bench_mg4() in main/bench.c, timed w/ the host clock
+ * instead of CCOUNT. An out-of-order desktop core hides most of what the
+ * block kernel does for the S3's in-order pipeline, so this is only a
+ * rough check that nothing got slower - the figures that count come from
+ * the BENCHMARK log on the hardware.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "ifilter_mg4_v1.h"
+
+#define BENCH_FRAMES 64
+#define BENCH_PASSES 4096
+
+static int16_t bench_src[2*BENCH_FRAMES], bench_dst[2*BENCH_FRAMES];
+
+/*
+ * monotonic time in ns
+ */
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(void)
+{
+	const uint8_t modes[] = {MG4_LP, MG4_HP, MG4_BP};
+	const char *names[] = {"LP", "HP", "BP"};
+	ifmg4_state fs[2];
+	ifmg4_stereo_state fsb;
+	int16_t fcm[BENCH_FRAMES];
+	uint64_t t, old, blk, mod;
+	uint32_t i, j, m;
+	
+	for(j=0;j<2*BENCH_FRAMES;j++)
+		bench_src[j] = (int16_t)(j*7919) >> 1;
+	for(j=0;j<BENCH_FRAMES;j++)
+		fcm[j] = 4096 + 64*j;
+	
+	init_ifilter_mg4_lut();
+	for(m=0;m<sizeof(modes);m++)
+	{
+		init_ifilter_mg4(&fs[0]);
+		init_ifilter_mg4(&fs[1]);
+		init_ifilter_mg4_block(&fsb);
+		old = blk = mod = UINT64_MAX;
+		
+		for(i=0;i<BENCH_PASSES;i++)
+		{
+			/* per-sample, coeffs set & copied once per block as before */
+			t = bench_ns();
+			set_ifilter_mg4(&fs[0], 8192, 16384, modes[m]);
+			dupe_ifilter_mg4(&fs[0], &fs[1]);
+			for(j=0;j<BENCH_FRAMES;j++)
+			{
+				bench_dst[2*j] = ifilter_mg4(&fs[0], bench_src[2*j]);
+				bench_dst[2*j+1] = ifilter_mg4(&fs[1], bench_src[2*j+1]);
+			}
+			t = bench_ns() - t;
+			old = t < old ? t : old;
+			
+			/* stereo block */
+			t = bench_ns();
+			set_ifilter_mg4_block(&fsb, 8192, 16384, modes[m]);
+			ifilter_mg4_block(&fsb, bench_dst, bench_src, BENCH_FRAMES);
+			t = bench_ns() - t;
+			blk = t < blk ? t : blk;
+			
+			/* stereo block w/ a cutoff per frame */
+			t = bench_ns();
+			ifilter_mg4_block_mod(&fsb, bench_dst, bench_src, fcm, BENCH_FRAMES);
+			t = bench_ns() - t;
+			mod = t < mod ? t : mod;
+		}
+		
+		printf("bench_mg4 %s: before %.2f ns/smpl, after %.2f ns/smpl, %d%%, modulated %.2f ns/smpl\n",
+			names[m], old/(2.0*BENCH_FRAMES), blk/(2.0*BENCH_FRAMES), (int)(100*blk/old),
+			mod/(2.0*BENCH_FRAMES));
+	}
+	
+	return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * test_dsp_fixed.c - host check of dsp_fixed.h against the expressions it
+ * replaced
+ * 10-18-26
+ *
+ * Every helper is compared bit for bit with the plain C it took the place
+ * of, over the edge values of each type and a long run of pseudo-random
+ * operands. Built for the host, so this covers the portable versions -
+ * the Xtensa ones have to be compared on the target.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "dsp_fixed.h"
+
+/* random operands per check */
+#define TEST_VECS 2000000
+
+static uint32_t test_rng = 0x12345678;
+static uint32_t test_fails;
+
+/*
+ * xorshift - the same vectors every run
+ */
+static uint32_t test_rand(void)
+{
+	test_rng ^= test_rng << 13;
+	test_rng ^= test_rng >> 17;
+	test_rng ^= test_rng << 5;
+	return test_rng;
+}
+
+/*
+ * note a mismatch, only printing the first few of each
+ */
+static void test_check(const char *name, int64_t got, int64_t want, int64_t a, int64_t b)
+{
+	if(got == want)
+		return;
+	if(test_fails++ < 20)
+		printf("FAIL %s(%lld, %lld): got %lld want %lld\n", name,
+			(long long)a, (long long)b, (long long)got, (long long)want);
+}
+
+/*
+ * the old expressions
+ */
+static int32_t ref_clamp(int32_t x, int bits)
+{
+	int32_t hi = (1<<bits)-1, lo = -(1<<bits);
+	
+	return x > hi ? hi : (x < lo ? lo : x);
+}
+
+static int32_t ref_s823mult(int32_t x, int32_t y)
+{
+	int64_t result;
+	
+	result = (int64_t)x * (int64_t)y;
+	result >>= 23;
+	return result;
+}
+
+/* edge values - a few are outside 16 bits for the wider types */
+static const int32_t test_edges[] =
+{
+	0, 1, -1, 2, -2, 4095, 4096, -4096, 32767, -32768, 32766, -32767,
+	65535, -65536, 8388607, -8388608, 8388608, 0x3fffffff, -0x40000000,
+	0x7fffffff, (int32_t)0x80000000, 0x7ffffffe, (int32_t)0x80000001,
+};
+#define TEST_NUM_EDGES (sizeof(test_edges)/sizeof(test_edges[0]))
+
+/*
+ * everything for one pair of operands
+ */
+static void test_pair(int32_t x, int32_t y)
+{
+	int16_t x16 = x, y16 = y;
+	int32_t acc = x>>2;
+	
+	/* saturation */
+	test_check("dsp_ssat16", dsp_ssat16(x), ref_clamp(x, 15), x, 0);
+	test_check("__SSAT7", __SSAT(x, 7), ref_clamp(x, 7), x, 0);
+	test_check("__SSAT15", __SSAT(x, 15), ref_clamp(x, 15), x, 0);
+	test_check("__SSAT22", __SSAT(x, 22), ref_clamp(x, 22), x, 0);
+	
+	/* fft twiddle rounding - a product of two 16-bit values */
+	test_check("dsp_rshift_rnd", dsp_rshift_rnd(x16*y16, 15),
+		(x16*y16 + (1<<14))>>15, x16, y16);
+	
+	/* Q15 */
+	test_check("q15_mul", q15_mul(x16, y16),
+		ref_clamp(((int32_t)x16 * y16) >> 15, 15), x16, y16);
+	test_check("q15_mac", q15_mac(acc, x16, y16), acc + (int32_t)x16 * y16, x16, y16);
+	
+	/* Q31 */
+	test_check("q31_mulh", q31_mulh(x, y), ((int64_t)x * y) >> 32, x, y);
+	test_check("q31_mul", q31_mul(x, y), (int32_t)(((int64_t)x * y) >> 31), x, y);
+	test_check("q31_mac", q31_mac((int64_t)acc*(1<<20), x, y),
+		((int64_t)acc*(1<<20)) + (int64_t)x * y, x, y);
+	
+	/* 12-bit gains - audio.c wet/dry mix, fx_vca.c & fx_cdl.c feedback */
+	test_check("q12_mix", q12_sat16(q12_mac(q12_mac(0, x16, y16 & 0xfff), y16, 0xfff - (y16 & 0xfff))),
+		ref_clamp((x16 * (y16 & 0xfff) + y16 * (0xfff - (y16 & 0xfff)))>>12, 15), x16, y16);
+	test_check("q12_fb", q12_sat16(q12_mac(x16*4096, y16, x16 & 0xfff)),
+		ref_clamp(((x16*4096) + y16 * (x16 & 0xfff))>>12, 15), x16, y16);
+	
+	/* S8.23 */
+	test_check("s823_mul", s823_mul(x, y), ref_s823mult(x, y), x, y);
+	test_check("s823_mul_rnd", s823_mul_rnd(x, y),
+		(int32_t)(((int64_t)x * y + (1<<22)) >> 23), x, y);
+}
+
+int main(void)
+{
+	uint32_t i, j;
+	
+	for(i=0;i<TEST_NUM_EDGES;i++)
+		for(j=0;j<TEST_NUM_EDGES;j++)
+			test_pair(test_edges[i], test_edges[j]);
+	
+	for(i=0;i<TEST_VECS;i++)
+		test_pair(test_rand(), test_rand());
+	
+	/* the one case q15_mul saturates */
+	test_check("q15_mul", q15_mul(-32768, -32768), 32767, -32768, -32768);
+	
+	printf("test_dsp_fixed: %s, %u mismatches\n", test_fails ? "FAIL" : "pass", test_fails);
+	return test_fails ? 1 : 0;
+}
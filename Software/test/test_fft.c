@@ -0,0 +1,159 @@
+/*
+ * test_fft.c - host check of fft.c against a double precision DFT
+ * 10-18-26
+ *
+ * Complex forward, inverse round trip and real transforms at every size
+ * from FFT_MIN_N to FFT_MAX_N, on tones plus noise. Each result is scaled
+ * by its block exponent and its error vs. the DFT must be below the
+ * signal by FFT_TEST_SNR. Rounding noise from 16-bit stages grows about
+ * 3dB each time n doubles, so the limit does too. Built with FFT_PIE_EMU
+ * it checks the PIE stages' data flow the same way.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "fft.h"
+#include "dsp_align.h"
+
+/* worst error allowed, dB below the signal - 58dB at 64 to 40dB at 4096 */
+#define FFT_TEST_SNR(n) (76.0 - 3.0*log2(n))
+
+static int16_t test_buf[2*FFT_MAX_N] DSP_VEC;
+static double test_xr[FFT_MAX_N], test_xi[FFT_MAX_N];
+static double test_cos[FFT_MAX_N], test_sin[FFT_MAX_N];
+static uint32_t test_rng = 0x2545f491;
+static uint32_t test_fails;
+
+/*
+ * xorshift noise, +/- amp
+ */
+static int32_t test_noise(int32_t amp)
+{
+	test_rng ^= test_rng << 13;
+	test_rng ^= test_rng >> 17;
+	test_rng ^= test_rng << 5;
+	return (int32_t)(test_rng % (2*amp+1)) - amp;
+}
+
+/*
+ * bin k of the DFT of test_x - sign -1 forward, +1 inverse
+ */
+static void test_dft(uint32_t n, uint32_t k, int sign, double *re, double *im)
+{
+	uint32_t i, m;
+	
+	*re = *im = 0;
+	for(i=0;i<n;i++)
+	{
+		m = (uint32_t)(((uint64_t)k * i) % n);
+		*re += test_xr[i]*test_cos[m] - sign*test_xi[i]*test_sin[m];
+		*im += test_xi[i]*test_cos[m] + sign*test_xr[i]*test_sin[m];
+	}
+}
+
+/*
+ * report one transform
+ */
+static void test_snr(const char *name, uint32_t n, double sig, double err)
+{
+	double snr = 10.0*log10(sig/err);
+	
+	printf("  %-5s n %4u: %5.1f dB\n", name, n, snr);
+	if(!(snr >= FFT_TEST_SNR(n)))
+	{
+		printf("FAIL %s n %u: %.1f dB\n", name, n, snr);
+		test_fails++;
+	}
+}
+
+int main(void)
+{
+	uint32_t n, i, k;
+	double re, im, gr, gi, sig, err, scale;
+	int8_t exp, exp2;
+	
+	fft_init();
+	for(n=FFT_MIN_N;n<=FFT_MAX_N;n<<=1)
+	{
+		for(i=0;i<n;i++)
+		{
+			test_cos[i] = cos(2.0*M_PI*i/n);
+			test_sin[i] = sin(2.0*M_PI*i/n);
+		}
+		
+		/* complex forward */
+		for(i=0;i<n;i++)
+		{
+			test_buf[2*i] = lrint(16000.0*sin(2.0*M_PI*5.3*i/n)) + test_noise(1000);
+			test_buf[2*i+1] = lrint(8000.0*cos(2.0*M_PI*17.0*i/n)) + test_noise(1000);
+			test_xr[i] = test_buf[2*i];
+			test_xi[i] = test_buf[2*i+1];
+		}
+		if(fft_cplx(test_buf, n, 0, &exp) != ESP_OK)
+			test_fails++;
+		scale = ldexp(1.0, exp);
+		sig = err = 0;
+		for(k=0;k<n;k++)
+		{
+			test_dft(n, k, -1, &re, &im);
+			gr = test_buf[2*k]*scale - re;
+			gi = test_buf[2*k+1]*scale - im;
+			sig += re*re + im*im;
+			err += gr*gr + gi*gi;
+		}
+		test_snr("cplx", n, sig, err);
+		
+		/* inverse back to the input */
+		if(fft_cplx(test_buf, n, 1, &exp2) != ESP_OK)
+			test_fails++;
+		scale = ldexp(1.0, exp+exp2) / n;
+		sig = err = 0;
+		for(i=0;i<n;i++)
+		{
+			gr = test_buf[2*i]*scale - test_xr[i];
+			gi = test_buf[2*i+1]*scale - test_xi[i];
+			sig += test_xr[i]*test_xr[i] + test_xi[i]*test_xi[i];
+			err += gr*gr + gi*gi;
+		}
+		test_snr("inv", n, sig, err);
+		
+		/* real - DC & Nyquist share bin 0 */
+		for(i=0;i<n;i++)
+		{
+			test_buf[i] = lrint(20000.0*sin(2.0*M_PI*3.7*i/n)) + test_noise(2000);
+			test_xr[i] = test_buf[i];
+			test_xi[i] = 0;
+		}
+		if(fft_real(test_buf, n, &exp) != ESP_OK)
+			test_fails++;
+		scale = ldexp(1.0, exp);
+		sig = err = 0;
+		for(k=0;k<=n/2;k++)
+		{
+			test_dft(n, k, -1, &re, &im);
+			if(k == 0)
+				gr = test_buf[0], gi = 0;
+			else if(k == n/2)
+				gr = test_buf[1], gi = 0;
+			else
+				gr = test_buf[2*k], gi = test_buf[2*k+1];
+			gr = gr*scale - re;
+			gi = gi*scale - im;
+			sig += re*re + im*im;
+			err += gr*gr + gi*gi;
+		}
+		test_snr("real", n, sig, err);
+	}
+	
+	/* sizes out of range */
+	if((fft_cplx(test_buf, FFT_MIN_N/2, 0, &exp) == ESP_OK) ||
+		(fft_real(test_buf, FFT_MAX_N+1, &exp) == ESP_OK))
+		test_fails++;
+	
+#ifdef FFT_PIE_EMU
+	printf("test_fft_pie: %s, %u failures\n", test_fails ? "FAIL" : "pass", test_fails);
+#else
+	printf("test_fft: %s, %u failures\n", test_fails ? "FAIL" : "pass", test_fails);
+#endif
+	return test_fails ? 1 : 0;
+}
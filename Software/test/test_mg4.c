@@ -0,0 +1,208 @@
+/*
+ * test_mg4.c - host check of the ladder filter block kernels against the
+ * per-sample path they replaced
+ * 10-18-26
+ *
+ * The block kernels take their coefficients from a table interpolated over
+ * cutoff, so they only match set_ifilter_mg4() where the cutoff falls on a
+ * table point. There the stereo block output must be bit for bit the same
+ * as two per-sample filters, in every mode the old path had, for a range
+ * of resonances and over several blocks so the state carries across. The
+ * modulated kernel w/ a flat cutoff must match the static one, and cutoffs
+ * past MG4_FC_MAX must bypass or mute the same way. Between table points
+ * the difference is printed but not checked. The single channel kernels,
+ * run once per side, must match the stereo ones bit for bit at any cutoff.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "ifilter_mg4_v1.h"
+
+#define TEST_FRAMES 64
+#define TEST_BLOCKS 32
+
+static uint32_t test_rng = 0x12345678;
+static uint32_t test_fails;
+
+/*
+ * xorshift - the same vectors every run
+ */
+static uint32_t test_rand(void)
+{
+	test_rng ^= test_rng << 13;
+	test_rng ^= test_rng >> 17;
+	test_rng ^= test_rng << 5;
+	return test_rng;
+}
+
+/*
+ * stereo noise at about -6dB
+ */
+static void test_fill(int16_t *buf, uint32_t len)
+{
+	while(len--)
+		*buf++ = (int16_t)test_rand() >> 1;
+}
+
+/*
+ * run both paths over the same input, return the largest difference
+ */
+static int32_t test_run(int16_t fc, int16_t res, uint8_t mode, uint8_t mod)
+{
+	ifmg4_state fs[2];
+	ifmg4_stereo_state fsb;
+	int16_t src[2*TEST_FRAMES], ref[2*TEST_FRAMES], dst[2*TEST_FRAMES];
+	int16_t fcm[TEST_FRAMES];
+	int32_t i, j, d, diff = 0;
+	
+	init_ifilter_mg4(&fs[0]);
+	init_ifilter_mg4(&fs[1]);
+	init_ifilter_mg4_block(&fsb);
+	for(j=0;j<TEST_FRAMES;j++)
+		fcm[j] = fc;
+	
+	for(i=0;i<TEST_BLOCKS;i++)
+	{
+		test_fill(src, 2*TEST_FRAMES);
+		
+		/* old per-sample path */
+		set_ifilter_mg4(&fs[0], fc, res, mode);
+		dupe_ifilter_mg4(&fs[0], &fs[1]);
+		for(j=0;j<TEST_FRAMES;j++)
+		{
+			ref[2*j] = ifilter_mg4(&fs[0], src[2*j]);
+			ref[2*j+1] = ifilter_mg4(&fs[1], src[2*j+1]);
+		}
+		
+		set_ifilter_mg4_block(&fsb, fc, res, mode);
+		if(mod)
+			ifilter_mg4_block_mod(&fsb, dst, src, fcm, TEST_FRAMES);
+		else
+			ifilter_mg4_block(&fsb, dst, src, TEST_FRAMES);
+		
+		for(j=0;j<2*TEST_FRAMES;j++)
+		{
+			d = abs(dst[j] - ref[j]);
+			diff = d > diff ? d : diff;
+		}
+	}
+	
+	return diff;
+}
+
+/*
+ * one channel of a mode - the effects pick these at compile time
+ */
+static void test_chl_kernel(ifmg4_stereo_state *f, int16_t *dst, int16_t *src,
+	int16_t *fcm, uint8_t mode, uint8_t chl)
+{
+#define TEST_CHL(name) \
+	if(fcm) \
+		ifilter_mg4_chl_mod_##name(f, dst, src, fcm, TEST_FRAMES, chl); \
+	else \
+		ifilter_mg4_chl_##name(f, dst, src, TEST_FRAMES, chl);
+	
+	switch(mode)
+	{
+		case MG4_LP: TEST_CHL(lp) break;
+		case MG4_HP: TEST_CHL(hp) break;
+		case MG4_BP: TEST_CHL(bp) break;
+		case MG4_NOTCH: TEST_CHL(notch) break;
+		case MG4_LP12: TEST_CHL(lp12) break;
+	}
+}
+
+/*
+ * stereo kernel vs. L & R run separately, w/ a cutoff sweep if mod is set
+ */
+static int32_t test_chl_run(int16_t fc, int16_t res, uint8_t mode, uint8_t mod)
+{
+	ifmg4_stereo_state fs, fsc;
+	int16_t src[2*TEST_FRAMES], ref[2*TEST_FRAMES], dst[2*TEST_FRAMES];
+	int16_t fcm[TEST_FRAMES];
+	int32_t i, j, d, diff = 0;
+	
+	init_ifilter_mg4_block(&fs);
+	init_ifilter_mg4_block(&fsc);
+	for(j=0;j<TEST_FRAMES;j++)
+		fcm[j] = fc + 64*j;
+	
+	for(i=0;i<TEST_BLOCKS;i++)
+	{
+		test_fill(src, 2*TEST_FRAMES);
+		set_ifilter_mg4_block(&fs, fc, res, mode);
+		set_ifilter_mg4_block(&fsc, fc, res, mode);
+		if(mod)
+			ifilter_mg4_block_mod(&fs, ref, src, fcm, TEST_FRAMES);
+		else
+			ifilter_mg4_block(&fs, ref, src, TEST_FRAMES);
+		
+		/* R first so it starts w/ coeffs L hasn't saved yet */
+		test_chl_kernel(&fsc, dst, src, mod ? fcm : NULL, mode, 1);
+		test_chl_kernel(&fsc, dst, src, mod ? fcm : NULL, mode, 0);
+		
+		for(j=0;j<2*TEST_FRAMES;j++)
+		{
+			d = abs(dst[j] - ref[j]);
+			diff = d > diff ? d : diff;
+		}
+	}
+	
+	return diff;
+}
+
+/*
+ * note a mismatch, only printing the first few
+ */
+static void test_check(const char *name, int16_t fc, int16_t res, uint8_t mode, int32_t diff)
+{
+	if(!diff)
+		return;
+	if(test_fails++ < 20)
+		printf("FAIL %s fc %d res %d mode %d: max diff %d\n", name, fc, res, mode, diff);
+}
+
+int main(void)
+{
+	const uint8_t modes[] = {MG4_LP, MG4_HP, MG4_BP};
+	const uint8_t chl_modes[] = {MG4_LP, MG4_HP, MG4_BP, MG4_NOTCH, MG4_LP12};
+	const int16_t res[] = {0, 8192, 16384, 24576, 30000};
+	int32_t m, r, fc, diff, off = 0;
+	
+	init_ifilter_mg4_lut();
+	for(m=0;m<sizeof(modes);m++)
+		for(r=0;r<sizeof(res)/sizeof(res[0]);r++)
+		{
+			/* table points - bit exact, static & modulated */
+			for(fc=0;fc<=MG4_FC_MAX;fc+=1<<MG4_LUT_FRAC)
+			{
+				test_check("block", fc, res[r], modes[m], test_run(fc, res[r], modes[m], 0));
+				test_check("mod", fc, res[r], modes[m], test_run(fc, res[r], modes[m], 1));
+			}
+		
+			/* past the top - bypassed or muted, no table lookup */
+			test_check("bypass", MG4_FC_MAX+1, res[r], modes[m],
+				test_run(MG4_FC_MAX+1, res[r], modes[m], 0));
+		
+			/* between table points - just report */
+			for(fc=(1<<MG4_LUT_FRAC)/2;fc<=MG4_FC_MAX;fc+=1<<MG4_LUT_FRAC)
+			{
+				diff = test_run(fc, res[r], modes[m], 0);
+				off = diff > off ? diff : off;
+			}
+		}
+	
+	/* single channel vs. stereo - any cutoff, every mode */
+	for(m=0;m<sizeof(chl_modes);m++)
+		for(r=0;r<sizeof(res)/sizeof(res[0]);r++)
+			for(fc=0;fc<=MG4_FC_MAX-64*TEST_FRAMES;fc+=1000)
+			{
+				test_check("chl", fc, res[r], chl_modes[m], test_chl_run(fc, res[r], chl_modes[m], 0));
+				test_check("chl mod", fc, res[r], chl_modes[m], test_chl_run(fc, res[r], chl_modes[m], 1));
+			}
+	
+	printf("test_mg4: off-table cutoffs differ by up to %d LSB\n", off);
+	printf("test_mg4: %s, %u failures\n", test_fails ? "FAIL" : "pass", test_fails);
+	return test_fails ? 1 : 0;
+}
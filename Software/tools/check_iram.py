@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+#
+# check_iram.py - verify everything reachable from the audio ISR is in
+# IRAM/DRAM so it survives the cache being disabled during flash writes.
+# 10-18-26
+#
+# Walks the call graph of the final ELF from a set of root functions. Edges
+# are direct calls plus any literal-pool word that holds the address of a
+# function (which is how function pointers and far calls look on Xtensa).
+# Fails if a reachable function lives in flash, or if a reachable function
+# from the main component loads the address of anything in flash.
+#
+# Indirect calls through tables in RAM can't be followed, so their targets
+# need to be given as extra roots.
+
+import argparse
+import bisect
+import re
+import struct
+import subprocess
+import sys
+
+
+class Elf:
+    """just enough ELF32 to map addresses to sections and read words"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from('<HHH', self.data, 0x2e)
+        hdrs = [struct.unpack_from('<IIIIII', self.data, shoff + i * shentsize)
+                for i in range(shnum)]
+        stroff = hdrs[shstrndx][4]
+        self.sections = []
+        for name, typ, flags, addr, offset, size in hdrs:
+            if addr == 0 or size == 0:
+                continue
+            end = self.data.index(b'\0', stroff + name)
+            sname = self.data[stroff + name:end].decode()
+            # SHT_NOBITS has nothing to read
+            self.sections.append((addr, addr + size, sname, None if typ == 8 else offset))
+
+    def section(self, addr):
+        for start, end, name, offset in self.sections:
+            if start <= addr < end:
+                return name, offset - start + addr if offset is not None else None
+        return None, None
+
+    def word(self, addr):
+        name, offset = self.section(addr)
+        if offset is None:
+            return None
+        return struct.unpack_from('<I', self.data, offset)[0]
+
+
+def in_flash(name):
+    return name is not None and name.startswith('.flash')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='check audio ISR call graph is IRAM-safe')
+    parser.add_argument('elf')
+    parser.add_argument('--objdump', default='xtensa-esp32s3-elf-objdump')
+    parser.add_argument('--nm', default='xtensa-esp32s3-elf-nm')
+    parser.add_argument('--lib', help='component library whose functions are checked for flash data refs')
+    parser.add_argument('--root', action='append', default=[], help='root function name')
+    parser.add_argument('--root-re', action='append', default=[], help='regex of root function names')
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+
+    # disassemble everything executable
+    text = [s[2] for s in elf.sections if s[2].startswith('.iram0.text') or s[2].startswith('.flash.text')]
+    cmd = [args.objdump, '-d', '--no-show-raw-insn'] + sum([['-j', t] for t in text], []) + [args.elf]
+    dis = subprocess.run(cmd, check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+
+    func_re = re.compile(r'^([0-9a-f]+) <(.+)>:$')
+    insn_re = re.compile(r'^\s*([0-9a-f]+):\s+(\S+)\s*(.*)$')
+    target_re = re.compile(r'\b([0-9a-f]{8}) <')
+
+    funcs = {}          # addr -> name
+    calls = {}          # addr -> set of called addrs
+    literals = {}       # addr -> set of literal addrs loaded
+    cur = None
+    for line in dis.splitlines():
+        m = func_re.match(line)
+        if m:
+            cur = int(m.group(1), 16)
+            funcs[cur] = m.group(2)
+            calls[cur] = set()
+            literals[cur] = set()
+            continue
+        m = insn_re.match(line)
+        if not m or cur is None:
+            continue
+        op, operands = m.group(2), m.group(3)
+        t = target_re.search(operands)
+        if not t:
+            continue
+        if op.startswith('call') or op == 'j':
+            calls[cur].add(int(t.group(1), 16))
+        elif op == 'l32r':
+            literals[cur].add(int(t.group(1), 16))
+
+    names = {}
+    for addr, name in funcs.items():
+        names.setdefault(name, []).append(addr)
+
+    # functions defined in the main component
+    local = set()
+    if args.lib:
+        out = subprocess.run([args.nm, '--defined-only', args.lib], check=True,
+                             stdout=subprocess.PIPE, universal_newlines=True).stdout
+        for line in out.splitlines():
+            f = line.split()
+            if len(f) == 3 and f[1] in 'Tt':
+                local.add(f[2])
+
+    # symbol names for data addresses in messages
+    out = subprocess.run([args.nm, '-n', args.elf], check=True,
+                         stdout=subprocess.PIPE, universal_newlines=True).stdout
+    syms = []
+    for line in out.splitlines():
+        f = line.split()
+        if len(f) == 3:
+            syms.append((int(f[0], 16), f[2]))
+    sym_addrs = [s[0] for s in syms]
+
+    def symname(addr):
+        i = bisect.bisect_right(sym_addrs, addr) - 1
+        if i < 0:
+            return hex(addr)
+        return '%s+0x%x' % (syms[i][1], addr - syms[i][0])
+
+    # roots
+    roots = []
+    for r in args.root:
+        if r not in names:
+            print('check_iram: root %s not found' % r)
+            return 1
+        roots += names[r]
+    for r in args.root_re:
+        rx = re.compile(r)
+        roots += [a for a, n in funcs.items() if rx.search(n)]
+
+    # walk
+    parent = {a: None for a in roots}
+    todo = list(roots)
+    errors = []
+
+    def path(addr):
+        p = []
+        while addr is not None:
+            p.append(funcs[addr])
+            addr = parent[addr]
+        return ' <- '.join(p)
+
+    while todo:
+        addr = todo.pop()
+        sect, _ = elf.section(addr)
+        if in_flash(sect):
+            errors.append('function in flash: %s' % path(addr))
+            continue
+        edges = set(calls[addr])
+        for lit in literals[addr]:
+            val = elf.word(lit)
+            if val is None:
+                continue
+            if val in funcs:
+                edges.add(val)
+            elif funcs[addr] in local and in_flash(elf.section(val)[0]):
+                errors.append('flash data %s used by %s' % (symname(val), path(addr)))
+        for e in edges:
+            if e in funcs and e not in parent:
+                parent[e] = addr
+                todo.append(e)
+
+    print('check_iram: %d functions reachable from %d roots' % (len(parent), len(roots)))
+    for e in sorted(set(errors)):
+        print('check_iram: ' + e)
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())